@@ -1,7 +1,11 @@
 package eventing_test
 
 import (
+	"fmt"
 	"github.com/abhi-bit/eventing/worker"
+	"io/ioutil"
+	"strings"
+	"sync"
 	"testing"
 )
 
@@ -31,6 +35,51 @@ func BenchmarkCGOCall(b *testing.B) {
 	}
 }
 
+func BenchmarkCGOBatchCall(b *testing.B) {
+	handle := worker.New("app1")
+	handle.Load("app1", "function OnUpdate(doc, meta) { }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+
+	batchSize := 100
+	values := make([]string, batchSize)
+	metas := make([]string, batchSize)
+	types := make([]string, batchSize)
+	for i := 0; i < batchSize; i++ {
+		values[i] = entry.value
+		metas[i] = entry.metadata
+		types[i] = entry.contenType
+	}
+
+	for n := 0; n < b.N; n += batchSize {
+		for _, rc := range handle.SendUpdateBatch(values, metas, types) {
+			if rc != 0 {
+				b.Error("OnUpdate failed with code: ", rc)
+			}
+		}
+	}
+}
+
+func BenchmarkRingSendUpdate(b *testing.B) {
+	handle := worker.New("app1")
+	handle.Load("app1", "function OnUpdate(doc, meta) { }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+	if err := handle.StartRing(64 * 1024 * 1024); err != nil {
+		b.Fatal(err)
+	}
+
+	for n := 0; n < b.N; n++ {
+		handle.RingSendUpdate(entry.value,
+			entry.metadata,
+			entry.contenType)
+	}
+	handle.RingDrain()
+
+	b.StopTimer()
+	stats := handle.RingStats()
+	if stats.RecordsFailed != 0 {
+		b.Error("OnUpdate failed for records: ", stats.RecordsFailed)
+	}
+	handle.StopRing()
+}
+
 func BenchmarkBucketSet(b *testing.B) {
 	handle := worker.New("app1")
 	handle.Load("app1", "function OnUpdate(doc, meta) { credit_bucket[meta.key] = doc; }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
@@ -53,6 +102,17 @@ func BenchmarkBucketGet(b *testing.B) {
 	}
 }
 
+func BenchmarkBucketMultiGet(b *testing.B) {
+	handle := worker.New("app1")
+	handle.Load("app1", "function OnUpdate(doc, meta) { var docs = credit_bucket.multiGet([meta.key, meta.key + '_1', meta.key + '_2', meta.key + '_3', meta.key + '_4']); }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+
+	for n := 0; n < b.N; n++ {
+		handle.SendUpdate(entry.value,
+			entry.metadata,
+			entry.contenType)
+	}
+}
+
 func BenchmarkEnqueue(b *testing.B) {
 	handle := worker.New("app1")
 	handle.Load("app1", "function OnUpdate(doc, meta) { enqueue(order_queue, meta.key); }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
@@ -63,3 +123,215 @@ func BenchmarkEnqueue(b *testing.B) {
 			entry.contenType)
 	}
 }
+
+// Pushes made within one handler invocation go out as a single LPUSH
+func BenchmarkEnqueueBurst(b *testing.B) {
+	handle := worker.New("app1")
+	handle.Load("app1", "function OnUpdate(doc, meta) { for (var i = 0; i < 64; i++) { enqueue(order_queue, meta.key + i); } }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+
+	for n := 0; n < b.N; n++ {
+		handle.SendUpdate(entry.value,
+			entry.metadata,
+			entry.contenType)
+	}
+}
+
+// app2 enqueues into the in-process ring, isolating binding overhead from
+// Redis round trips. dequeue keeps the ring from filling up
+func BenchmarkEnqueueLocal(b *testing.B) {
+	handle := worker.New("app2")
+	handle.Load("app2", "function OnUpdate(doc, meta) { enqueue(order_queue, meta.key)\n dequeue(order_queue); }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+
+	for n := 0; n < b.N; n++ {
+		handle.SendUpdate(entry.value,
+			entry.metadata,
+			entry.contenType)
+	}
+}
+
+// Each iteration schedules 1M timers spread over the next 9 minutes. With
+// the default 10 minute horizon those minutes are entirely within it, so
+// every timer stays in the timing wheel and nothing is spilled to KV
+func BenchmarkTimerSchedule1M(b *testing.B) {
+	handle := worker.New("app1")
+	handle.Load("app1", "function OnUpdate(doc, meta) { for (var i = 0; i < 1000000; i++) { registerCallback('TimerCallback', meta.key + i, 1 + i % 540); } }\n function TimerCallback(docID) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+	defer handle.Dispose()
+
+	for n := 0; n < b.N; n++ {
+		handle.SendUpdate(entry.value,
+			entry.metadata,
+			entry.contenType)
+	}
+}
+
+// Each iteration fires 1M timers that are already due, in one FireTimers
+// call
+func BenchmarkTimerFire1M(b *testing.B) {
+	handle := worker.New("app1")
+	handle.Load("app1", "function OnUpdate(doc, meta) { for (var i = 0; i < 1000000; i++) { registerCallback('TimerCallback', meta.key + i, 25920001); } }\n function TimerCallback(docID) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+	defer handle.Dispose()
+
+	for n := 0; n < b.N; n++ {
+		b.StopTimer()
+		handle.SendUpdate(entry.value,
+			entry.metadata,
+			entry.contenType)
+		b.StartTimer()
+
+		if fired := handle.FireTimers(); fired != 1000000 {
+			b.Error("Timers fired: ", fired)
+		}
+	}
+}
+
+// OnHTTPGet latency while another goroutine keeps feeding mutations to a
+// CPU heavy OnUpdate, with http served either by the DCP isolate or by an
+// isolate of its own as go_eventing's http pool does
+func benchmarkHTTPUnderDCPLoad(b *testing.B, separate bool) {
+	handler := "function OnUpdate(doc, meta) { var s = 0; for (var i = 0; i < 100000; i++) { s += i; } }\n function OnDelete() {}\n function OnHTTPGet(req, res) { res.body.path = req.path; }\n function OnHTTPPost(req, res) {}"
+
+	dcpHandle := worker.New("app1")
+	dcpHandle.Load("app1", handler)
+	defer dcpHandle.Dispose()
+
+	httpHandle := dcpHandle
+	if separate {
+		httpHandle = worker.New("app1")
+		httpHandle.Load("app1", handler)
+		defer httpHandle.Dispose()
+	}
+
+	stop := make(chan struct{})
+	var wg sync.WaitGroup
+	wg.Add(1)
+	go func() {
+		defer wg.Done()
+		for {
+			select {
+			case <-stop:
+				return
+			default:
+				dcpHandle.SendUpdate(entry.value, entry.metadata, entry.contenType)
+			}
+		}
+	}()
+
+	req := "{\"path\":\"bench\",\"host\":\"\"}"
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		httpHandle.SendHTTPGet(req)
+	}
+	b.StopTimer()
+
+	close(stop)
+	wg.Wait()
+}
+
+func BenchmarkHTTPUnderDCPLoadShared(b *testing.B) {
+	benchmarkHTTPUnderDCPLoad(b, false)
+}
+
+func BenchmarkHTTPUnderDCPLoadSeparate(b *testing.B) {
+	benchmarkHTTPUnderDCPLoad(b, true)
+}
+
+// OnHTTPGet returning res.body with a growing number of rows, written out
+// the way go_eventing's http pool does
+func BenchmarkHTTPResponseSize(b *testing.B) {
+	handle := worker.New("app1")
+	handle.Load("app1", "var rows = []; for (var i = 0; i < 32768; i++) { rows.push({id: i, name: \"row\" + i, score: i * 7}); }\n function OnUpdate(doc, meta) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) { res.body.rows = rows.slice(0, req.rows); }\n function OnHTTPPost(req, res) {}")
+	defer handle.Dispose()
+
+	for _, rows := range []int{32, 2048, 32768} {
+		req := fmt.Sprintf("{\"rows\":%d}", rows)
+		size := len(handle.SendHTTPGet(req))
+		b.Run(fmt.Sprintf("%dB", size), func(b *testing.B) {
+			b.SetBytes(int64(size))
+			for n := 0; n < b.N; n++ {
+				handle.WriteHTTPGet(req, ioutil.Discard)
+			}
+		})
+	}
+}
+
+func benchmarkWorkerSpawn(b *testing.B, snapshot bool) {
+	worker.SetStartupSnapshot(snapshot)
+	defer worker.SetStartupSnapshot(false)
+
+	for n := 0; n < b.N; n++ {
+		handle := worker.New("app1")
+		err := handle.Load("app1", "function OnUpdate(doc, meta) { }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+		if err != nil {
+			b.Error(err)
+		}
+		handle.Dispose()
+	}
+}
+
+func BenchmarkWorkerSpawn(b *testing.B) {
+	benchmarkWorkerSpawn(b, false)
+}
+
+func BenchmarkWorkerSpawnSnapshot(b *testing.B) {
+	benchmarkWorkerSpawn(b, true)
+}
+
+// makeDoc returns a JSON document of roughly size bytes
+func makeDoc(size int) string {
+	doc := "{\"ssn\":\"335_12_2551\",\"credit_score\":430,\"padding\":\"\"}"
+	if size <= len(doc) {
+		return doc
+	}
+	return fmt.Sprintf("{\"ssn\":\"335_12_2551\",\"credit_score\":430,\"padding\":\"%s\"}",
+		strings.Repeat("x", size-len(doc)))
+}
+
+func benchmarkDocSize(b *testing.B, handler string) {
+	handle := worker.New("app1")
+	handle.Load("app1", handler+"\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+	defer handle.Dispose()
+
+	for _, size := range []int{256, 4 * 1024, 64 * 1024, 1024 * 1024} {
+		doc := makeDoc(size)
+		b.Run(fmt.Sprintf("%dB", size), func(b *testing.B) {
+			b.SetBytes(int64(len(doc)))
+			for n := 0; n < b.N; n++ {
+				updateErr := handle.SendUpdate(doc, entry.metadata, entry.contenType)
+				if updateErr != nil {
+					b.Error(updateErr)
+				}
+			}
+		})
+	}
+}
+
+func BenchmarkDocSizeMetaOnly(b *testing.B) {
+	benchmarkDocSize(b, "function OnUpdate(doc, meta) { var key = meta.key; }")
+}
+
+func BenchmarkDocSizeFieldRead(b *testing.B) {
+	benchmarkDocSize(b, "function OnUpdate(doc, meta) { var score = doc.credit_score; }")
+}
+
+func BenchmarkCGOMutationBatch(b *testing.B) {
+	handle := worker.New("app1")
+	handle.Load("app1", "function OnUpdate(doc, meta) { }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+
+	batchSize := 100
+	meta := worker.EventMeta{Cas: 0x270df63d0000, Seqno: 1, Vbucket: 7, JSON: true}
+	key := []byte("ijk335_12_2551")
+	value := []byte(entry.value)
+
+	var batch worker.MutationBatch
+	for i := 0; i < batchSize; i++ {
+		batch.Add(&meta, key, value)
+	}
+
+	for n := 0; n < b.N; n += batchSize {
+		for _, rc := range handle.SendMutations(&batch) {
+			if rc != 0 {
+				b.Error("OnUpdate failed with code: ", rc)
+			}
+		}
+	}
+}
@@ -156,11 +156,11 @@ func setUpEventingApp(appName string) {
 	kvaddr := srcEndpoint + ":" + options.kvport
 	kvaddrs := []string{kvaddr}
 
-	// Mutation channel for source bucket
+	// Mutation channels for source bucket, one per DCP connection
 	chans := handleChans{
 		dcpStreamClose:  make(chan string, 1),
 		timerEventClose: make(chan bool, 1),
-		rch:             make(chan []interface{}, 10000),
+		ranges:          newDcpRanges(options.maxVbno, options.dcpConns),
 	}
 
 	tableLock.Lock()
@@ -171,9 +171,20 @@ func setUpEventingApp(appName string) {
 	fmt.Printf("Setting up local tcp port for communication with C++ binding\n")
 	setUpLocalTcpServer(appName)
 
+	// DCP progress is kept in the metadata bucket, streams resume from it
+	checkpoints := newCheckpointStore(appName, bucket, options.maxVbno)
+	if options.checkpoint > 0 {
+		checkpoints.load()
+		checkpoints.start(time.Millisecond * time.Duration(options.checkpoint))
+	}
+
+	// Loaded ahead of the feed, whose flow control window is sized from
+	// the app's isolates
+	workers := loadApp(appName, checkpoints)
+
 	fmt.Printf("Starting up bucket dcp feed for appName: %s with bucket: %s\n",
 		appName, srcBucket)
-	go startBucket(cluster, srcBucket, kvaddrs, chans)
+	go startBucket(cluster, srcBucket, kvaddrs, chans, checkpoints, workers.flow)
 
 	var ticker *time.Ticker
 
@@ -181,16 +192,14 @@ func setUpEventingApp(appName string) {
 		ticker = time.NewTicker(time.Millisecond * time.Duration(options.stats))
 	}
 
-	handle := loadApp(appName)
-
 	config := v8handleBucketConfig{
 		bucket: bucket,
-		handle: handle,
+		handle: workers.primary(),
 		hChans: &chans,
 	}
 
 	timerEventWorkerChannel <- config
 
 	workerWG.Add(1)
-	go runWorker(chans, ticker, appName, handle, bucket)
+	go runWorker(chans, ticker, appName, workers, bucket)
 }
@@ -0,0 +1,86 @@
+package main
+
+import (
+	"time"
+
+	mcd "github.com/couchbase/indexing/secondary/dcp/transport"
+	mc "github.com/couchbase/indexing/secondary/dcp/transport/client"
+)
+
+// coalesceConfig is the opt-in "dedup" section of depcfg. Events are
+// collected for up to window, or till maxEvents of them are queued up,
+// whichever comes first
+type coalesceConfig struct {
+	window    time.Duration
+	maxEvents int
+}
+
+// coalescer keeps only the newest mutation or deletion per vbucket and
+// key out of a window of DCP events. Handlers are expected to be
+// idempotent w.r.t. intermediate versions of a document, only its latest
+// state gets to OnUpdate/OnDelete. Surviving events keep the order of
+// their last occurrence, other events e.g. snapshot markers pass through.
+// Owned by a single isolate routine.
+type coalescer struct {
+	config coalesceConfig
+	events [][]interface{}
+	index  map[coalesceKey]int
+	queued int
+}
+
+type coalesceKey struct {
+	vbucket uint16
+	key     string
+}
+
+func newCoalescer(config coalesceConfig) *coalescer {
+	if config.maxEvents < 1 {
+		config.maxEvents = isolateChanSize
+	}
+	return &coalescer{
+		config: config,
+		events: make([][]interface{}, 0, config.maxEvents),
+		index:  make(map[coalesceKey]int),
+	}
+}
+
+// add queues msg, returns true if it superseded an older event which got
+// dropped
+func (c *coalescer) add(msg []interface{}) bool {
+	c.queued++
+
+	m := msg[1].(*mc.DcpEvent)
+	if m.Opcode != mcd.DCP_MUTATION && m.Opcode != mcd.DCP_DELETION {
+		c.events = append(c.events, msg)
+		return false
+	}
+
+	k := coalesceKey{vbucket: m.VBucket, key: string(m.Key)}
+	i, collapsed := c.index[k]
+	if collapsed {
+		c.events[i] = nil
+	}
+	c.index[k] = len(c.events)
+	c.events = append(c.events, msg)
+	return collapsed
+}
+
+// full tells whether the window's count limit got hit
+func (c *coalescer) full() bool {
+	return c.queued >= c.config.maxEvents
+}
+
+// flush hands surviving events to fn in order and starts a new window
+func (c *coalescer) flush(fn func(msg []interface{})) {
+	for i, msg := range c.events {
+		if msg != nil {
+			fn(msg)
+		}
+		c.events[i] = nil
+	}
+	c.events = c.events[:0]
+	for k := range c.index {
+		delete(c.index, k)
+	}
+	c.queued = 0
+}
@@ -0,0 +1,262 @@
+package main
+
+import (
+	"encoding/json"
+	"fmt"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/couchbase/go-couchbase"
+	mcd "github.com/couchbase/indexing/secondary/dcp/transport"
+	mc "github.com/couchbase/indexing/secondary/dcp/transport/client"
+	"github.com/couchbase/indexing/secondary/logging"
+)
+
+// vbCheckpoint is how far an app got on a vbucket's stream, seqno is that
+// of the last event handed to v8
+type vbCheckpoint struct {
+	Vbuuid    uint64 `json:"vbuuid"`
+	Seqno     uint64 `json:"seqno"`
+	SnapStart uint64 `json:"snap_start"`
+	SnapEnd   uint64 `json:"snap_end"`
+}
+
+// checkpointStore tracks per vbucket DCP progress of an app and
+// periodically writes it to the metadata bucket as a single document, so
+// that a restart resumes streams where they left off instead of replaying
+// the whole bucket. Progress is recorded only after v8 has processed the
+// events, with the shared ring on that's once its consumer has read past
+// them. A crash replays at most one checkpoint interval worth of mutations
+// plus whatever was still in the ring.
+type checkpointStore struct {
+	appName string
+	bucket  *couchbase.Bucket
+	key     string
+
+	lock  sync.Mutex
+	vbs   []vbCheckpoint
+	dirty bool
+
+	running bool
+	stopCh  chan struct{}
+	wg      sync.WaitGroup
+
+	writes    uint64
+	failures  uint64
+	rollbacks uint64
+	resumed   uint64
+}
+
+// checkpointStats is checkpoint stats snapshot exposed via /get_stats/
+type checkpointStats struct {
+	Writes    uint64 `json:"writes"`
+	Failures  uint64 `json:"failures"`
+	Rollbacks uint64 `json:"rollbacks"`
+	Resumed   uint64 `json:"resumed_vbuckets"`
+}
+
+type checkpointDoc struct {
+	Vbuckets map[uint16]vbCheckpoint `json:"vbuckets"`
+}
+
+func newCheckpointStore(appName string, bucket *couchbase.Bucket, maxVbno int) *checkpointStore {
+	return &checkpointStore{
+		appName: appName,
+		bucket:  bucket,
+		key:     fmt.Sprintf("%s::dcp_checkpoint", appName),
+		vbs:     make([]vbCheckpoint, maxVbno),
+		stopCh:  make(chan struct{}),
+	}
+}
+
+// load reads checkpoints written by an earlier run, a missing document
+// means streams start from scratch
+func (store *checkpointStore) load() {
+	data, err := store.bucket.GetRaw(store.key)
+	if err != nil {
+		logging.Infof("App: %s no DCP checkpoints found, streaming from seqno 0",
+			store.appName)
+		return
+	}
+
+	var doc checkpointDoc
+	if err := json.Unmarshal(data, &doc); err != nil {
+		logging.Errorf("App: %s failed to unmarshal DCP checkpoints, err: %v",
+			store.appName, err)
+		return
+	}
+
+	store.lock.Lock()
+	defer store.lock.Unlock()
+	for vbno, cp := range doc.Vbuckets {
+		if int(vbno) < len(store.vbs) {
+			store.vbs[vbno] = cp
+		}
+	}
+	logging.Infof("App: %s loaded DCP checkpoints for %d vbuckets",
+		store.appName, len(doc.Vbuckets))
+}
+
+// streamRequest returns arguments to resume vbno's stream with, along
+// with whether there's anything to resume from
+func (store *checkpointStore) streamRequest(vbno uint16) (vbuuid, start, snapStart, snapEnd uint64, ok bool) {
+	store.lock.Lock()
+	cp := store.vbs[vbno]
+	store.lock.Unlock()
+
+	if cp.Seqno == 0 || cp.Vbuuid == 0 {
+		return 0, 0, 0, 0, false
+	}
+
+	// Snapshot has to enclose start seqno, it doesn't when the marker of
+	// the next snapshot arrived but none of its events made it to v8 yet
+	snapStart, snapEnd = cp.SnapStart, cp.SnapEnd
+	if cp.Seqno < snapStart || cp.Seqno > snapEnd {
+		snapStart, snapEnd = cp.Seqno, cp.Seqno
+	}
+	atomic.AddUint64(&store.resumed, 1)
+	return cp.Vbuuid, cp.Seqno, snapStart, snapEnd, true
+}
+
+// commit records progress made by events already processed by v8, events
+// must be in stream order
+func (store *checkpointStore) commit(events []*mc.DcpEvent) {
+	if len(events) == 0 {
+		return
+	}
+
+	store.lock.Lock()
+	defer store.lock.Unlock()
+
+	for _, m := range events {
+		if int(m.VBucket) >= len(store.vbs) {
+			continue
+		}
+		cp := &store.vbs[m.VBucket]
+
+		switch m.Opcode {
+		case mcd.DCP_STREAMREQ:
+			// Failover log comes newest entry first
+			if m.Status == mcd.SUCCESS && m.FailoverLog != nil && len(*m.FailoverLog) > 0 {
+				cp.Vbuuid = (*m.FailoverLog)[0][0]
+			}
+		case mcd.DCP_SNAPSHOT:
+			cp.SnapStart, cp.SnapEnd = m.SnapstartSeq, m.SnapendSeq
+		case mcd.DCP_MUTATION, mcd.DCP_DELETION, mcd.DCP_EXPIRATION:
+			cp.Seqno = m.Seqno
+		default:
+			continue
+		}
+		store.dirty = true
+	}
+}
+
+// rollback rewinds vbno to the seqno the server asked to roll back to,
+// vbuuid is the failover log entry covering it
+func (store *checkpointStore) rollback(vbno uint16, vbuuid, seqno uint64) {
+	atomic.AddUint64(&store.rollbacks, 1)
+
+	store.lock.Lock()
+	defer store.lock.Unlock()
+
+	if int(vbno) < len(store.vbs) {
+		store.vbs[vbno] = vbCheckpoint{
+			Vbuuid:    vbuuid,
+			Seqno:     seqno,
+			SnapStart: seqno,
+			SnapEnd:   seqno,
+		}
+		store.dirty = true
+	}
+}
+
+func (store *checkpointStore) start(interval time.Duration) {
+	store.running = true
+	store.wg.Add(1)
+	go store.run(interval)
+}
+
+func (store *checkpointStore) run(interval time.Duration) {
+	defer store.wg.Done()
+
+	ticker := time.NewTicker(interval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-ticker.C:
+			store.flush()
+		case <-store.stopCh:
+			return
+		}
+	}
+}
+
+// stop writes out whatever progress is left and stops periodic writes
+func (store *checkpointStore) stop() {
+	if !store.running {
+		return
+	}
+	close(store.stopCh)
+	store.wg.Wait()
+	store.flush()
+}
+
+// flush writes all vbuckets in one go, skipped if nothing moved since the
+// last write
+func (store *checkpointStore) flush() {
+	store.lock.Lock()
+	if !store.dirty {
+		store.lock.Unlock()
+		return
+	}
+	doc := checkpointDoc{Vbuckets: make(map[uint16]vbCheckpoint)}
+	for vbno, cp := range store.vbs {
+		if cp.Vbuuid != 0 || cp.Seqno != 0 {
+			doc.Vbuckets[uint16(vbno)] = cp
+		}
+	}
+	store.dirty = false
+	store.lock.Unlock()
+
+	data, err := json.Marshal(&doc)
+	if err == nil {
+		err = store.bucket.SetRaw(store.key, 0, data)
+	}
+	if err != nil {
+		atomic.AddUint64(&store.failures, 1)
+		logging.Errorf("App: %s failed to write DCP checkpoints, err: %v",
+			store.appName, err)
+
+		// Picked up again by the next tick
+		store.lock.Lock()
+		store.dirty = true
+		store.lock.Unlock()
+		return
+	}
+	atomic.AddUint64(&store.writes, 1)
+}
+
+func (store *checkpointStore) stats() *checkpointStats {
+	return &checkpointStats{
+		Writes:    atomic.LoadUint64(&store.writes),
+		Failures:  atomic.LoadUint64(&store.failures),
+		Rollbacks: atomic.LoadUint64(&store.rollbacks),
+		Resumed:   atomic.LoadUint64(&store.resumed),
+	}
+}
+
+// vbuuidAt returns vbuuid of the failover log entry which seqno falls
+// under, entries are newest first
+func vbuuidAt(flog mc.FailoverLog, seqno uint64) uint64 {
+	for _, entry := range flog {
+		if entry[1] <= seqno {
+			return entry[0]
+		}
+	}
+	if len(flog) > 0 {
+		return flog[len(flog)-1][0]
+	}
+	return 0
+}
@@ -3,11 +3,13 @@ package main
 import (
 	"fmt"
 	"strings"
+	"sync/atomic"
 	"time"
 
 	"github.com/couchbase/indexing/secondary/common"
 	"github.com/couchbase/indexing/secondary/dcp"
 	mcd "github.com/couchbase/indexing/secondary/dcp/transport"
+	mc "github.com/couchbase/indexing/secondary/dcp/transport/client"
 	"github.com/couchbase/indexing/secondary/logging"
 )
 
@@ -18,6 +20,14 @@ var options struct {
 	kvport     string
 	restport   string
 	stats      int // periodic timeout(ms) to print stats, 0 will disable
+	dcpConns   int // DCP connections per app, each streams a vbucket range
+	genChan    int // genChanSize of each DCP connection
+	dataChan   int // dataChanSize of each DCP connection
+	flowBytes  int // DCP bytes an app may buffer ahead of v8
+	checkpoint int // interval(ms) of DCP checkpoint writes, 0 will disable
+	batchSize  int // max mutations sent to v8 in a single cgo call
+	ringSize   int // size(bytes) of ring shared with v8 worker, 0 disables
+	snapshot   bool
 	printflogs bool
 	auth       string
 	info       bool
@@ -25,8 +35,111 @@ var options struct {
 	trace      bool
 }
 
+// streamRollback is the server asking to restart a vbucket's stream from
+// an earlier seqno than requested
+type streamRollback struct {
+	vbno  uint16
+	seqno uint64
+}
+
+// dcpRangeChanSize is depth of the channel between a range's DCP feed and
+// the routine routing its events to isolates
+const dcpRangeChanSize = 10000
+
+// dcpRange is a contiguous slice of vbuckets streamed over a DCP
+// connection of its own. Its events are routed to isolates by a routine of
+// its own too, so that ingestion isn't capped by one socket and one
+// goroutine
+type dcpRange struct {
+	index int
+	vbnos []uint16
+	ch    chan []interface{}
+
+	events     uint64
+	bytes      uint64
+	lagUs      uint64
+	maxLagUs   uint64
+	totalLagUs uint64
+}
+
+// dcpRangeStats is per range stats snapshot exposed via /get_stats/, lag
+// is time from an event being read off the socket till it's routed to an
+// isolate
+type dcpRangeStats struct {
+	Index    int    `json:"index"`
+	VbStart  uint16 `json:"vb_start"`
+	VbEnd    uint16 `json:"vb_end"`
+	Events   uint64 `json:"events"`
+	Bytes    uint64 `json:"bytes"`
+	Pending  int    `json:"pending"`
+	LagUs    uint64 `json:"lag_us"`
+	AvgLagUs uint64 `json:"avg_lag_us"`
+	MaxLagUs uint64 `json:"max_lag_us"`
+}
+
+// newDcpRanges splits vbuckets 0..maxVbno-1 into count ranges of nearly
+// equal size
+func newDcpRanges(maxVbno, count int) []*dcpRange {
+	if count < 1 {
+		count = 1
+	}
+	if count > maxVbno {
+		count = maxVbno
+	}
+
+	vbnos := listOfVbnos(maxVbno)
+	ranges := make([]*dcpRange, count)
+	for i := 0; i < count; i++ {
+		ranges[i] = &dcpRange{
+			index: i,
+			vbnos: vbnos[i*maxVbno/count : (i+1)*maxVbno/count],
+			ch:    make(chan []interface{}, dcpRangeChanSize),
+		}
+	}
+	return ranges
+}
+
+// record accounts for an event once routed to its isolate, only called from
+// the range's routing routine
+func (r *dcpRange) record(m *mc.DcpEvent) {
+	atomic.AddUint64(&r.events, 1)
+	atomic.AddUint64(&r.bytes, uint64(len(m.Key)+len(m.Value)))
+
+	if m.Ctime <= 0 {
+		return
+	}
+	lag := time.Now().UnixNano() - m.Ctime
+	if lag < 0 {
+		lag = 0
+	}
+	lagUs := uint64(lag / int64(time.Microsecond))
+	atomic.StoreUint64(&r.lagUs, lagUs)
+	atomic.AddUint64(&r.totalLagUs, lagUs)
+	if lagUs > atomic.LoadUint64(&r.maxLagUs) {
+		atomic.StoreUint64(&r.maxLagUs, lagUs)
+	}
+}
+
+func (r *dcpRange) stats() dcpRangeStats {
+	stats := dcpRangeStats{
+		Index:    r.index,
+		VbStart:  r.vbnos[0],
+		VbEnd:    r.vbnos[len(r.vbnos)-1],
+		Events:   atomic.LoadUint64(&r.events),
+		Bytes:    atomic.LoadUint64(&r.bytes),
+		Pending:  len(r.ch),
+		LagUs:    atomic.LoadUint64(&r.lagUs),
+		MaxLagUs: atomic.LoadUint64(&r.maxLagUs),
+	}
+	if stats.Events > 0 {
+		stats.AvgLagUs = atomic.LoadUint64(&r.totalLagUs) / stats.Events
+	}
+	return stats
+}
+
 func startBucket(cluster, bucketn string,
-	kvaddrs []string, chans handleChans) {
+	kvaddrs []string, chans handleChans, checkpoints *checkpointStore,
+	flow *flowControl) {
 	defer func() {
 		if r := recover(); r != nil {
 			logging.Errorf("%s:\n%s\n", r, logging.StackTrace())
@@ -50,9 +163,10 @@ func startBucket(cluster, bucketn string,
 	}
 	logging.Infof("Connected with %q\n", bucketn)
 
+	// Applies to each of the range connections
 	dcpConfig := map[string]interface{}{
-		"genChanSize":    10000,
-		"dataChanSize":   10000,
+		"genChanSize":    options.genChan,
+		"dataChanSize":   options.dataChan,
 		"numConnections": 1,
 	}
 
@@ -77,59 +191,119 @@ func startBucket(cluster, bucketn string,
 		printFlogs(vbnos, flogs)
 	}
 
+	done := make(chan struct{})
+	feeds := make([]*couchbase.DcpFeed, len(chans.ranges))
+	for i, r := range chans.ranges {
+		feeds[i] = openDcpFeed(b, fmt.Sprintf("eventing_%d", i), dcpConfig)
+
+		// Stream requests are issued by startDcp, readDcpFeed has to keep
+		// draining the feed meanwhile
+		rollbacks := make(chan streamRollback, len(r.vbnos))
+		go startDcp(feeds[i], r.vbnos, flogs, checkpoints, rollbacks, done)
+		go readDcpFeed(b.Name, feeds[i], r, flow, rollbacks, done)
+	}
+
+	appName := <-chans.dcpStreamClose
+	logging.Infof("Closing dcp streams related to app: %s", appName)
+	close(chans.dcpStreamClose)
+	close(done)
+	for _, dcpFeed := range feeds {
+		dcpFeed.Close()
+	}
+}
+
+func openDcpFeed(b *couchbase.Bucket, name string,
+	dcpConfig map[string]interface{}) *couchbase.DcpFeed {
 	dcpFeed, err := b.StartDcpFeedOver(
-		couchbase.NewDcpFeedName("eventing"),
+		couchbase.NewDcpFeedName(name),
 		uint32(0), options.kvaddrs, 0xABCD, dcpConfig)
 
-	sleep = 1
+	sleep := time.Duration(1)
 	for err != nil {
-		logging.Infof("Unable to open DCP Feed, retrying after %d seconds\n", sleep)
+		logging.Infof("Unable to open DCP Feed: %s, retrying after %d seconds\n",
+			name, sleep)
 		time.Sleep(time.Second * sleep)
 
-		dcpFeed, err = b.StartDcpFeedOver(couchbase.NewDcpFeedName("eventing"),
+		dcpFeed, err = b.StartDcpFeedOver(couchbase.NewDcpFeedName(name),
 			uint32(0), options.kvaddrs, 0xABCD, dcpConfig)
 
 		if sleep < 8 {
 			sleep = sleep * 2
 		}
 	}
+	return dcpFeed
+}
 
-	go startDcp(dcpFeed, flogs, chans)
-
+// readDcpFeed forwards events of a range's feed to the range's channel,
+// which gets closed along with the feed. The feed isn't read while flow
+// control has ingestion paused. Events are dropped once done is closed,
+// nobody reads the range's channel anymore
+func readDcpFeed(bucketName string, dcpFeed *couchbase.DcpFeed, r *dcpRange,
+	flow *flowControl, rollbacks chan streamRollback, done chan struct{}) {
 	for {
+		flow.wait(done)
+
 		e, ok := <-dcpFeed.C
 		if ok == false {
-			logging.Infof("Closing for bucket %q", b.Name)
-			close(chans.rch)
+			logging.Infof("Closing range: %d for bucket %q", r.index, bucketName)
+			close(r.ch)
 			return
 		}
-		chans.rch <- []interface{}{b.Name, e}
+		if e.Opcode == mcd.DCP_STREAMREQ && e.Status == mcd.ROLLBACK {
+			select {
+			case rollbacks <- streamRollback{vbno: e.VBucket, seqno: e.Seqno}:
+			case <-done:
+			}
+			continue
+		}
+		flow.acquire(e)
+		select {
+		case r.ch <- []interface{}{bucketName, e}:
+		case <-done:
+		}
 	}
 }
 
-func startDcp(dcpFeed *couchbase.DcpFeed, flogs couchbase.FailoverLog,
-	hChans handleChans) {
-	start, end := uint64(0), uint64(0xFFFFFFFFFFFFFFFF)
-	snapStart, snapEnd := uint64(0), uint64(0)
-	for vbno, flog := range flogs {
+// startDcp opens a stream per vbucket of vbnos, resuming from the app's
+// checkpoint where there is one. The server answers with a rollback when
+// the checkpoint's vbuuid/seqno isn't part of the vbucket's history
+// anymore e.g. after a failover, the stream is then reopened from the
+// seqno the server asked for
+func startDcp(dcpFeed *couchbase.DcpFeed, vbnos []uint16,
+	flogs couchbase.FailoverLog, checkpoints *checkpointStore,
+	rollbacks chan streamRollback, done chan struct{}) {
+	end := uint64(0xFFFFFFFFFFFFFFFF)
+	for _, vbno := range vbnos {
+		flog := flogs[vbno]
 		x := flog[len(flog)-1] // map[uint16][][2]uint64
 		opaque, flags, vbuuid := uint16(vbno), uint32(0), x[0]
-		logging.Tracef("vbno: %v# flog: %#v vbuuid: %#v opaque: %#v flags: %#v",
-			vbno, flog, vbuuid, opaque, flags)
+		start, snapStart, snapEnd := uint64(0), uint64(0), uint64(0)
+		if cpVbuuid, cpStart, cpSnapStart, cpSnapEnd, ok := checkpoints.streamRequest(vbno); ok {
+			vbuuid, start, snapStart, snapEnd = cpVbuuid, cpStart, cpSnapStart, cpSnapEnd
+		}
+		logging.Tracef("vbno: %v# flog: %#v vbuuid: %#v start: %v opaque: %#v flags: %#v",
+			vbno, flog, vbuuid, start, opaque, flags)
 		err := dcpFeed.DcpRequestStream(
 			vbno, opaque, flags, vbuuid, start, end, snapStart, snapEnd)
 		mf(err, fmt.Sprintf("stream-req for %v failed", vbno))
 	}
 
-	select {
-	case appName := <-hChans.dcpStreamClose:
-		logging.Infof("Closing dcp stream related to app: %s",
-			appName)
-		close(hChans.dcpStreamClose)
-		dcpFeed.Close()
-		return
-	}
+	for {
+		select {
+		case r := <-rollbacks:
+			vbuuid := vbuuidAt(flogs[r.vbno], r.seqno)
+			logging.Infof("vbno: %v rolling back to seqno: %v vbuuid: %#v",
+				r.vbno, r.seqno, vbuuid)
+			checkpoints.rollback(r.vbno, vbuuid, r.seqno)
+
+			err := dcpFeed.DcpRequestStream(r.vbno, r.vbno, uint32(0),
+				vbuuid, r.seqno, end, r.seqno, r.seqno)
+			mf(err, fmt.Sprintf("stream-req after rollback for %v failed", r.vbno))
 
+		case <-done:
+			return
+		}
+	}
 }
 
 func mf(err error, msg string) {
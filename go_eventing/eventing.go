@@ -9,6 +9,7 @@ import (
 	"net/http"
 	"os"
 	"runtime"
+	"strings"
 	"sync"
 
 	"github.com/abhi-bit/eventing/worker"
@@ -37,7 +38,7 @@ var uriPrefixAppnameBackIndex map[string]string
 type handleChans struct {
 	dcpStreamClose  chan string
 	timerEventClose chan bool
-	rch             chan []interface{}
+	ranges          []*dcpRange
 }
 
 type v8handleBucketConfig struct {
@@ -65,6 +66,22 @@ func argParse() {
 		"ns_server port to connect")
 	flag.IntVar(&options.stats, "stats", 100000,
 		"periodic timeout in mS, to print statistics, `0` will disable stats")
+	flag.IntVar(&options.dcpConns, "dcpconns", 1,
+		"DCP connections per app, vbuckets are split into as many ranges")
+	flag.IntVar(&options.genChan, "genchansize", 10000,
+		"genChanSize of each DCP connection")
+	flag.IntVar(&options.dataChan, "datachansize", 10000,
+		"dataChanSize of each DCP connection")
+	flag.IntVar(&options.flowBytes, "flowbytes", 64*1024*1024,
+		"DCP bytes per app buffered ahead of v8 before its feeds are paused")
+	flag.IntVar(&options.checkpoint, "checkpoint", 2000,
+		"interval in mS of DCP checkpoint writes to metadata bucket, `0` replays streams from seqno 0 on restart")
+	flag.IntVar(&options.batchSize, "batchsize", 100,
+		"maximum number of mutations sent to v8 in a single call")
+	flag.IntVar(&options.ringSize, "ringsize", 0,
+		"size in bytes of ring buffer shared with v8 worker, `0` sends mutations synchronously")
+	flag.BoolVar(&options.snapshot, "snapshot", false,
+		"create isolates from a startup snapshot with builtins precompiled")
 	flag.BoolVar(&options.printflogs, "flogs", false,
 		"display failover logs")
 	flag.StringVar(&options.auth, "auth", "Administrator:asdasd",
@@ -78,6 +95,10 @@ func argParse() {
 
 	flag.Parse()
 
+	if options.snapshot {
+		worker.SetStartupSnapshot(true)
+	}
+
 	if options.debug {
 		logging.SetLogLevel(logging.Debug)
 	} else if options.trace {
@@ -138,11 +159,29 @@ func getSource(appName string) (string, string, string) {
 	return "", "", ""
 }
 
+// listApps returns names of app definitions under ./apps/, skipping
+// directories and dotfiles i.e. v8 code cache
+func listApps() ([]string, error) {
+	files, err := ioutil.ReadDir("./apps/")
+	if err != nil {
+		return nil, err
+	}
+
+	apps := make([]string, 0, len(files))
+	for _, file := range files {
+		if file.IsDir() || strings.HasPrefix(file.Name(), ".") {
+			continue
+		}
+		apps = append(apps, file.Name())
+	}
+	return apps, nil
+}
+
 func main() {
 	argParse()
-	files, _ := ioutil.ReadDir("./apps/")
-	for _, file := range files {
-		setUpEventingApp(file.Name())
+	apps, _ := listApps()
+	for _, appName := range apps {
+		setUpEventingApp(appName)
 	}
 
 	go startTimerProcessing()
@@ -152,6 +191,7 @@ func main() {
 		http.Handle("/", fs)
 		http.HandleFunc("/get_application/", fetchAppSetup)
 		http.HandleFunc("/set_application/", storeAppSetup)
+		http.HandleFunc("/get_stats/", fetchAppStats)
 		http.HandleFunc("/start_dbg/", startV8Debugger)
 		http.HandleFunc("/stop_dbg/", stopV8Debugger)
 		http.HandleFunc("/sendmail/", sendMail)
@@ -165,15 +205,15 @@ func main() {
 
 	pwd, _ := os.Getwd()
 	logging.Infof("Eventing Service: Current working dir: %s", pwd)
-	files, err := ioutil.ReadDir("./apps/")
+	apps, err := listApps()
 	if err != nil {
 		logging.Infof("Failed to read application directory, is it missing?\n")
 		os.Exit(1)
 	}
 
 	appSetup = make(chan string, 100)
-	for _, file := range files {
-		appSetup <- file.Name()
+	for _, appName := range apps {
+		appSetup <- appName
 	}
 
 	for {
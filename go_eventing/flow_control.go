@@ -0,0 +1,129 @@
+package main
+
+import (
+	"sync"
+	"time"
+
+	mc "github.com/couchbase/indexing/secondary/dcp/transport/client"
+)
+
+// flowControl bounds DCP events an app has read off its feeds but not yet
+// handed to v8, both in count and in bytes. Once either crosses its high
+// watermark every feed of the app stops being read, the DCP client's own
+// buffers fill up and it stops acking bytes to the server, which in turn
+// stops sending. Reading resumes once both are back under half of their
+// high watermark, so that a slow handler costs a bounded amount of memory
+// instead of buffering without limit.
+type flowControl struct {
+	lock      sync.Mutex
+	maxEvents int64
+	maxBytes  int64
+	events    int64
+	bytes     int64
+
+	paused   bool
+	resume   chan struct{}
+	pausedAt time.Time
+
+	pauses   uint64
+	pausedNs int64
+}
+
+// flowStats is flow control stats snapshot exposed via /get_stats/
+type flowStats struct {
+	Events    int64  `json:"events"`
+	Bytes     int64  `json:"bytes"`
+	MaxEvents int64  `json:"max_events"`
+	MaxBytes  int64  `json:"max_bytes"`
+	Paused    bool   `json:"paused"`
+	Pauses    uint64 `json:"pauses"`
+	PausedMs  int64  `json:"paused_ms"`
+}
+
+func newFlowControl(maxEvents, maxBytes int64) *flowControl {
+	if maxEvents < 2 {
+		maxEvents = 2
+	}
+	if maxBytes < 2 {
+		maxBytes = 2
+	}
+	return &flowControl{
+		maxEvents: maxEvents,
+		maxBytes:  maxBytes,
+	}
+}
+
+// wait blocks while ingestion is paused, or till done gets closed
+func (fc *flowControl) wait(done chan struct{}) {
+	fc.lock.Lock()
+	if !fc.paused {
+		fc.lock.Unlock()
+		return
+	}
+	resume := fc.resume
+	fc.lock.Unlock()
+
+	select {
+	case <-resume:
+	case <-done:
+	}
+}
+
+// acquire accounts for an event read off a feed
+func (fc *flowControl) acquire(m *mc.DcpEvent) {
+	fc.lock.Lock()
+	defer fc.lock.Unlock()
+
+	fc.events++
+	fc.bytes += int64(len(m.Key) + len(m.Value))
+
+	if !fc.paused && (fc.events >= fc.maxEvents || fc.bytes >= fc.maxBytes) {
+		fc.paused = true
+		fc.resume = make(chan struct{})
+		fc.pausedAt = time.Now()
+		fc.pauses++
+	}
+}
+
+// release accounts for events handed to v8
+func (fc *flowControl) release(events []*mc.DcpEvent) {
+	if len(events) == 0 {
+		return
+	}
+
+	var bytes int64
+	for _, m := range events {
+		bytes += int64(len(m.Key) + len(m.Value))
+	}
+
+	fc.lock.Lock()
+	defer fc.lock.Unlock()
+
+	fc.events -= int64(len(events))
+	fc.bytes -= bytes
+
+	if fc.paused && fc.events <= fc.maxEvents/2 && fc.bytes <= fc.maxBytes/2 {
+		fc.paused = false
+		fc.pausedNs += int64(time.Since(fc.pausedAt))
+		close(fc.resume)
+	}
+}
+
+func (fc *flowControl) stats() *flowStats {
+	fc.lock.Lock()
+	defer fc.lock.Unlock()
+
+	pausedNs := fc.pausedNs
+	if fc.paused {
+		pausedNs += int64(time.Since(fc.pausedAt))
+	}
+	return &flowStats{
+		Events:    fc.events,
+		Bytes:     fc.bytes,
+		MaxEvents: fc.maxEvents,
+		MaxBytes:  fc.maxBytes,
+		Paused:    fc.paused,
+		Pauses:    fc.pauses,
+		PausedMs:  pausedNs / int64(time.Millisecond),
+	}
+}
@@ -83,9 +83,7 @@ func handleJsRequests(w http.ResponseWriter, r *http.Request) {
 		if err != nil {
 			logging.Infof("json marshalling of http request failed")
 		}
-		res := workerHTTPReferrerTable[referrer].SendHTTPGet(string(request))
-		w.Header().Set("Content-Type", "application/json")
-		fmt.Fprintf(w, "%s\n", res)
+		serveJsRequest(w, referrer, "GET", req.Path, string(request))
 
 	} else if r.Method == "POST" {
 
@@ -105,18 +103,35 @@ func handleJsRequests(w http.ResponseWriter, r *http.Request) {
 		if err != nil {
 			logging.Infof("json marshalling of http request failed")
 		}
-		res := workerHTTPReferrerTable[referrer].SendHTTPPost(string(request))
-		w.Header().Set("Content-Type", "application/json")
-		fmt.Fprintf(w, "%s\n", res)
+		serveJsRequest(w, referrer, "POST", req.Path, string(request))
+	}
+}
+
+// serveJsRequest hands request over to the app's http isolates, responds
+// with 503 when they are backed up
+func serveJsRequest(w http.ResponseWriter, referrer, method, path, request string) {
+	tableLock.Lock()
+	pool, ok := httpPoolReferrerTable[referrer]
+	tableLock.Unlock()
+
+	if !ok {
+		http.Error(w, "Application missing", http.StatusNotFound)
+		return
+	}
+
+	// Set upfront as the pool writes the body, http.Error overrides it
+	w.Header().Set("Content-Type", "application/json")
+	if !pool.serve(method, path, request, w) {
+		http.Error(w, "Too many requests in flight", http.StatusServiceUnavailable)
 	}
 }
 
 func fetchAppSetup(w http.ResponseWriter, r *http.Request) {
 
-	files, _ := ioutil.ReadDir("./apps/")
-	respData := make([]application, len(files))
-	for index, file := range files {
-		data, _ := ioutil.ReadFile("./apps/" + file.Name())
+	apps, _ := listApps()
+	respData := make([]application, len(apps))
+	for index, appName := range apps {
+		data, _ := ioutil.ReadFile("./apps/" + appName)
 		var app application
 		json.Unmarshal(data, &app)
 		respData[index] = app
@@ -126,6 +141,54 @@ func fetchAppSetup(w http.ResponseWriter, r *http.Request) {
 	fmt.Fprintf(w, "%s\n", data)
 }
 
+// appStats is the payload returned by /get_stats/
+type appStats struct {
+	Name       string           `json:"name"`
+	Processed  uint64           `json:"processed"`
+	Isolates   []isolateStats   `json:"isolates"`
+	HTTP       *httpPoolStats   `json:"http"`
+	Checkpoint *checkpointStats `json:"checkpoint"`
+	DCP        []dcpRangeStats  `json:"dcp"`
+	Flow       *flowStats       `json:"flow"`
+}
+
+func fetchAppStats(w http.ResponseWriter, r *http.Request) {
+	values := r.URL.Query()
+	appName := values.Get("name")
+
+	tableLock.Lock()
+	pool, ok := workerPoolTable[appName]
+	chans := appDoneChans[appName]
+	tableLock.Unlock()
+
+	if !ok {
+		fmt.Fprintf(w, "Application missing\n")
+		return
+	}
+
+	stats := appStats{
+		Name:       appName,
+		Processed:  pool.processed(),
+		Isolates:   pool.isolateStats(),
+		HTTP:       pool.http.stats(),
+		Checkpoint: pool.checkpoints.stats(),
+		DCP:        make([]dcpRangeStats, len(chans.ranges)),
+		Flow:       pool.flow.stats(),
+	}
+	for i, r := range chans.ranges {
+		stats.DCP[i] = r.stats()
+	}
+
+	data, err := json.Marshal(stats)
+	if err != nil {
+		logging.Errorf("Failed to marshal stats for appname: %s", appName)
+		fmt.Fprintf(w, "Failed to fetch stats\n")
+		return
+	}
+	w.Header().Set("Content-Type", "application/json")
+	fmt.Fprintf(w, "%s\n", data)
+}
+
 func storeAppSetup(w http.ResponseWriter, r *http.Request) {
 	values := r.URL.Query()
 	content, _ := ioutil.ReadAll(r.Body)
@@ -0,0 +1,284 @@
+package main
+
+import (
+	"io"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/abhi-bit/eventing/worker"
+	"github.com/couchbase/indexing/secondary/logging"
+)
+
+const (
+	defaultHTTPWorkerCount = 1
+	defaultHTTPQueueSize   = 256
+
+	// Paths come from clients, latency of endpoints past the first
+	// maxHTTPLatencyEndpoints is recorded under httpLatencyOther
+	maxHTTPLatencyEndpoints = 64
+	httpLatencyOther        = "other"
+)
+
+// Upper bounds of latency histogram buckets in microseconds, the last
+// bucket catches everything slower
+var httpLatencyBoundsUs = []uint64{
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000,
+}
+
+// httpPool serves OnHTTPGet/OnHTTPPost on isolates of its own, loaded with
+// the same handler as the worker pool. Slow http handlers thus never hold
+// up DCP processing and DCP bursts don't show up as http latency. Requests
+// that find the queue full are shed right away instead of piling up
+type httpPool struct {
+	appName  string
+	handles  []*worker.Worker
+	requests chan *httpJob
+	stopped  int32
+	wg       sync.WaitGroup
+
+	// dead is closed once every isolate routine has exited, requests
+	// waiting on it are failed instead of hanging
+	running int32
+	dead    chan struct{}
+
+	served uint64
+	shed   uint64
+
+	latencyLock sync.Mutex
+	latency     map[string]*latencyHistogram
+}
+
+type httpJob struct {
+	method   string
+	request  string
+	endpoint string
+	queued   time.Time
+	out      io.Writer
+	done     chan struct{}
+	failed   bool
+}
+
+type latencyHistogram struct {
+	BoundsUs []uint64 `json:"bounds_us"`
+	Counts   []uint64 `json:"counts"`
+	Count    uint64   `json:"count"`
+	AvgUs    uint64   `json:"avg_us"`
+	MaxUs    uint64   `json:"max_us"`
+	totalUs  uint64
+}
+
+// httpPoolStats is http pool stats snapshot exposed via /get_stats/,
+// latency is per "<method> <path>" and includes time spent queued, endpoints
+// past maxHTTPLatencyEndpoints are lumped under "other"
+type httpPoolStats struct {
+	Isolates int                          `json:"isolates"`
+	Queued   int                          `json:"queued"`
+	Served   uint64                       `json:"served"`
+	Shed     uint64                       `json:"shed"`
+	Latency  map[string]*latencyHistogram `json:"latency"`
+}
+
+func newHTTPPool(appName string, handles []*worker.Worker, queueSize int) *httpPool {
+	if queueSize < 1 {
+		queueSize = defaultHTTPQueueSize
+	}
+	return &httpPool{
+		appName:  appName,
+		handles:  handles,
+		requests: make(chan *httpJob, queueSize),
+		latency:  make(map[string]*latencyHistogram),
+		dead:     make(chan struct{}),
+	}
+}
+
+func (pool *httpPool) start() {
+	atomic.StoreInt32(&pool.running, int32(len(pool.handles)))
+	for i := range pool.handles {
+		pool.wg.Add(1)
+		go pool.runIsolate(i)
+	}
+}
+
+// stop aborts running JS and waits for all isolate routines to exit,
+// requests still queued get an empty response
+func (pool *httpPool) stop() {
+	atomic.StoreInt32(&pool.stopped, 1)
+	for _, handle := range pool.handles {
+		handle.TerminateExecution()
+	}
+	close(pool.requests)
+	pool.wg.Wait()
+}
+
+// serve runs request on one of the pool's isolates, which writes response
+// body to out straight from its response buffer. Returns false without
+// blocking if the request queue is full, out is left untouched then. Also
+// returns false if the isolate serving it panicked or no isolate is left
+func (pool *httpPool) serve(method, endpoint, request string, out io.Writer) (ok bool) {
+	if atomic.LoadInt32(&pool.stopped) == 1 {
+		return false
+	}
+	select {
+	case <-pool.dead:
+		return false
+	default:
+	}
+
+	job := &httpJob{
+		method:   method,
+		request:  request,
+		endpoint: method + " " + endpoint,
+		queued:   time.Now(),
+		out:      out,
+		done:     make(chan struct{}),
+	}
+
+	// Sending on requests races with stop closing it
+	defer func() {
+		if r := recover(); r != nil {
+			ok = false
+		}
+	}()
+
+	select {
+	case pool.requests <- job:
+	default:
+		atomic.AddUint64(&pool.shed, 1)
+		return false
+	}
+
+	select {
+	case <-job.done:
+	case <-pool.dead:
+		// Job may have been served right before the last isolate exited
+		select {
+		case <-job.done:
+		default:
+			return false
+		}
+	}
+	return !job.failed
+}
+
+func (pool *httpPool) runIsolate(index int) {
+	defer pool.wg.Done()
+
+	handle := pool.handles[index]
+
+	// Request being served, a panic fails it instead of leaving its caller
+	// waiting
+	var current *httpJob
+
+	defer func() {
+		if r := recover(); r != nil {
+			logging.Errorf("%s:\n%s\n", r, logging.StackTrace())
+			if current != nil {
+				current.failed = true
+				close(current.done)
+			}
+		}
+		if atomic.AddInt32(&pool.running, -1) == 0 {
+			close(pool.dead)
+		}
+	}()
+
+	// Timers registered by http handlers live in this isolate's wheel
+	wheelTicker := time.NewTicker(timerWheelTick)
+	defer wheelTicker.Stop()
+
+	for {
+		select {
+		case <-wheelTicker.C:
+			if atomic.LoadInt32(&pool.stopped) == 0 {
+				handle.FireTimers()
+			}
+
+		case job, ok := <-pool.requests:
+			if !ok {
+				return
+			}
+			if atomic.LoadInt32(&pool.stopped) == 1 {
+				close(job.done)
+				continue
+			}
+
+			// Response buffer is reused by the next request, so the body
+			// is written out before this isolate picks up another job
+			current = job
+			var err error
+			if job.method == "POST" {
+				_, err = handle.WriteHTTPPost(job.request, job.out)
+			} else {
+				_, err = handle.WriteHTTPGet(job.request, job.out)
+			}
+			if err == nil {
+				_, err = io.WriteString(job.out, "\n")
+			}
+			if err != nil {
+				logging.Debugf("App: %s http response write failed: %v", pool.appName, err)
+			}
+			close(job.done)
+			current = nil
+
+			atomic.AddUint64(&pool.served, 1)
+			pool.record(job.endpoint, time.Since(job.queued))
+		}
+	}
+}
+
+func (pool *httpPool) record(endpoint string, elapsed time.Duration) {
+	us := uint64(elapsed / time.Microsecond)
+
+	pool.latencyLock.Lock()
+	defer pool.latencyLock.Unlock()
+
+	h, ok := pool.latency[endpoint]
+	if !ok && len(pool.latency) >= maxHTTPLatencyEndpoints {
+		endpoint = httpLatencyOther
+		h, ok = pool.latency[endpoint]
+	}
+	if !ok {
+		h = &latencyHistogram{
+			BoundsUs: httpLatencyBoundsUs,
+			Counts:   make([]uint64, len(httpLatencyBoundsUs)+1),
+		}
+		pool.latency[endpoint] = h
+	}
+
+	bucket := len(httpLatencyBoundsUs)
+	for i, bound := range httpLatencyBoundsUs {
+		if us <= bound {
+			bucket = i
+			break
+		}
+	}
+	h.Counts[bucket]++
+	h.Count++
+	h.totalUs += us
+	if us > h.MaxUs {
+		h.MaxUs = us
+	}
+}
+
+func (pool *httpPool) stats() *httpPoolStats {
+	stats := &httpPoolStats{
+		Isolates: len(pool.handles),
+		Queued:   len(pool.requests),
+		Served:   atomic.LoadUint64(&pool.served),
+		Shed:     atomic.LoadUint64(&pool.shed),
+		Latency:  make(map[string]*latencyHistogram),
+	}
+
+	pool.latencyLock.Lock()
+	defer pool.latencyLock.Unlock()
+
+	for endpoint, h := range pool.latency {
+		snapshot := *h
+		snapshot.Counts = append([]uint64(nil), h.Counts...)
+		snapshot.AvgUs = h.totalUs / h.Count
+		stats.Latency[endpoint] = &snapshot
+	}
+	return stats
+}
@@ -1,7 +1,6 @@
 package main
 
 import (
-	"strings"
 	"sync"
 	"time"
 
@@ -14,6 +13,15 @@ var timerEventWorkerChannel chan v8handleBucketConfig
 var timerWG sync.WaitGroup
 var fixedZone = time.FixedZone("", 0)
 
+// Timers registered by handlers live in the timing wheel of the isolate
+// that registered them and are fired from this tick by the worker pool.
+// Per second keys are only polled here to drain timers stored in KV by
+// earlier versions
+const timerWheelTick = 100 * time.Millisecond
+
+// Upper bound on per second keys scanned in one tick while catching up
+const maxTimerCatchUp = 60
+
 // NewISO8601 function
 func NewISO8601(t time.Time) time.Time {
 	baseTime := time.Date(
@@ -45,39 +53,42 @@ func processTimerEvent(v8handleBucket v8handleBucketConfig) {
 	}()
 	defer timerWG.Done()
 
+	handle := v8handleBucket.handle
+	bucket := v8handleBucket.bucket
+
+	// Seconds missed while this goroutine was stalled are caught up on
+	// instead of being dropped
+	cursor := NewISO8601(time.Now().UTC())
+
 	timerTicker := time.NewTicker(time.Second)
 	for {
 		select {
 		case <-timerTicker.C:
-			t := NewISO8601(time.Now().UTC())
+			target := NewISO8601(time.Now().UTC())
 
-			handle := v8handleBucket.handle
-			bucket := v8handleBucket.bucket
+			for n := 0; !cursor.After(target) && n < maxTimerCatchUp; n++ {
+				docID := strftime.Format("%Y-%m-%dT%H:%M:%S", cursor)
+				cursor = cursor.Add(time.Second)
 
-			docID := strftime.Format("%Y-%m-%dT%H:%M:%S", t)
+				value := bucketGet(bucket, docID)
+				if value == "" {
+					continue
+				}
 
-			valueCh := make(chan string, 1)
-			// Enforcing timeout on bucket operations
-			select {
-			case valueCh <- bucketGet(bucket, docID):
-				value := <-valueCh
 				tableLock.Lock()
 				logging.Tracef("Processed timer event for docid: %#v bucket: %s",
 					docID, workerHTTPReferrerTableBackIndex[handle])
 				tableLock.Unlock()
-				handle.SendTimerCallback(value)
 
-				// Purge all timer event and docid once they are processed
+				// Timer blobs are removed by the worker in one batch
+				handle.SendTimerCallback(value)
 				bucket.Delete(docID)
-				keys := strings.Split(value, ";")
-				for index := range keys {
-					bucket.Delete(keys[index])
-				}
+			}
 
-			case <-time.After(time.Second * 1):
-				// Enforced 1 second timeout on bucket fetch operation
-				logging.Errorf("Timer event docid: %s fetch failed", docID)
+			if lag := target.Sub(cursor); lag > 0 {
+				logging.Infof("Timer scan lagging behind wall clock by %v", lag)
 			}
+
 		case <-v8handleBucket.hChans.timerEventClose:
 			logging.Infof("Recieved message. Going to stop timer routine")
 			timerTicker.Stop()
@@ -5,7 +5,6 @@ import (
 	"fmt"
 	"io/ioutil"
 	_ "net/http/pprof"
-	"strconv"
 	"sync"
 	"sync/atomic"
 	"time"
@@ -23,19 +22,14 @@ const (
 )
 
 var workerTable = make(map[string]*worker.Worker)
+var workerPoolTable = make(map[string]*workerPool)
 var workerHTTPReferrerTable = make(map[string]*worker.Worker)
 var workerHTTPReferrerTableBackIndex = make(map[*worker.Worker]string)
+var httpPoolReferrerTable = make(map[string]*httpPool)
 var workerChannel chan *worker.Worker
 var tableLock sync.Mutex
 
-type eventMeta struct {
-	Key    string `json:"key"`
-	Type   string `json:"type"`
-	Cas    string `json:"cas"`
-	Expiry string `json:"expiry"`
-}
-
-func loadApp(appName string) *worker.Worker {
+func loadApp(appName string, checkpoints *checkpointStore) *workerPool {
 	data, err := ioutil.ReadFile("./apps/" + appName)
 	if err != nil {
 		logging.Infof("Failed to load application JS file\n")
@@ -48,17 +42,84 @@ func loadApp(appName string) *worker.Worker {
 			appName)
 	}
 
-	logging.Infof("Loading application handler for app: %s\n", appName)
+	config := app.DeploymentConfig.(map[string]interface{})
+
+	workerCount := 1
+	if count, ok := config["worker_count"].(float64); ok && count > 1 {
+		workerCount = int(count)
+	}
+
+	logging.Infof("Loading application handler for app: %s on %d isolate(s)\n",
+		appName, workerCount)
+
+	handles := make([]*worker.Worker, workerCount)
+	for i := 0; i < workerCount; i++ {
+		handle := worker.New(appName)
+		handle.SetTimerScope(fmt.Sprintf("worker_%d", i))
+		if err := handle.Load(appName, app.AppHandlers); err != nil {
+			logging.Errorf("App: %s isolate: %d failed to load handlers, err: %s",
+				appName, i, err.Error())
+		}
+
+		if options.ringSize > 0 {
+			if err := handle.StartRing(uint64(options.ringSize)); err != nil {
+				logging.Errorf("App: %s isolate: %d failed to set up shared ring, err: %s",
+					appName, i, err.Error())
+			}
+		}
+		handles[i] = handle
+	}
+
+	httpWorkerCount := defaultHTTPWorkerCount
+	if count, ok := config["http_worker_count"].(float64); ok && count > 1 {
+		httpWorkerCount = int(count)
+	}
+	httpQueueSize := defaultHTTPQueueSize
+	if size, ok := config["http_queue_size"].(float64); ok && size > 0 {
+		httpQueueSize = int(size)
+	}
+
+	httpHandles := make([]*worker.Worker, httpWorkerCount)
+	for i := 0; i < httpWorkerCount; i++ {
+		handle := worker.New(appName)
+		handle.SetTimerScope(fmt.Sprintf("http_%d", i))
+		if err := handle.Load(appName, app.AppHandlers); err != nil {
+			logging.Errorf("App: %s http isolate: %d failed to load handlers, err: %s",
+				appName, i, err.Error())
+		}
+		httpHandles[i] = handle
+	}
+
+	// Window covers what the isolates' queues hold
+	flow := newFlowControl(int64(workerCount*isolateChanSize),
+		int64(options.flowBytes))
+
+	// Opt-in, coalesces mutations of a key within a window of events
+	var dedup *coalesceConfig
+	if dedupConfig, ok := config["dedup"].(map[string]interface{}); ok {
+		windowMs, _ := dedupConfig["window_ms"].(float64)
+		maxEvents, _ := dedupConfig["max_events"].(float64)
+		if windowMs > 0 || maxEvents > 0 {
+			dedup = &coalesceConfig{
+				window:    time.Duration(windowMs) * time.Millisecond,
+				maxEvents: int(maxEvents),
+			}
+			logging.Infof("App: %s coalescing mutations, window: %v max events: %d",
+				appName, dedup.window, dedup.maxEvents)
+		}
+	}
 
-	newHandle := worker.New(appName)
+	pool := newWorkerPool(appName, handles,
+		newHTTPPool(appName, httpHandles, httpQueueSize), checkpoints, flow,
+		dedup)
+	newHandle := pool.primary()
 	newHandle.Quit = make(chan string, 1)
-	newHandle.Load(appName, app.AppHandlers)
 
 	tableLock.Lock()
 	workerTable[appName] = newHandle
+	workerPoolTable[appName] = pool
 	tableLock.Unlock()
 
-	config := app.DeploymentConfig.(map[string]interface{})
 	httpConfigs := config["http"].([]interface{})
 
 	for appIndex := 0; appIndex < len(httpConfigs); appIndex++ {
@@ -67,87 +128,89 @@ func loadApp(appName string) *worker.Worker {
 		tableLock.Lock()
 		workerHTTPReferrerTable[referrer] = newHandle
 		workerHTTPReferrerTableBackIndex[newHandle] = referrer
+		httpPoolReferrerTable[referrer] = pool.http
 		tableLock.Unlock()
 	}
-	return newHandle
+	return pool
 }
 
-func handleDcpEvent(handle *worker.Worker, msg []interface{},
-	bucket *couchbase.Bucket, ops *uint64) {
+// queueMutation hands DCP_MUTATION over to the shared ring if enabled,
+// otherwise buffers it so that the batch could be sent to v8 with a single
+// cgo call
+func queueMutation(handle *worker.Worker, batch *worker.MutationBatch,
+	meta *worker.EventMeta, key, value []byte) {
+	if handle.RingEnabled() {
+		handle.RingSendMutation(meta, key, value)
+		return
+	}
+	batch.Add(meta, key, value)
+}
+
+func flushMutations(handle *worker.Worker, batch *worker.MutationBatch) {
+	if batch.Len() == 0 {
+		return
+	}
+
+	results := handle.SendMutations(batch)
+	for i, rc := range results {
+		if rc != 0 {
+			logging.Infof("OnUpdate failed with code: %d for mutation: %d of batch: %d",
+				rc, i, len(results))
+		}
+	}
+	batch.Reset()
+}
+
+// handleDcpEvent runs on isolate routines, appName is passed in as the
+// referrer tables may be concurrently updated by app stop
+func handleDcpEvent(handle *worker.Worker, appName string, msg []interface{},
+	bucket *couchbase.Bucket, ops *uint64, batch *worker.MutationBatch) {
 	m := msg[1].(*mc.DcpEvent)
 	if m.Opcode == mcd.DCP_MUTATION {
 
 		bucketName := msg[0].(string)
-		// Fetching CAS value from KV to ensure idempotent-ness of callback handlers
-		casValue := fmt.Sprintf("%d", m.Cas)
-		_, err := bucket.GetRaw(casValue)
-
-		if err != nil {
-			atomic.AddUint64(ops, 1)
-			logging.Infof("Sending key: %s from bucket: %s to handle: %s flags: %x",
-				string(m.Key), bucketName,
-				workerHTTPReferrerTableBackIndex[handle], m.Flags)
-			logging.Tracef("DCP_MUTATION opcode flag %x cas: %x error: %#v\n",
-				m.Flags, m.Cas, err.Error())
-
-			if m.Flags == JSONType {
-
-				meta := eventMeta{Key: string(m.Key),
-					Type:   "json",
-					Cas:    strconv.FormatUint(m.Cas, 16),
-					Expiry: fmt.Sprint(m.Expiry),
-				}
-
-				mEvent, err := json.Marshal(meta)
-				if err == nil {
-					//TODO: check for return code of SendUpdate
-					logging.Infof("Sending DCP_MUTATION to: %s meta dump: %#v \n",
-						workerHTTPReferrerTableBackIndex[handle], meta)
-					handle.SendUpdate(string(m.Value), string(mEvent), "json")
-				} else {
-					logging.Infof("Failed to marshal update event: %#v\n", meta)
-				}
-			} else {
-
-				meta := eventMeta{Key: string(m.Key),
-					Type:   "base64",
-					Cas:    strconv.FormatUint(m.Cas, 16),
-					Expiry: fmt.Sprint(m.Expiry),
-				}
-
-				mEvent, err := json.Marshal(meta)
-				if err == nil {
-					//TODO: check for return code of SendUpdate
-					handle.SendUpdate(string(m.Value), string(mEvent), "non-json")
-				} else {
-					logging.Infof("Failed to marshal update event: %#v\n", meta)
-				}
 
-			}
-		} else {
-			logging.Tracef("Skipped mutation triggered by handler code, cas: %s",
-				casValue)
-			bucket.Delete(casValue)
+		// Mutations generated by the handler's own writes are dropped by
+		// the binding's recursion filter, without any KV lookups
+		atomic.AddUint64(ops, 1)
+		logging.Infof("Sending key: %s from bucket: %s to app: %s flags: %x",
+			string(m.Key), bucketName, appName, m.Flags)
+
+		meta := worker.EventMeta{
+			Cas:     m.Cas,
+			Seqno:   m.Seqno,
+			Expiry:  m.Expiry,
+			Vbucket: m.VBucket,
+			JSON:    m.Flags == JSONType,
 		}
+		logging.Infof("Queueing DCP_MUTATION to: %s meta dump: %#v \n",
+			appName, meta)
+		queueMutation(handle, batch, &meta, m.Key, m.Value)
 
 	} else if m.Opcode == mcd.DCP_DELETION {
 
+		// Preserve ordering w.r.t. mutations queued ahead of the deletion
+		flushMutations(handle, batch)
+
 		msg, err := json.Marshal(m)
 		if err != nil {
 			logging.Infof("Failed to marshal delete event: %#v\n", m)
 		}
-		if err := handle.SendDelete(string(msg)); err == nil {
+		if handle.RingEnabled() {
+			handle.RingSendDelete(string(msg))
+			atomic.AddUint64(ops, 1)
+		} else if err := handle.SendDelete(string(msg)); err == nil {
 			atomic.AddUint64(ops, 1)
 		}
 	}
 }
 
 func runWorker(chans handleChans, ticker *time.Ticker,
-	aName string, handle *worker.Worker, bucket *couchbase.Bucket) {
+	aName string, pool *workerPool, bucket *couchbase.Bucket) {
 	defer workerWG.Done()
 
 	var appName string
-	var ops uint64
+	handle := pool.primary()
 
 	defer func() {
 		if r := recover(); r != nil {
@@ -155,6 +218,16 @@ func runWorker(chans handleChans, ticker *time.Ticker,
 		}
 	}()
 
+	pool.start(bucket)
+
+	// Every vbucket range is routed to isolates by a routine of its own
+	stopRanges := make(chan struct{})
+	var rangeWG sync.WaitGroup
+	for _, r := range chans.ranges {
+		rangeWG.Add(1)
+		go runRange(aName, r, pool, stopRanges, &rangeWG)
+	}
+
 	tableLock.Lock()
 	logging.Tracef("INIT: handle: %#v \nBI: %#v \nchan item left count: %d",
 		handle, workerHTTPReferrerTableBackIndex[handle], len(workerChannel))
@@ -174,6 +247,8 @@ func runWorker(chans handleChans, ticker *time.Ticker,
 			referrer := workerHTTPReferrerTableBackIndex[handle]
 			delete(workerHTTPReferrerTable, referrer)
 			delete(workerHTTPReferrerTableBackIndex, handle)
+			delete(httpPoolReferrerTable, referrer)
+			delete(workerPoolTable, appName)
 
 			hChans := appDoneChans[appName]
 			hChans.dcpStreamClose <- appName
@@ -184,16 +259,48 @@ func runWorker(chans handleChans, ticker *time.Ticker,
 			delete(appDoneChans, appName)
 
 			ticker.Stop()
-			handle.TerminateExecution()
+			close(stopRanges)
+			rangeWG.Wait()
+			pool.stop()
 			tableLock.Unlock()
 			return
 
-		case msg := <-chans.rch:
-			handleDcpEvent(handle, msg, bucket, &ops)
-
 		case <-ticker.C:
 			logging.Infof("Appname: %s Processed %d mutations",
-				aName, atomic.LoadUint64(&ops))
+				aName, pool.processed())
+			for _, stats := range pool.isolateStats() {
+				logging.Infof("Appname: %s isolate stats: %#v", aName, stats)
+			}
+			for _, r := range chans.ranges {
+				logging.Infof("Appname: %s dcp range stats: %#v", aName, r.stats())
+			}
+			logging.Infof("Appname: %s flow control stats: %#v", aName, *pool.flow.stats())
+		}
+	}
+}
+
+// runRange routes events of a vbucket range to isolates till either the
+// range's feed is closed or stop is
+func runRange(aName string, r *dcpRange, pool *workerPool,
+	stop chan struct{}, wg *sync.WaitGroup) {
+	defer wg.Done()
+
+	for {
+		select {
+		case msg, ok := <-r.ch:
+			if !ok {
+				logging.Infof("Appname: %s mutation channel of range: %d closed",
+					aName, r.index)
+				return
+			}
+			// Lag includes time spent waiting on a full isolate queue
+			if !pool.route(msg, stop) {
+				return
+			}
+			r.record(msg[1].(*mc.DcpEvent))
+
+		case <-stop:
+			return
 		}
 	}
 }
@@ -0,0 +1,309 @@
+package main
+
+import (
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/abhi-bit/eventing/worker"
+	"github.com/couchbase/go-couchbase"
+	mc "github.com/couchbase/indexing/secondary/dcp/transport/client"
+	"github.com/couchbase/indexing/secondary/logging"
+)
+
+const isolateChanSize = 1000
+
+// workerPool runs an app's handler on multiple v8 isolates, DCP events are
+// routed by vbucket so per-document ordering is preserved. http requests
+// are served by a separate set of isolates. Every isolate releases flow
+// control window once a batch has been handed to v8, and reports DCP
+// progress of its vbuckets to checkpoints once v8 has processed it
+type workerPool struct {
+	appName     string
+	handles     []*worker.Worker
+	chans       []chan []interface{}
+	stats       []isolateCounters
+	http        *httpPool
+	checkpoints *checkpointStore
+	flow        *flowControl
+	dedup       *coalesceConfig
+	stopped     int32
+	wg          sync.WaitGroup
+}
+
+// ringBatch is DCP progress of a batch copied into the shared ring, it's
+// committed once the ring consumer has read past tail
+type ringBatch struct {
+	tail   uint64
+	events []*mc.DcpEvent
+}
+
+type isolateCounters struct {
+	ops       uint64
+	batches   uint64
+	collapsed uint64
+}
+
+// isolateStats is per isolate stats snapshot exposed via /get_stats/
+type isolateStats struct {
+	Index     int               `json:"index"`
+	Processed uint64            `json:"processed"`
+	Batches   uint64            `json:"batches"`
+	Collapsed uint64            `json:"collapsed"`
+	Pending   int               `json:"pending"`
+	Ring      *worker.RingStats `json:"ring,omitempty"`
+	V8        worker.Stats      `json:"v8"`
+}
+
+// dedup is nil unless the app opted in to coalescing mutations
+func newWorkerPool(appName string, handles []*worker.Worker, http *httpPool,
+	checkpoints *checkpointStore, flow *flowControl,
+	dedup *coalesceConfig) *workerPool {
+	pool := &workerPool{
+		appName:     appName,
+		handles:     handles,
+		chans:       make([]chan []interface{}, len(handles)),
+		stats:       make([]isolateCounters, len(handles)),
+		http:        http,
+		checkpoints: checkpoints,
+		flow:        flow,
+		dedup:       dedup,
+	}
+	for i := range handles {
+		pool.chans[i] = make(chan []interface{}, isolateChanSize)
+	}
+	return pool
+}
+
+// primary isolate serves legacy timer callbacks and debugger
+func (pool *workerPool) primary() *worker.Worker {
+	return pool.handles[0]
+}
+
+func (pool *workerPool) start(bucket *couchbase.Bucket) {
+	for i := range pool.handles {
+		pool.wg.Add(1)
+		go pool.runIsolate(i, bucket)
+	}
+	pool.http.start()
+}
+
+// route hands msg to the isolate owning its vbucket, gives up and returns
+// false once stop is closed
+func (pool *workerPool) route(msg []interface{}, stop chan struct{}) bool {
+	m := msg[1].(*mc.DcpEvent)
+	select {
+	case pool.chans[int(m.VBucket)%len(pool.chans)] <- msg:
+		return true
+	case <-stop:
+		return false
+	}
+}
+
+// stop aborts running JS, drops queued events and waits for all isolate
+// routines to exit. Progress up to the last batch handed to v8 is written
+// out as the final checkpoint
+func (pool *workerPool) stop() {
+	atomic.StoreInt32(&pool.stopped, 1)
+	for _, handle := range pool.handles {
+		handle.TerminateExecution()
+	}
+	for _, ch := range pool.chans {
+		close(ch)
+	}
+	pool.wg.Wait()
+	pool.http.stop()
+	pool.checkpoints.stop()
+}
+
+func (pool *workerPool) processed() uint64 {
+	var ops uint64
+	for i := range pool.stats {
+		ops += atomic.LoadUint64(&pool.stats[i].ops)
+	}
+	return ops
+}
+
+func (pool *workerPool) isolateStats() []isolateStats {
+	stats := make([]isolateStats, len(pool.handles))
+	for i, handle := range pool.handles {
+		stats[i] = isolateStats{
+			Index:     i,
+			Processed: atomic.LoadUint64(&pool.stats[i].ops),
+			Batches:   atomic.LoadUint64(&pool.stats[i].batches),
+			Collapsed: atomic.LoadUint64(&pool.stats[i].collapsed),
+			Pending:   len(pool.chans[i]),
+			V8:        handle.Stats(),
+		}
+		if handle.RingEnabled() {
+			ringStats := handle.RingStats()
+			stats[i].Ring = &ringStats
+		}
+	}
+	return stats
+}
+
+func (pool *workerPool) runIsolate(index int, bucket *couchbase.Bucket) {
+	defer pool.wg.Done()
+
+	handle := pool.handles[index]
+	ch := pool.chans[index]
+	counters := &pool.stats[index]
+
+	defer handle.StopRing()
+	defer func() {
+		if r := recover(); r != nil {
+			logging.Errorf("%s:\n%s\n", r, logging.StackTrace())
+		}
+	}()
+
+	batchSize := options.batchSize
+	if batchSize < 1 {
+		batchSize = 1
+	}
+	batch := &worker.MutationBatch{}
+	progress := make([]*mc.DcpEvent, 0, batchSize)
+
+	var dedup *coalescer
+	if pool.dedup != nil {
+		dedup = newCoalescer(*pool.dedup)
+	}
+
+	// With the shared ring on, events are only copied into the ring by the
+	// time a batch is done. Their progress waits here till the consumer
+	// has run OnUpdate/OnDelete for them, records still in the ring are
+	// dropped on stop and have to be replayed after a restart
+	var ringPending []ringBatch
+	commitConsumed := func() {
+		head := handle.RingHead()
+		n := 0
+		for ; n < len(ringPending) && ringPending[n].tail <= head; n++ {
+			pool.checkpoints.commit(ringPending[n].events)
+			ringPending[n].events = nil
+		}
+		ringPending = append(ringPending[:0], ringPending[n:]...)
+	}
+
+	// Every isolate keeps its own timing wheel for timers registered by
+	// its handlers
+	wheelTicker := time.NewTicker(timerWheelTick)
+	defer wheelTicker.Stop()
+
+	for {
+		var msg []interface{}
+		var ok bool
+		select {
+		case <-wheelTicker.C:
+			if atomic.LoadInt32(&pool.stopped) == 0 {
+				handle.FireTimers()
+			}
+			if len(ringPending) > 0 {
+				commitConsumed()
+			}
+			continue
+		case msg, ok = <-ch:
+			if !ok {
+				if len(ringPending) > 0 {
+					commitConsumed()
+				}
+				return
+			}
+		}
+
+		if atomic.LoadInt32(&pool.stopped) == 1 {
+			continue
+		}
+
+		if dedup != nil {
+			// Superseded events still count towards checkpoints and
+			// flow control, they're done with
+			progress = pool.collectWindow(ch, dedup, msg, counters, progress)
+			dedup.flush(func(msg []interface{}) {
+				handleDcpEvent(handle, pool.appName, msg, bucket, &counters.ops, batch)
+			})
+		} else {
+			handleDcpEvent(handle, pool.appName, msg, bucket, &counters.ops, batch)
+			progress = append(progress, msg[1].(*mc.DcpEvent))
+
+			// Drain whatever else is already queued up, so that the
+			// isolate gets entered once for the whole batch
+		drain:
+			for i := 1; i < batchSize; i++ {
+				select {
+				case msg, ok := <-ch:
+					if !ok {
+						break drain
+					}
+					handleDcpEvent(handle, pool.appName, msg, bucket, &counters.ops, batch)
+					progress = append(progress, msg[1].(*mc.DcpEvent))
+				default:
+					break drain
+				}
+			}
+		}
+		flushMutations(handle, batch)
+		atomic.AddUint64(&counters.batches, 1)
+
+		if handle.RingEnabled() {
+			events := make([]*mc.DcpEvent, len(progress))
+			copy(events, progress)
+			ringPending = append(ringPending, ringBatch{handle.RingTail(), events})
+			commitConsumed()
+		} else {
+			pool.checkpoints.commit(progress)
+		}
+		pool.flow.release(progress)
+		for i := range progress {
+			progress[i] = nil
+		}
+		progress = progress[:0]
+	}
+}
+
+// collectWindow queues first and whatever follows it on c till c's window
+// runs out or fills up. Without a time window only events already queued
+// up are collected
+func (pool *workerPool) collectWindow(ch chan []interface{}, c *coalescer,
+	first []interface{}, counters *isolateCounters,
+	progress []*mc.DcpEvent) []*mc.DcpEvent {
+	add := func(msg []interface{}) {
+		if c.add(msg) {
+			atomic.AddUint64(&counters.collapsed, 1)
+		}
+		progress = append(progress, msg[1].(*mc.DcpEvent))
+	}
+	add(first)
+
+	var timeout <-chan time.Time
+	if c.config.window > 0 {
+		timer := time.NewTimer(c.config.window)
+		defer timer.Stop()
+		timeout = timer.C
+	}
+
+	for !c.full() {
+		if timeout == nil {
+			select {
+			case msg, ok := <-ch:
+				if !ok {
+					return progress
+				}
+				add(msg)
+			default:
+				return progress
+			}
+			continue
+		}
+
+		select {
+		case msg, ok := <-ch:
+			if !ok {
+				return progress
+			}
+			add(msg)
+		case <-timeout:
+			return progress
+		}
+	}
+	return progress
+}
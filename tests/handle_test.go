@@ -2,6 +2,7 @@ package eventing_test
 
 import (
 	"github.com/abhi-bit/eventing/worker"
+	"strings"
 	"testing"
 )
 
@@ -22,7 +23,7 @@ var loadTests = []loadtestentry{
 	{"app1", "function OnUpdate(doc, meta) { log(meta.id); }", ""},
 	{"app2", "function OnDelete(meta) { log(meta.id); }", ""},
 	{"app3", "function OnDelete(meta) { log(meta.id); ",
-		"undefined:29\n}\n^\nSyntaxError: Unexpected end of input\n"},
+		"undefined:54\n}\n^\nSyntaxError: Unexpected end of input\n"},
 }
 
 func TestHandleLoad(t *testing.T) {
@@ -66,3 +67,210 @@ func TestHandleUpdate(t *testing.T) {
 	}
 	handle.Dispose()
 }
+
+func TestHandleCodeCache(t *testing.T) {
+	source := "function OnUpdate(doc, meta) { log(meta); }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}"
+
+	first := worker.New("app1")
+	first.Load("app1", source)
+	first.Dispose()
+
+	second := worker.New("app1")
+	err := second.Load("app1", source)
+	stats := second.Stats()
+	second.Dispose()
+
+	if err != nil {
+		t.Error("Load failed", err)
+	}
+	if stats.CodeCacheHits != 1 {
+		t.Error("expected code cache hit, got", stats)
+	}
+}
+
+func TestHandleMutationMeta(t *testing.T) {
+	handle := worker.New("app1")
+	err := handle.Load("app1", "function OnUpdate(doc, meta) { if (meta.key !== \"ijk335_12_2551\" || meta.cas !== \"270df63d0000\" || meta.expiry !== \"0\" || meta.type !== \"json\" || meta.vbucket !== 7 || meta.seqno !== 42 || doc.credit_score !== 430) throw \"unexpected mutation\"; }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+	if err != nil {
+		t.Fatal("Load failed", err)
+	}
+
+	meta := worker.EventMeta{Cas: 0x270df63d0000, Seqno: 42, Vbucket: 7, JSON: true}
+	var batch worker.MutationBatch
+	batch.Add(&meta, []byte("ijk335_12_2551"), []byte(sendUpdateTests[0].value))
+
+	for _, rc := range handle.SendMutations(&batch) {
+		if rc != 0 {
+			t.Error("OnUpdate failed with code", rc)
+		}
+	}
+	handle.Dispose()
+}
+
+func TestHandleRingPosition(t *testing.T) {
+	handle := worker.New("app1")
+	err := handle.Load("app1", "function OnUpdate(doc, meta) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+	if err != nil {
+		t.Fatal("Load failed", err)
+	}
+	if err := handle.StartRing(1024 * 1024); err != nil {
+		t.Fatal("StartRing failed", err)
+	}
+
+	meta := worker.EventMeta{Cas: 0x270df63d0000, Seqno: 42, Vbucket: 7, JSON: true}
+	handle.RingSendMutation(&meta, []byte("ijk335_12_2551"), []byte(sendUpdateTests[0].value))
+	tail := handle.RingTail()
+	handle.RingDrain()
+
+	if tail == 0 || handle.RingHead() != tail {
+		t.Error("expected consumer to read past", tail, "got", handle.RingHead())
+	}
+	handle.StopRing()
+	handle.Dispose()
+}
+
+func TestHandleHTTPResponse(t *testing.T) {
+	handle := worker.New("app1")
+	err := handle.Load("app1", "function OnUpdate(doc, meta) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) { res.body.path = req.path; res.body.rows = [1, 2]; }\n function OnHTTPPost(req, res) { res.body = \"posted\"; }")
+	if err != nil {
+		t.Fatal("Load failed", err)
+	}
+
+	if res := handle.SendHTTPGet("{\"path\":\"credit\"}"); res != "{\"path\":\"credit\",\"rows\":[1,2]}" {
+		t.Error("unexpected GET response", res)
+	}
+	if res := handle.SendHTTPPost("{\"path\":\"credit\"}"); res != "\"posted\"" {
+		t.Error("unexpected POST response", res)
+	}
+	handle.Dispose()
+}
+
+func TestHandleN1QLStatement(t *testing.T) {
+	handle := worker.New("app1")
+	err := handle.Load("app1", "function OnUpdate(doc, meta) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) { var i = 5; res.body.bound = n1qlStatement([\"SELECT * FROM b WHERE x = \", \" LIMIT \", \"\"], [i, 10]); res.body.spliced = n1qlStatement([\"SELECT * FROM b\", \" WHERE `f-\", \"` = 1\"], [i, i]); }\n function OnHTTPPost(req, res) {}")
+	if err != nil {
+		t.Fatal("Load failed", err)
+	}
+
+	expected := "{\"bound\":[\"SELECT * FROM b WHERE x = $1 LIMIT $2\",[5,10]],\"spliced\":[\"SELECT * FROM b5 WHERE `f-5` = 1\",[]]}"
+	if res := handle.SendHTTPGet("{}"); res != expected {
+		t.Error("unexpected n1ql statement", res)
+	}
+	handle.Dispose()
+}
+
+func TestHandleBucketMultiDetached(t *testing.T) {
+	handle := worker.New("app1")
+	err := handle.Load("app1", "function OnUpdate(doc, meta) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) { var get = credit_bucket.multiGet; var set = credit_bucket.multiSet; set({\"eventing_multi_a\": {\"v\": 1}}); res.body.detached = get([\"eventing_multi_a\"]); res.body.called = credit_bucket.multiGet.call({}, [\"eventing_multi_a\"]); credit_bucket[\"multiGet\"] = {\"doc\": true}; res.body.doc = credit_bucket[\"multiGet\"]; delete credit_bucket[\"multiGet\"]; delete credit_bucket[\"eventing_multi_a\"]; res.body.fn = typeof credit_bucket.multiGet; }\n function OnHTTPPost(req, res) {}")
+	if err != nil {
+		t.Fatal("Load failed", err)
+	}
+
+	expected := "{\"detached\":{\"eventing_multi_a\":{\"v\":1}},\"called\":{\"eventing_multi_a\":{\"v\":1}},\"doc\":{\"doc\":true},\"fn\":\"function\"}"
+	if res := handle.SendHTTPGet("{}"); res != expected {
+		t.Error("unexpected multiGet/multiSet result", res)
+	}
+	handle.Dispose()
+}
+
+func TestHandleN1QLAdhoc(t *testing.T) {
+	handle := worker.New("app1")
+	err := handle.Load("app1", "function OnUpdate(doc, meta) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) { for (var i = 0; i < 2; i++) { n1ql`CREATE INDEX eventing_adhoc_test ON default(eventing_adhoc_test)`; res.body[\"created\" + i] = n1ql`SELECT RAW name FROM system:indexes WHERE name = \"eventing_adhoc_test\"`.length; n1ql`DROP INDEX default.eventing_adhoc_test`; } }\n function OnHTTPPost(req, res) {}")
+	if err != nil {
+		t.Fatal("Load failed", err)
+	}
+
+	if res := handle.SendHTTPGet("{}"); res != "{\"created0\":1,\"created1\":1}" {
+		t.Error("expected DDL to run ad hoc, got", res)
+	}
+
+	// CREATE and DROP are remembered as not preparable, PREPARE isn't sent
+	// for them on the second round
+	stats := handle.Stats()
+	if stats.N1QLPreparedMisses != 3 || stats.N1QLPreparedHits != 3 {
+		t.Error("unexpected prepared cache stats", stats)
+	}
+	handle.Dispose()
+}
+
+func TestHandleN1QLDetached(t *testing.T) {
+	handle := worker.New("app1")
+	err := handle.Load("app1", "function OnUpdate(doc, meta) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) { var execute = _n1ql.execute; res.body.execute = execute(\"SELECT 1 AS one\"); var stream = _n1ql.stream; res.body.stream = []; for (var row of stream(\"SELECT 1 AS one\")) res.body.stream.push(row); }\n function OnHTTPPost(req, res) {}")
+	if err != nil {
+		t.Fatal("Load failed", err)
+	}
+
+	if res := handle.SendHTTPGet("{}"); res != "{\"execute\":[{\"one\":1}],\"stream\":[{\"one\":1}]}" {
+		t.Error("unexpected detached n1ql result", res)
+	}
+	handle.Dispose()
+}
+
+type filtertestentry struct {
+	key    string
+	value  string
+	json   bool
+	passed bool
+}
+
+// app4 filters on key_prefixes ["user::"], key_regex "::[0-9]+$", doc_type
+// "json" and top-level fields {"type": "vip"} and "note"
+var filterTests = []filtertestentry{
+	{"user::1", "{\"type\":\"vip\",\"note\":\"a\"}", true, true},
+	{"order::1", "{\"type\":\"vip\",\"note\":\"a\"}", true, false},
+	{"user::abc", "{\"type\":\"vip\",\"note\":\"a\"}", true, false},
+	{"user::2", "{\"type\":\"vip\",\"note\":\"a\"}", false, false},
+	{"user::3", "{\"type\":\"vip\"}", true, false},
+	{"user::4", "{\"type\":\"basic\",\"note\":\"a\"}", true, false},
+	{"user::5", "{ \"note\" : \"a\" , \"type\" : \"vip\" }", true, true},
+	{"user::6", "{\"note\":\"say \\\"type\\\":\\\"vip\\\"\",\"type\":\"basic\"}", true, false},
+	{"user::7", "{\"note\":\"a\\\\\",\"type\":\"vip\"}", true, true},
+	{"user::8", "{\"note\":\"a\",\"meta\":{\"type\":\"vip\"}}", true, false},
+	{"user::9", "{\"meta\":{\"type\":\"basic\",\"x\":[\"}\"]},\"note\":1,\"type\":\"vip\"}", true, true},
+}
+
+func TestHandleEventFilter(t *testing.T) {
+	handle := worker.New("app4")
+	err := handle.Load("app4", "function OnUpdate(doc, meta) { if (doc.type !== \"vip\") throw \"unexpected mutation\"; }\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+	if err != nil {
+		t.Fatal("Load failed", err)
+	}
+
+	for i, entry := range filterTests {
+		before := handle.Stats()
+
+		meta := worker.EventMeta{Cas: 1, Seqno: uint64(i + 1), Vbucket: 3, JSON: entry.json}
+		var batch worker.MutationBatch
+		batch.Add(&meta, []byte(entry.key), []byte(entry.value))
+		for _, rc := range handle.SendMutations(&batch) {
+			if rc != 0 {
+				t.Error("For", entry.key, entry.value, "OnUpdate failed with code", rc)
+			}
+		}
+
+		after := handle.Stats()
+		passed := after.FilterPassed - before.FilterPassed
+		dropped := after.FilterDropped - before.FilterDropped
+		if entry.passed && (passed != 1 || dropped != 0) ||
+			!entry.passed && (passed != 0 || dropped != 1) {
+			t.Error("For", entry.key, entry.value,
+				"expected passed", entry.passed,
+				"got passed", passed, "dropped", dropped)
+		}
+	}
+	handle.Dispose()
+}
+
+func TestHandleEventFilterInvalid(t *testing.T) {
+	handle := worker.New("app5")
+	err := handle.Load("app5", "function OnUpdate(doc, meta) {}\n function OnDelete() {}\n function OnHTTPGet(req, res) {}\n function OnHTTPPost(req, res) {}")
+	handle.Dispose()
+
+	if err == nil {
+		t.Fatal("expected invalid filter to fail Load")
+	}
+	if !strings.Contains(err.Error(), "Invalid filter doc_type: xml") ||
+		!strings.Contains(err.Error(), "Invalid filter key_regex: user::(") {
+		t.Error("unexpected Load error", err)
+	}
+}
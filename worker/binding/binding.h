@@ -1,6 +1,8 @@
 #ifndef __BINDING_H__
 #define __BINDING_H__
 
+#include "ring_buffer.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -12,15 +14,25 @@ __attribute__((visibility("default"))) const char* worker_version();
 
 __attribute__((visibility("default"))) void v8_init();
 
+__attribute__((visibility("default"))) void v8_set_startup_snapshot(int enabled);
+
 __attribute__((visibility("default"))) worker* worker_new(int table_index, const char* app_name);
 
  __attribute__((visibility("default"))) int worker_load(worker* w, char* name_s, char* source_s);
  __attribute__((visibility("default"))) const char* worker_last_exception(worker* w);
+// Returned JSON is malloc'd, callers free it
+ __attribute__((visibility("default"))) char* worker_stats(worker* w);
  __attribute__((visibility("default"))) int worker_send_update(worker* w, const char* value, const char* meta, const char* type);
+ __attribute__((visibility("default"))) int worker_send_update_batch(worker* w, int count, const char** values, const char** metas, const char** types, int* results);
+ __attribute__((visibility("default"))) int worker_send_mutations(worker* w, const char* buf, uint64_t length, int* results);
+ __attribute__((visibility("default"))) ring_buffer* worker_ring_start(worker* w, uint64_t capacity);
+ __attribute__((visibility("default"))) void worker_ring_stop(worker* w);
  __attribute__((visibility("default"))) int worker_send_delete(worker* w, const char* msg);
- __attribute__((visibility("default"))) const char* worker_send_http_get(worker* w, const char* http_req);
- __attribute__((visibility("default"))) const char* worker_send_http_post(worker* w, const char* http_req);
+ __attribute__((visibility("default"))) const char* worker_send_http_get(worker* w, const char* http_req, uint64_t* length);
+ __attribute__((visibility("default"))) const char* worker_send_http_post(worker* w, const char* http_req, uint64_t* length);
  __attribute__((visibility("default"))) void worker_send_timer_callback(worker* w, const char* keys);
+ __attribute__((visibility("default"))) void worker_set_timer_scope(worker* w, const char* scope);
+ __attribute__((visibility("default"))) int worker_fire_timers(worker* w);
  __attribute__((visibility("default"))) const char* worker_send_continue_request(worker* w, const char* request);
  __attribute__((visibility("default"))) const char* worker_send_evaluate_request(worker* w, const char* request);
  __attribute__((visibility("default"))) const char* worker_send_lookup_request(worker* w, const char* request);
@@ -17,6 +17,7 @@
 
 #include "bucket.h"
 #include "event_assert.h"
+#include "recursion_filter.h"
 
 using namespace std;
 using namespace v8;
@@ -26,6 +27,7 @@ static void get_callback(lcb_t, int, const lcb_RESPBASE *rb) {
     Result *result = reinterpret_cast<Result*>(rb->cookie);
 
     result->status = resp->rc;
+    result->cas = resp->cas;
     result->value.clear();
     if (resp->rc == LCB_SUCCESS) {
         result->value.assign(
@@ -45,30 +47,32 @@ static void set_callback(lcb_t instance, int cbtype, const lcb_RESPBASE *rb) {
     //     << " cas " << resp->cas << endl;
 }
 
-// convert Little endian unsigned int64 to Big endian notation
-uint64_t htonll_64(uint64_t value) {
-    static const int num = 42;
-
-    if (*reinterpret_cast<const char*>(&num) == num) {
-        const uint32_t high_part = htonl(static_cast<uint32_t>(value >> 32));
-        const uint32_t low_part = htonl(static_cast<uint32_t>(value & 0xFFFFFFFFLL));
-
-        return (static_cast<uint64_t>(low_part) << 32) | high_part;
-    } else {
-        return value;
-    }
+static void remove_callback(lcb_t, int, const lcb_RESPBASE *rb) {
+    Result *result = reinterpret_cast<Result*>(rb->cookie);
+    if (result != NULL)
+        result->status = rb->rc;
 }
 
+static Bucket* UnwrapBucket(Local<Object> obj) {
+  Local<External> field = Local<External>::Cast(obj->GetInternalField(3));
+  return static_cast<Bucket*>(field->Value());
+}
 
 Bucket::Bucket(Worker* w,
                const char* bname,
-               const char* ep, const char* alias) {
+               const char* ep, const char* alias,
+               bool async_writes,
+               const BucketCacheConfig& cache_config) {
   isolate_ = w->GetIsolate();
   context_.Reset(isolate_, w->context_);
 
   bucket_name.assign(bname);
   endpoint.assign(ep);
   bucket_alias.assign(alias);
+  async_writes_ = async_writes;
+  doc_cache_.Configure(cache_config.max_entries, cache_config.max_bytes,
+                       cache_config.ttl_ms);
+  dcp_invalidation_ = cache_config.dcp_invalidation;
 
   worker = w;
 
@@ -87,10 +91,13 @@ Bucket::Bucket(Worker* w,
 
   lcb_install_callback3(bucket_lcb_obj, LCB_CALLBACK_GET, get_callback);
   lcb_install_callback3(bucket_lcb_obj, LCB_CALLBACK_STORE, set_callback);
+  lcb_install_callback3(bucket_lcb_obj, LCB_CALLBACK_REMOVE, remove_callback);
 }
 
 Bucket::~Bucket() {
     lcb_destroy(bucket_lcb_obj);
+    multi_get_.Reset();
+    multi_set_.Reset();
     context_.Reset();
 }
 
@@ -128,9 +135,18 @@ Local<Object> Bucket::WrapBucketMap(map<string, string>* obj) {
                                                      &bucket_lcb_obj);
   Local<External> worker_cb_instance = External::New(GetIsolate(),
                                                       &(worker->cb_instance));
+  Local<External> bucket_ptr = External::New(GetIsolate(), this);
   result->SetInternalField(0, map_ptr);
   result->SetInternalField(1, bucket_lcb_obj_ptr);
   result->SetInternalField(2, worker_cb_instance);
+  result->SetInternalField(3, bucket_ptr);
+
+  // multiGet/multiSet resolve on the bucket map only when there's no doc
+  // by that name, see ReturnMultiFunction
+  multi_get_.Reset(GetIsolate(),
+                   Function::New(GetIsolate(), BucketMultiGet, bucket_ptr));
+  multi_set_.Reset(GetIsolate(),
+                   Function::New(GetIsolate(), BucketMultiSet, bucket_ptr));
 
   return handle_scope.Escape(result);
 }
@@ -161,6 +177,35 @@ void Bucket::BucketGet(Local<Name> name,
   if (name->IsSymbol()) return;
 
   string key = ObjectToString(Local<String>::Cast(name));
+  Bucket* bucket = UnwrapBucket(info.Holder());
+
+  bucket->worker->ApplyInvalidations();
+
+  // Writes not yet flushed are visible to the handler that made them
+  map<string, PendingWrite>::iterator pending = bucket->pending_writes_.find(key);
+  if (pending != bucket->pending_writes_.end()) {
+    if (pending->second.is_delete) {
+      bucket->ReturnMultiFunction(key, info);
+      return;
+    }
+
+    const string& value = pending->second.value;
+    info.GetReturnValue().Set(
+        v8::JSON::Parse(String::NewFromUtf8(info.GetIsolate(), value.c_str(),
+                            NewStringType::kNormal,
+                            static_cast<int>(value.length())).ToLocalChecked()));
+    return;
+  }
+
+  CachedDoc cached;
+  if (bucket->doc_cache_.Get(key, &cached)) {
+    const string& value = cached.value;
+    info.GetReturnValue().Set(
+        v8::JSON::Parse(String::NewFromUtf8(info.GetIsolate(), value.c_str(),
+                            NewStringType::kNormal,
+                            static_cast<int>(value.length())).ToLocalChecked()));
+    return;
+  }
 
   lcb_t* bucket_lcb_obj_ptr = UnwrapLcbInstance(info.Holder());
 
@@ -172,6 +217,12 @@ void Bucket::BucketGet(Local<Name> name,
   lcb_sched_leave(*bucket_lcb_obj_ptr);
   lcb_wait(*bucket_lcb_obj_ptr);
 
+  if (result.status == LCB_SUCCESS)
+    bucket->CacheDoc(key, result);
+  else if (result.status == LCB_KEY_ENOENT &&
+           bucket->ReturnMultiFunction(key, info))
+    return;
+
   // cout << "GET call result Key: " << key << " VALUE: " << result.value << endl;
   const string& value = result.value;
   info.GetReturnValue().Set(
@@ -189,10 +240,19 @@ void Bucket::BucketSet(Local<Name> name, Local<Value> value_obj,
 
   // cout << "Set call KEY: " << key << " VALUE: " << value << endl;
 
+  Bucket* bucket = UnwrapBucket(info.Holder());
+  if (bucket->async_writes_) {
+    bucket->doc_cache_.Erase(key);
+    PendingWrite& write = bucket->pending_writes_[key];
+    write.is_delete = false;
+    write.value.swap(value);
+    info.GetReturnValue().Set(value_obj);
+    return;
+  }
+
   lcb_t* bucket_lcb_obj_ptr = UnwrapLcbInstance(info.Holder());
-  lcb_t* cb_instance = UnwrapWorkerLcbInstance(info.Holder());
 
-  Result result;
+  vector<Result> results(1);
   lcb_CMDSTORE scmd = { 0 };
   LCB_CMD_SET_KEY(&scmd, key.c_str(), key.length());
   LCB_CMD_SET_VALUE(&scmd, value.c_str(), value.length());
@@ -200,35 +260,280 @@ void Bucket::BucketSet(Local<Name> name, Local<Value> value_obj,
   scmd.flags = 0x2000000;
 
   lcb_sched_enter(*bucket_lcb_obj_ptr);
-  lcb_store3(*bucket_lcb_obj_ptr, &result, &scmd);
+  lcb_store3(*bucket_lcb_obj_ptr, &results[0], &scmd);
   lcb_sched_leave(*bucket_lcb_obj_ptr);
   lcb_wait(*bucket_lcb_obj_ptr);
 
-  // convert uint64_t cas to string
-  ostringstream out;
-  string cas_key;
-  out << htonll_64(result.cas);
-  cas_key += out.str();
+  bucket->MarkSelfWrites(vector<string>(1, key), results);
 
-  scmd = { 0 };
-  LCB_CMD_SET_KEY(&scmd, cas_key.c_str(), cas_key.length());
-  LCB_CMD_SET_VALUE(&scmd, key.c_str(), key.length());
-  scmd.operation = LCB_SET;
-
-  lcb_sched_enter(*cb_instance);
-  lcb_store3(*cb_instance, NULL, &scmd);
-  lcb_sched_leave(*cb_instance);
-  lcb_wait(*cb_instance);
+  // Write-through, so that a read following the write is served locally
+  if (results[0].status == LCB_SUCCESS) {
+    results[0].value.swap(value);
+    bucket->CacheDoc(key, results[0]);
+  } else {
+    bucket->doc_cache_.Erase(key);
+  }
 
   info.GetReturnValue().Set(value_obj);
 }
 
+void Bucket::CacheDoc(const string& key, const Result& result) {
+  if (!doc_cache_.Enabled())
+    return;
+
+  CachedDoc doc;
+  doc.value = result.value;
+  doc.cas = result.cas;
+  doc_cache_.Put(key, doc, key.length() + doc.value.length());
+}
+
+void Bucket::InvalidateDoc(const string& key, lcb_CAS cas) {
+  if (!dcp_invalidation_)
+    return;
+
+  CachedDoc* doc = doc_cache_.Peek(key);
+  if (doc != NULL && (cas == 0 || doc->cas != cas))
+    doc_cache_.Erase(key);
+}
+
+void Bucket::InvalidateAllDocs() {
+  if (dcp_invalidation_)
+    doc_cache_.Clear();
+}
+
+void Bucket::MarkSelfWrites(const vector<string>& keys,
+                            const vector<Result>& results) {
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (results[i].status != LCB_SUCCESS || results[i].cas == 0)
+      continue;
+
+    RecursionFilterAdd(worker->recursion_scope, keys[i].c_str(),
+                       keys[i].length(), results[i].cas);
+  }
+}
+
+void Bucket::FlushWrites() {
+  if (pending_writes_.empty())
+    return;
+
+  vector<string> keys;
+  vector<Result> results(pending_writes_.size());
+  keys.reserve(pending_writes_.size());
+
+  lcb_sched_enter(bucket_lcb_obj);
+  map<string, PendingWrite>::iterator it = pending_writes_.begin();
+  for (size_t i = 0; it != pending_writes_.end(); it++, i++) {
+    const string& key = it->first;
+    keys.push_back(key);
+
+    if (it->second.is_delete) {
+      lcb_CMDREMOVE rcmd = { 0 };
+      LCB_CMD_SET_KEY(&rcmd, key.c_str(), key.length());
+      lcb_remove3(bucket_lcb_obj, &results[i], &rcmd);
+    } else {
+      const string& value = it->second.value;
+      lcb_CMDSTORE scmd = { 0 };
+      LCB_CMD_SET_KEY(&scmd, key.c_str(), key.length());
+      LCB_CMD_SET_VALUE(&scmd, value.c_str(), value.length());
+      scmd.operation = LCB_SET;
+      scmd.flags = 0x2000000;
+      lcb_store3(bucket_lcb_obj, &results[i], &scmd);
+    }
+  }
+  lcb_sched_leave(bucket_lcb_obj);
+  lcb_wait(bucket_lcb_obj);
+
+  for (size_t i = 0; i < results.size(); i++) {
+    if (results[i].status != LCB_SUCCESS) {
+      cerr << "Async write failed for key: " << keys[i] << " error: "
+           << lcb_strerror(bucket_lcb_obj, results[i].status) << endl;
+    }
+  }
+
+  MarkSelfWrites(keys, results);
+  pending_writes_.clear();
+}
+
+bool Bucket::ReturnMultiFunction(const string& key,
+                                 const PropertyCallbackInfo<Value>& info) {
+  if (key == "multiGet") {
+    info.GetReturnValue().Set(
+        Local<Function>::New(info.GetIsolate(), multi_get_));
+    return true;
+  }
+  if (key == "multiSet") {
+    info.GetReturnValue().Set(
+        Local<Function>::New(info.GetIsolate(), multi_set_));
+    return true;
+  }
+  return false;
+}
+
+void Bucket::BucketMultiGet(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+
+  if (args.Length() < 1 || !args[0]->IsArray()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "multiGet expects an array of keys")));
+    return;
+  }
+
+  Bucket* bucket = static_cast<Bucket*>(args.Data().As<External>()->Value());
+  Local<Array> key_arr = Local<Array>::Cast(args[0]);
+  uint32_t count = key_arr->Length();
+
+  vector<string> keys(count);
+  vector<Result> results(count);
+  vector<bool> from_pending(count, false);
+  vector<bool> from_cache(count, false);
+
+  bucket->worker->ApplyInvalidations();
+  lcb_sched_enter(bucket->bucket_lcb_obj);
+  for (uint32_t i = 0; i < count; i++) {
+    keys[i] = ObjectToString(key_arr->Get(i));
+
+    map<string, PendingWrite>::iterator pending =
+        bucket->pending_writes_.find(keys[i]);
+    if (pending != bucket->pending_writes_.end()) {
+      from_pending[i] = true;
+      if (pending->second.is_delete) {
+        results[i].status = LCB_KEY_ENOENT;
+      } else {
+        results[i].value = pending->second.value;
+      }
+      continue;
+    }
+
+    CachedDoc cached;
+    if (bucket->doc_cache_.Get(keys[i], &cached)) {
+      from_cache[i] = true;
+      results[i].value.swap(cached.value);
+      results[i].cas = cached.cas;
+      continue;
+    }
+
+    lcb_CMDGET gcmd = { 0 };
+    LCB_CMD_SET_KEY(&gcmd, keys[i].c_str(), keys[i].length());
+    lcb_get3(bucket->bucket_lcb_obj, &results[i], &gcmd);
+  }
+  lcb_sched_leave(bucket->bucket_lcb_obj);
+  lcb_wait(bucket->bucket_lcb_obj);
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (!from_pending[i] && !from_cache[i] && results[i].status == LCB_SUCCESS)
+      bucket->CacheDoc(keys[i], results[i]);
+  }
+
+  // Missing keys are left out of the result object
+  Local<Object> result_obj = Object::New(isolate);
+  for (uint32_t i = 0; i < count; i++) {
+    if (results[i].status != LCB_SUCCESS)
+      continue;
+
+    const string& value = results[i].value;
+    Local<Value> parsed;
+    if (!JSON::Parse(isolate,
+                     String::NewFromUtf8(isolate, value.c_str(),
+                                         NewStringType::kNormal,
+                                         static_cast<int>(value.length()))
+                       .ToLocalChecked()).ToLocal(&parsed))
+      return;
+
+    result_obj->Set(context,
+                    String::NewFromUtf8(isolate, keys[i].c_str(),
+                                        NewStringType::kNormal,
+                                        static_cast<int>(keys[i].length()))
+                      .ToLocalChecked(),
+                    parsed).FromJust();
+  }
+
+  args.GetReturnValue().Set(result_obj);
+}
+
+void Bucket::BucketMultiSet(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+
+  if (args.Length() < 1 || !args[0]->IsObject()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "multiSet expects an object of key/values")));
+    return;
+  }
+
+  Bucket* bucket = static_cast<Bucket*>(args.Data().As<External>()->Value());
+  Local<Object> kv = args[0]->ToObject();
+  Local<Array> names;
+  if (!kv->GetOwnPropertyNames(context).ToLocal(&names))
+    return;
+
+  uint32_t count = names->Length();
+  vector<string> keys(count);
+  vector<string> values(count);
+  for (uint32_t i = 0; i < count; i++) {
+    Local<Value> name = names->Get(i);
+    keys[i] = ObjectToString(name);
+    values[i] = ToString(isolate, kv->Get(name));
+  }
+
+  if (bucket->async_writes_) {
+    for (uint32_t i = 0; i < count; i++) {
+      bucket->doc_cache_.Erase(keys[i]);
+      PendingWrite& write = bucket->pending_writes_[keys[i]];
+      write.is_delete = false;
+      write.value.swap(values[i]);
+    }
+    args.GetReturnValue().Set(true);
+    return;
+  }
+
+  vector<Result> results(count);
+  lcb_sched_enter(bucket->bucket_lcb_obj);
+  for (uint32_t i = 0; i < count; i++) {
+    lcb_CMDSTORE scmd = { 0 };
+    LCB_CMD_SET_KEY(&scmd, keys[i].c_str(), keys[i].length());
+    LCB_CMD_SET_VALUE(&scmd, values[i].c_str(), values[i].length());
+    scmd.operation = LCB_SET;
+    scmd.flags = 0x2000000;
+    lcb_store3(bucket->bucket_lcb_obj, &results[i], &scmd);
+  }
+  lcb_sched_leave(bucket->bucket_lcb_obj);
+  lcb_wait(bucket->bucket_lcb_obj);
+
+  bucket->MarkSelfWrites(keys, results);
+
+  bool all_stored = true;
+  for (uint32_t i = 0; i < count; i++) {
+    if (results[i].status != LCB_SUCCESS) {
+      all_stored = false;
+      bucket->doc_cache_.Erase(keys[i]);
+    } else {
+      results[i].value.swap(values[i]);
+      bucket->CacheDoc(keys[i], results[i]);
+    }
+  }
+  args.GetReturnValue().Set(all_stored);
+}
+
 void Bucket::BucketDelete(Local<Name> name,
                        const PropertyCallbackInfo<Boolean>& info) {
   if (name->IsSymbol()) return;
 
   string key = ObjectToString(Local<String>::Cast(name));
 
+  Bucket* bucket = UnwrapBucket(info.Holder());
+  bucket->doc_cache_.Erase(key);
+
+  if (bucket->async_writes_) {
+    PendingWrite& write = bucket->pending_writes_[key];
+    write.is_delete = true;
+    write.value.clear();
+    info.GetReturnValue().Set(true);
+    return;
+  }
+
   lcb_t* bucket_lcb_obj_ptr = UnwrapLcbInstance(info.Holder());
 
   lcb_CMDREMOVE rcmd = { 0 };
@@ -247,7 +552,7 @@ Local<ObjectTemplate> Bucket::MakeBucketMapTemplate(
   EscapableHandleScope handle_scope(isolate);
 
   Local<ObjectTemplate> result = ObjectTemplate::New(isolate);
-  result->SetInternalFieldCount(3);
+  result->SetInternalFieldCount(4);
   result->SetHandler(NamedPropertyHandlerConfiguration(BucketGet,
                                                        BucketSet,
                                                        NULL,
@@ -9,14 +9,39 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "lru_cache.h"
 #include "worker.h"
 
 using namespace std;
 using namespace v8;
 
+// Write queued up by a handler in async mode, flushed once the handler
+// returns. Only the last write to a key within an invocation is kept
+struct PendingWrite {
+    bool is_delete;
+    string value;
+};
+
+// Document read through the bucket map, cached along with its CAS
+struct CachedDoc {
+    string value;
+    lcb_CAS cas;
+};
+
+struct BucketCacheConfig {
+    size_t max_entries;
+    size_t max_bytes;
+    uint64_t ttl_ms;
+    bool dcp_invalidation;
+
+    BucketCacheConfig()
+        : max_entries(0), max_bytes(0), ttl_ms(0), dcp_invalidation(false) {}
+};
+
 class Bucket {
   public:
-    Bucket(Worker* w, const char* bname, const char* ep, const char* alias);
+    Bucket(Worker* w, const char* bname, const char* ep, const char* alias,
+           bool async_writes, const BucketCacheConfig& cache_config);
     ~Bucket();
 
     virtual bool Initialize(Worker* w,
@@ -26,6 +51,19 @@ class Bucket {
     string GetBucketName() { return bucket_name; }
     string GetEndPoint() { return endpoint; }
 
+    // Sends writes queued up by the last handler invocation as a single
+    // scheduled libcouchbase batch
+    void FlushWrites();
+
+    // Drops cached doc if it is older than the mutation seen on DCP, cas 0
+    // drops it unconditionally. No-op unless dcp invalidation is enabled
+    void InvalidateDoc(const string& key, lcb_CAS cas);
+
+    // Drops every cached doc, no-op unless dcp invalidation is enabled
+    void InvalidateAllDocs();
+
+    const LRUCache<CachedDoc>& GetDocCache() { return doc_cache_; }
+
     Global<ObjectTemplate> bucket_map_template_;
 
     lcb_t bucket_lcb_obj;
@@ -42,6 +80,23 @@ class Bucket {
     static void BucketDelete(Local<Name> name,
                              const PropertyCallbackInfo<Boolean>& info);
 
+    // multiGet/multiSet are bound to the bucket through function data, so
+    // they work detached from the bucket map too
+    static void BucketMultiGet(const FunctionCallbackInfo<Value>& args);
+    static void BucketMultiSet(const FunctionCallbackInfo<Value>& args);
+
+    // Returns multiGet/multiSet for a key the bucket has no doc for, docs
+    // by those names stay readable through the bucket map
+    bool ReturnMultiFunction(const string& key,
+                             const PropertyCallbackInfo<Value>& info);
+
+    // Records writes that succeeded in the recursion filter, so that their
+    // DCP mutations don't re-trigger the handler
+    void MarkSelfWrites(const vector<string>& keys,
+                        const vector<Result>& results);
+
+    void CacheDoc(const string& key, const Result& result);
+
     Local<Object> WrapBucketMap(map<string, string> *bucket);
 
     Isolate* isolate_;
@@ -51,6 +106,15 @@ class Bucket {
     string endpoint;
     string bucket_alias;
 
+    bool async_writes_;
+    map<string, PendingWrite> pending_writes_;
+
+    LRUCache<CachedDoc> doc_cache_;
+    bool dcp_invalidation_;
+
+    Global<Function> multi_get_;
+    Global<Function> multi_set_;
+
     Worker* worker;
 };
 
@@ -1,21 +1,59 @@
 
-function n1ql(strings, ...values) {
+// Text ending in an operator or one of these keywords is followed by a value
+var n1qlValueKeywords = /(^|[^A-Za-z0-9_$`])(LIMIT|OFFSET|AND|OR|NOT|BETWEEN|IN|LIKE|WHEN|THEN|ELSE|SELECT|RAW)$/i;
+
+function n1qlValuePosition(query) {
+    // Inside a backtick quoted name
+    if (query.split("`").length % 2 === 0)
+        return false;
+
+    var text = query.replace(/\s+$/, "");
+    return /[=<>!+\-*\/%(\[,:]$/.test(text) || n1qlValueKeywords.test(text);
+}
+
+// Quoted values and numbers in value positions become positional
+// parameters, so that every call shares one prepared statement. Other
+// values are keyspace or field names, or parts of them, and are spliced
+// into the statement text
+function n1qlStatement(strings, values) {
     var stringsLength = strings.length;
+    var params = [];
     var query = "";
 
     query = strings[0];
 
-    for (i = 0; i < stringsLength - 1; i++) {
-        if (typeof values[i] === "string" && values[i].indexOf("-") !== -1) {
+    for (var i = 0; i < stringsLength - 1; i++) {
+        var next = strings[i + 1];
+        var quote = query.charAt(query.length - 1);
+
+        if ((quote === "'" || quote === '"') && next.charAt(0) === quote) {
+            params.push(String(values[i]));
+            query = query.slice(0, -1).concat('$', params.length);
+            next = next.substring(1);
+        } else if (typeof values[i] === "number" && n1qlValuePosition(query)) {
+            params.push(values[i]);
+            query = query.concat('$', params.length);
+        } else if (typeof values[i] === "string" && values[i].indexOf("-") !== -1) {
             query = query.concat('`');
             query = query.concat(values[i]);
             query = query.concat('`');
         } else {
           query = query.concat(values[i]);
         }
-        query = query.concat(strings[i + 1]);
+        query = query.concat(next);
     }
-    return _n1ql[query];
+    return [query, params];
+}
+
+function n1ql(strings, ...values) {
+    var statement = n1qlStatement(strings, values);
+    return _n1ql.execute(statement[0], statement[1]);
+}
+
+// Yields rows as they arrive instead of returning them all at once
+function n1qlStream(strings, ...values) {
+    var statement = n1qlStatement(strings, values);
+    return _n1ql.stream(statement[0], statement[1]);
 }
 
 function ISODateString(d) {
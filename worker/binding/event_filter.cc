@@ -0,0 +1,189 @@
+#include <cstring>
+
+#include "event_filter.h"
+
+using namespace std;
+
+static const char* SkipWhitespace(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    p++;
+  return p;
+}
+
+// p points right after the opening quote, returns pointer past the closing
+// one or NULL if the string isn't terminated
+static const char* SkipString(const char* p, const char* end) {
+  const char* start = p;
+  while (p < end) {
+    const char* quote = static_cast<const char*>(memchr(p, '"', end - p));
+    if (!quote)
+      return NULL;
+
+    // Quote is escaped if preceded by an odd number of backslashes
+    size_t backslashes = 0;
+    for (const char* b = quote; b > start && *(b - 1) == '\\'; b--)
+      backslashes++;
+    if (backslashes % 2 == 0)
+      return quote + 1;
+
+    p = quote + 1;
+  }
+  return NULL;
+}
+
+// Returns pointer past the value starting at p, or NULL if it's truncated
+static const char* SkipValue(const char* p, const char* end) {
+  if (p >= end)
+    return NULL;
+
+  if (*p == '"')
+    return SkipString(p + 1, end);
+
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    while (p < end) {
+      char c = *p;
+      if (c == '"') {
+        p = SkipString(p + 1, end);
+        if (!p)
+          return NULL;
+        continue;
+      }
+      if (c == '{' || c == '[') {
+        depth++;
+      } else if (c == '}' || c == ']') {
+        if (--depth == 0)
+          return p + 1;
+      }
+      p++;
+    }
+    return NULL;
+  }
+
+  // Number, true, false or null
+  while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' &&
+         *p != '\t' && *p != '\n' && *p != '\r')
+    p++;
+  return p;
+}
+
+EventFilter::EventFilter(const filter_config& config)
+    : key_prefixes_(config.key_prefixes), has_regex_(false),
+      doc_type_(config.doc_type), fields_(config.fields) {
+  enabled_ = false;
+
+  if (!config.key_regex.empty()) {
+    try {
+      key_regex_.assign(config.key_regex, regex::ECMAScript | regex::optimize);
+      has_regex_ = true;
+    } catch (const regex_error& e) {
+      error_ = "Invalid filter key_regex: " + config.key_regex +
+               " error: " + e.what();
+      return;
+    }
+  }
+
+  if (fields_.size() > kMaxFields) {
+    error_ = "Filter supports up to " + to_string(kMaxFields) +
+             " fields, got: " + to_string(fields_.size());
+    return;
+  }
+
+  for (size_t i = 0; i < fields_.size(); i++)
+    needles_.push_back("\"" + fields_[i].name + "\"");
+
+  enabled_ = NeedsKey() || !doc_type_.empty() || !fields_.empty();
+}
+
+bool EventFilter::Match(const char* key, size_t key_len, const char* value,
+                        size_t value_len, bool is_json) const {
+  if (!doc_type_.empty() && (doc_type_ == "json") != is_json)
+    return false;
+
+  if (!MatchKey(key, key_len))
+    return false;
+
+  if (fields_.empty())
+    return true;
+  if (!is_json)
+    return false;
+
+  for (size_t i = 0; i < needles_.size(); i++) {
+    if (!memmem(value, value_len, needles_[i].data(), needles_[i].length()))
+      return false;
+  }
+  return MatchFields(value, value_len);
+}
+
+bool EventFilter::MatchKey(const char* key, size_t key_len) const {
+  if (!key_prefixes_.empty()) {
+    bool matched = false;
+    for (size_t i = 0; i < key_prefixes_.size() && !matched; i++) {
+      const string& prefix = key_prefixes_[i];
+      matched = prefix.length() <= key_len &&
+                memcmp(key, prefix.data(), prefix.length()) == 0;
+    }
+    if (!matched)
+      return false;
+  }
+
+  if (has_regex_ && !regex_search(key, key + key_len, key_regex_))
+    return false;
+
+  return true;
+}
+
+// Walks top-level members once, till every field predicate is satisfied
+bool EventFilter::MatchFields(const char* value, size_t value_len) const {
+  const char* end = value + value_len;
+  const char* p = SkipWhitespace(value, end);
+  if (p == end || *p != '{')
+    return false;
+  p++;
+
+  uint64_t all = fields_.size() == 64 ? ~0ULL : (1ULL << fields_.size()) - 1;
+  uint64_t found = 0;
+
+  while (true) {
+    p = SkipWhitespace(p, end);
+    if (p == end || *p != '"')
+      return false;
+
+    const char* name = p + 1;
+    p = SkipString(name, end);
+    if (!p)
+      return false;
+    size_t name_len = p - 1 - name;
+
+    p = SkipWhitespace(p, end);
+    if (p == end || *p != ':')
+      return false;
+    p = SkipWhitespace(p + 1, end);
+
+    const char* field_value = p;
+    p = SkipValue(p, end);
+    if (!p)
+      return false;
+    size_t field_value_len = p - field_value;
+
+    for (size_t i = 0; i < fields_.size(); i++) {
+      const field_predicate& field = fields_[i];
+      if ((found & (1ULL << i)) || field.name.length() != name_len ||
+          memcmp(field.name.data(), name, name_len) != 0)
+        continue;
+
+      if (field.has_value &&
+          (field.value.length() != field_value_len ||
+           memcmp(field.value.data(), field_value, field_value_len) != 0))
+        return false;
+      found |= 1ULL << i;
+    }
+    if (found == all)
+      return true;
+
+    p = SkipWhitespace(p, end);
+    if (p == end || *p != ',')
+      return false;
+    p++;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef __EVENT_FILTER_H__
+#define __EVENT_FILTER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "parse_deployment.h"
+
+using namespace std;
+
+// Evaluates depcfg.filter against raw mutations, so that events a handler
+// would ignore anyway skip doc parsing and the JS call altogether.
+//
+// Field predicates first look for every quoted field name with memmem over
+// the raw value, rejecting most documents lacking a field without looking
+// at their structure. Only documents containing every name get their
+// top-level members walked, strings are skipped with memchr and nested
+// values aren't parsed. Values are compared as JSON text, escapes and
+// number formatting aren't normalised.
+class EventFilter {
+  public:
+    explicit EventFilter(const filter_config& config);
+
+    bool Enabled() const { return enabled_; }
+
+    // Describes an invalid key_regex or too many fields, filter is
+    // disabled then
+    const string& Error() const { return error_; }
+
+    // Key predicates are configured, i.e. callers without a raw key at
+    // hand need to dig it out
+    bool NeedsKey() const { return !key_prefixes_.empty() || has_regex_; }
+
+    bool Match(const char* key, size_t key_len, const char* value,
+               size_t value_len, bool is_json) const;
+
+  private:
+    static const size_t kMaxFields = 64;
+
+    bool MatchKey(const char* key, size_t key_len) const;
+    bool MatchFields(const char* value, size_t value_len) const;
+
+    bool enabled_;
+    string error_;
+    vector<string> key_prefixes_;
+    bool has_regex_;
+    regex key_regex_;
+    string doc_type_;
+    vector<field_predicate> fields_;
+
+    // "name" of every field, as it appears in raw JSON
+    vector<string> needles_;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include "event_meta.h"
+#include "lazy_doc.h"
+
+using namespace std;
+
+static const event_meta* UnwrapEventMeta(Local<Object> holder) {
+  Local<String> raw = holder->GetInternalField(0).As<String>();
+  return reinterpret_cast<const event_meta*>(
+      raw->GetExternalOneByteStringResource()->data());
+}
+
+static void EventMetaKey(Local<Name> name,
+                         const PropertyCallbackInfo<Value>& info) {
+  const event_meta* meta = UnwrapEventMeta(info.Holder());
+  const char* key = reinterpret_cast<const char*>(meta + 1);
+
+  Local<String> result;
+  if (String::NewFromUtf8(info.GetIsolate(), key, NewStringType::kNormal,
+                          meta->key_len).ToLocal(&result))
+    info.GetReturnValue().Set(result);
+}
+
+// cas and expiry are strings, same as when meta was sent as JSON
+static void EventMetaCas(Local<Name> name,
+                         const PropertyCallbackInfo<Value>& info) {
+  ostringstream out;
+  out << std::hex << UnwrapEventMeta(info.Holder())->cas;
+  info.GetReturnValue().Set(
+      String::NewFromUtf8(info.GetIsolate(), out.str().c_str()));
+}
+
+static void EventMetaExpiry(Local<Name> name,
+                            const PropertyCallbackInfo<Value>& info) {
+  ostringstream out;
+  out << UnwrapEventMeta(info.Holder())->expiry;
+  info.GetReturnValue().Set(
+      String::NewFromUtf8(info.GetIsolate(), out.str().c_str()));
+}
+
+static void EventMetaType(Local<Name> name,
+                          const PropertyCallbackInfo<Value>& info) {
+  const event_meta* meta = UnwrapEventMeta(info.Holder());
+  info.GetReturnValue().Set(
+      String::NewFromUtf8(info.GetIsolate(),
+                          meta->datatype == EVENT_DATATYPE_JSON ?
+                          "json" : "base64"));
+}
+
+static void EventMetaVbucket(Local<Name> name,
+                             const PropertyCallbackInfo<Value>& info) {
+  info.GetReturnValue().Set(UnwrapEventMeta(info.Holder())->vbucket);
+}
+
+static void EventMetaSeqno(Local<Name> name,
+                           const PropertyCallbackInfo<Value>& info) {
+  info.GetReturnValue().Set(
+      static_cast<double>(UnwrapEventMeta(info.Holder())->seqno));
+}
+
+Local<ObjectTemplate> MakeEventMetaTemplate(Isolate* isolate) {
+  EscapableHandleScope handle_scope(isolate);
+
+  Local<ObjectTemplate> result = ObjectTemplate::New(isolate);
+  result->SetInternalFieldCount(1);
+
+  result->SetAccessor(String::NewFromUtf8(isolate, "key"), EventMetaKey);
+  result->SetAccessor(String::NewFromUtf8(isolate, "cas"), EventMetaCas);
+  result->SetAccessor(String::NewFromUtf8(isolate, "expiry"), EventMetaExpiry);
+  result->SetAccessor(String::NewFromUtf8(isolate, "type"), EventMetaType);
+  result->SetAccessor(String::NewFromUtf8(isolate, "vbucket"), EventMetaVbucket);
+  result->SetAccessor(String::NewFromUtf8(isolate, "seqno"), EventMetaSeqno);
+
+  return handle_scope.Escape(result);
+}
+
+Local<Value> NewEventMeta(Isolate* isolate, Local<ObjectTemplate> meta_template,
+                          const event_meta* meta, const char* key) {
+  EscapableHandleScope handle_scope(isolate);
+
+  // event_meta followed by key, kept alive for as long as meta object is.
+  // KV keys are capped at 250 bytes, so the stack buffer nearly always fits
+  char stack_buf[sizeof(event_meta) + 256];
+  string heap_buf;
+  size_t raw_len = sizeof(event_meta) + meta->key_len;
+  char* raw = stack_buf;
+  if (raw_len > sizeof(stack_buf)) {
+    heap_buf.resize(raw_len);
+    raw = &heap_buf[0];
+  }
+  memcpy(raw, meta, sizeof(event_meta));
+  memcpy(raw + sizeof(event_meta), key, meta->key_len);
+
+  Local<String> raw_str;
+  if (!NewPooledExternalString(isolate, raw, raw_len).ToLocal(&raw_str))
+    return Local<Value>();
+
+  Local<Object> obj;
+  if (!meta_template->NewInstance(isolate->GetCurrentContext()).ToLocal(&obj))
+    return Local<Value>();
+
+  obj->SetInternalField(0, raw_str);
+  return handle_scope.Escape(obj);
+}
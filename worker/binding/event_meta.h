@@ -0,0 +1,22 @@
+#ifndef __EVENT_META_H__
+#define __EVENT_META_H__
+
+#include <include/v8.h>
+
+#include "ring_buffer.h"
+
+using namespace v8;
+
+// meta argument of OnUpdate, built from binary event_meta sent by Go.
+//
+// Raw event_meta and key bytes are kept in a single pooled external string,
+// properties are native accessors on a cached template that decode fields
+// on access, so fields a handler never reads cost nothing.
+
+// Template for meta objects, one per isolate
+Local<ObjectTemplate> MakeEventMetaTemplate(Isolate* isolate);
+
+Local<Value> NewEventMeta(Isolate* isolate, Local<ObjectTemplate> meta_template,
+                          const event_meta* meta, const char* key);
+
+#endif
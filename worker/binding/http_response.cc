@@ -1,17 +1,4 @@
-
-#include <cassert>
-#include <cstdio>
-#include <cstring>
-#include <fstream>
-#include <iostream>
-#include <map>
 #include <string>
-#include <vector>
-
-#include <rapidjson/document.h>
-#include <rapidjson/writer.h>
-#include <rapidjson/stringbuffer.h>
-#include <rapidjson/prettywriter.h>
 
 #include <include/v8.h>
 #include <include/libplatform/libplatform.h>
@@ -21,121 +8,80 @@
 using namespace std;
 using namespace v8;
 
-HTTPBody::HTTPBody(Isolate* isolate) {
-  isolate_ = isolate;
-}
-
-HTTPBody::~HTTPBody() {
-}
-
-void HTTPBody::HTTPBodySet(Local<Name> name, Local<Value> value_obj,
-                           const PropertyCallbackInfo<Value>& info) {
-  if (name->IsSymbol()) return;
-
-  string key = ObjectToString(Local<String>::Cast(name));
-  string value = ToString(info.GetIsolate(), value_obj);
-
-  map<string, string>* body = UnwrapMap(info.Holder());
-  (*body)[key] = value;
-
-  info.GetReturnValue().Set(value_obj);
-}
-
-Local<Object> HTTPBody::WrapHTTPBodyMap() {
-  EscapableHandleScope handle_scope(GetIsolate());
-
-  Local<FunctionTemplate> body_map_template = FunctionTemplate::New(GetIsolate());
-  body_map_template->InstanceTemplate()->SetHandler(
-          NamedPropertyHandlerConfiguration(NULL, HTTPBodySet));
-  body_map_template->InstanceTemplate()->SetInternalFieldCount(1);
-  Local<Object> result = body_map_template->GetFunction()->NewInstance();
-
-  Local<External> map_ptr = External::New(GetIsolate(), &http_body);
-
-  result->SetInternalField(0, map_ptr);
-
-  return handle_scope.Escape(result);
-}
+// Buffer is given back after a response larger than this, so that one
+// huge body doesn't pin its memory for the lifetime of the worker
+static const size_t kMaxRetainedBuffer = 1024 * 1024;
 
 HTTPResponse::HTTPResponse(Worker* w) {
   isolate_ = w->GetIsolate();
-  context_.Reset(isolate_, w->context_);
   worker = w;
 
-  http_body = new HTTPBody(GetIsolate());
-
   HandleScope handle_scope(GetIsolate());
 
   Local<Context> context = Local<Context>::New(GetIsolate(), w->context_);
   context_.Reset(GetIsolate(), context);
-
-  Context::Scope context_scope(context);
 }
 
 HTTPResponse::~HTTPResponse() {
-    context_.Reset();
+  body_name_.Reset();
+  context_.Reset();
 }
 
-void HTTPResponse::HTTPResponseGet(Local<Name> name,
-                                  const PropertyCallbackInfo<Value>& info) {
-  if (name->IsSymbol()) return;
-
-  string key = ObjectToString(Local<String>::Cast(name));
-
-  Local<External> field = Local<External>::Cast(info.Holder()->GetInternalField(1));
-  void* ptr = field->Value();
-  HTTPBody* body = static_cast<HTTPBody*>(ptr);
-
-  Local<Object> body_map = body->WrapHTTPBodyMap();
-  info.GetReturnValue().Set(body_map);
-}
-
-Local<ObjectTemplate> HTTPResponse::MakeHTTPResponseMapTemplate(
-    Isolate* isolate) {
-  EscapableHandleScope handle_scope(isolate);
-
-  Local<ObjectTemplate> result = ObjectTemplate::New(isolate);
-  result->SetInternalFieldCount(2);
-  result->SetHandler(NamedPropertyHandlerConfiguration(HTTPResponseGet));
-
-  return handle_scope.Escape(result);
+Local<String> HTTPResponse::BodyName() {
+  if (body_name_.IsEmpty()) {
+    Local<String> name = String::NewFromUtf8(GetIsolate(), "body",
+                                             NewStringType::kInternalized)
+                             .ToLocalChecked();
+    body_name_.Reset(GetIsolate(), name);
+  }
+  return Local<String>::New(GetIsolate(), body_name_);
 }
 
-Local<Object> HTTPResponse::WrapHTTPResponseMap() {
+Local<Object> HTTPResponse::NewResponse() {
   EscapableHandleScope handle_scope(GetIsolate());
+  Local<Context> context = GetIsolate()->GetCurrentContext();
 
-  if (http_response_map_template_.IsEmpty()) {
-    Local<ObjectTemplate> raw_template = MakeHTTPResponseMapTemplate(GetIsolate());
-    http_response_map_template_.Reset(GetIsolate(), raw_template);
-  }
-  Local<ObjectTemplate> templ =
-      Local<ObjectTemplate>::New(GetIsolate(), http_response_map_template_);
-
-  Local<Object> result =
-      templ->NewInstance(GetIsolate()->GetCurrentContext()).ToLocalChecked();
-
-  Local<External> map_ptr = External::New(GetIsolate(), &http_response);
-  Local<External> body = External::New(GetIsolate(), http_body);
-
-  result->SetInternalField(0, map_ptr);
-  result->SetInternalField(1, body);
+  Local<Object> result = Object::New(GetIsolate());
+  result->Set(context, BodyName(), Object::New(GetIsolate())).FromJust();
 
   return handle_scope.Escape(result);
 }
 
-const char* HTTPResponse::ConvertMapToJson() {
-  rapidjson::StringBuffer s;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(s);
-
-  writer.StartObject();
+const char* HTTPResponse::Serialize(Local<Object> response, uint64_t* length) {
+  HandleScope handle_scope(GetIsolate());
+  Local<Context> context = GetIsolate()->GetCurrentContext();
+
+  Local<Value> body;
+  Local<String> json;
+  bool ok = response->Get(context, BodyName()).ToLocal(&body);
+
+  if (ok && body->IsObject()) {
+    ok = JSON::Stringify(context, body.As<Object>()).ToLocal(&json);
+  } else if (ok && !body->IsUndefined()) {
+    // Primitive bodies, JSON::Stringify only takes objects
+    string raw = ToString(GetIsolate(), body);
+    ok = String::NewFromUtf8(GetIsolate(), raw.c_str(), NewStringType::kNormal,
+                             raw.length()).ToLocal(&json);
+  } else {
+    ok = false;
+  }
 
-  for (auto elem : this->http_body->http_body) {
-      writer.Key(elem.first.c_str());
-      writer.RawValue(elem.second.c_str(), elem.second.length(), rapidjson::kObjectType);
+  // Stringify comes back undefined for e.g. functions
+  if (!ok || json.IsEmpty() || !json->IsString()) {
+    buffer_.assign("{}");
+    *length = buffer_.length();
+    return buffer_.data();
   }
 
-  writer.EndObject();
-  http_response.clear();
+  size_t utf8_length = json->Utf8Length();
+  if (buffer_.capacity() > kMaxRetainedBuffer &&
+      utf8_length <= kMaxRetainedBuffer)
+    string().swap(buffer_);
+
+  buffer_.resize(utf8_length);
+  json->WriteUtf8(&buffer_[0], utf8_length, nullptr,
+                  String::NO_NULL_TERMINATION);
 
-  return s.GetString();
+  *length = buffer_.length();
+  return buffer_.data();
 }
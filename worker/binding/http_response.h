@@ -2,7 +2,6 @@
 #define __HTTP_RESPONSE_H__
 
 #include <string>
-#include <map>
 
 #include <include/v8.h>
 #include <include/libplatform/libplatform.h>
@@ -12,56 +11,35 @@
 using namespace std;
 using namespace v8;
 
-class HTTPBody;
-
+// res argument of OnHTTPGet/OnHTTPPost. res.body is a plain object which
+// handlers fill in like any other object, it's serialized once with
+// JSON::Stringify after the handler returns. Output lands in a buffer owned
+// by the worker and reused across requests, so a response costs no
+// allocations once the buffer has grown to the usual body size.
 class HTTPResponse {
   public:
     HTTPResponse(Worker* w);
     ~HTTPResponse();
 
-    Local<Object> WrapHTTPResponseMap();
-
-    Isolate* GetIsolate() { return isolate_; }
+    // Fresh res object with an empty body
+    Local<Object> NewResponse();
 
-    Global<ObjectTemplate> http_response_map_template_;
+    // Serializes res.body, returned pointer stays valid until next call.
+    // Bodies that can't be serialized come out as {}
+    const char* Serialize(Local<Object> response, uint64_t* length);
 
-    const char* ConvertMapToJson();
+    Isolate* GetIsolate() { return isolate_; }
 
     Worker* worker;
-    map<string, string> http_response;
-
-    HTTPBody* http_body;
 
   private:
-    static Local<ObjectTemplate> MakeHTTPResponseMapTemplate(Isolate* isolate);
-
-    static void HTTPResponseGet(Local<Name> name,
-                          const PropertyCallbackInfo<Value>& info);
+    Local<String> BodyName();
 
     Persistent<Context> context_;
     Isolate* isolate_;
-};
-
-class HTTPBody {
-  public:
-    HTTPBody(Isolate* isolate);
-    ~HTTPBody();
 
-    Local<Object> WrapHTTPBodyMap();
-
-    Isolate* GetIsolate() { return isolate_; }
-
-    Global<ObjectTemplate> http_body_map_template_;
-
-    const char* ConvertMapToJson();
-
-    map<string, string> http_body;
-
-  private:
-    static void HTTPBodySet(Local<Name> name, Local<Value> value,
-                          const PropertyCallbackInfo<Value>& info);
-
-    Isolate* isolate_;
+    Global<String> body_name_;
+    string buffer_;
 };
 
 #endif
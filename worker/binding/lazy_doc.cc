@@ -0,0 +1,333 @@
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "lazy_doc.h"
+
+// Buffers are pooled in power of two size classes from 256B to 1MB, larger
+// payloads are malloc'd and freed directly
+static const size_t kMinBufferSize = 256;
+static const int kBufferClasses = 13;
+static const size_t kMaxPooledPerClass = 64;
+
+static std::mutex pool_m;
+static vector<char*> buffer_pool[kBufferClasses];
+
+static int BufferClass(size_t length) {
+  size_t size = kMinBufferSize;
+  for (int cls = 0; cls < kBufferClasses; cls++, size <<= 1) {
+    if (length <= size)
+      return cls;
+  }
+  return -1;
+}
+
+static char* AcquireBuffer(size_t length, int cls) {
+  if (cls >= 0) {
+    std::lock_guard<std::mutex> lk(pool_m);
+    if (!buffer_pool[cls].empty()) {
+      char* buf = buffer_pool[cls].back();
+      buffer_pool[cls].pop_back();
+      return buf;
+    }
+    return static_cast<char*>(malloc(kMinBufferSize << cls));
+  }
+  return static_cast<char*>(malloc(length));
+}
+
+static void ReleaseBuffer(char* buf, int cls) {
+  if (cls >= 0) {
+    std::lock_guard<std::mutex> lk(pool_m);
+    if (buffer_pool[cls].size() < kMaxPooledPerClass) {
+      buffer_pool[cls].push_back(buf);
+      return;
+    }
+  }
+  free(buf);
+}
+
+static bool IsAscii(const char* s, size_t length) {
+  const uint64_t high_bits = 0x8080808080808080ULL;
+  size_t i = 0;
+
+  for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, s + i, sizeof(uint64_t));
+    if (word & high_bits)
+      return false;
+  }
+
+  for (; i < length; i++) {
+    if (s[i] & 0x80)
+      return false;
+  }
+  return true;
+}
+
+// Owns a pooled buffer for as long as V8 holds on to the string
+class ExternalDocResource : public String::ExternalOneByteStringResource {
+  public:
+    ExternalDocResource(char* data, size_t length, int cls)
+        : data_(data), length_(length), cls_(cls) {}
+
+    const char* data() const override { return data_; }
+    size_t length() const override { return length_; }
+
+  protected:
+    void Dispose() override {
+      ReleaseBuffer(data_, cls_);
+      delete this;
+    }
+
+  private:
+    char* data_;
+    size_t length_;
+    int cls_;
+};
+
+MaybeLocal<String> NewPooledExternalString(Isolate* isolate, const char* data,
+                                           size_t length) {
+  int cls = BufferClass(length);
+  char* buf = AcquireBuffer(length, cls);
+  if (buf == NULL)
+    return MaybeLocal<String>();
+
+  memcpy(buf, data, length);
+  ExternalDocResource* resource = new ExternalDocResource(buf, length, cls);
+
+  MaybeLocal<String> str = String::NewExternalOneByte(isolate, resource);
+  if (str.IsEmpty()) {
+    // V8 doesn't take ownership of resource on failure
+    ReleaseBuffer(buf, cls);
+    delete resource;
+  }
+  return str;
+}
+
+// Holds on to a string handed over by the caller
+class OwnedStringResource : public String::ExternalOneByteStringResource {
+  public:
+    explicit OwnedStringResource(string* value) { value_.swap(*value); }
+
+    const char* data() const override { return value_.data(); }
+    size_t length() const override { return value_.size(); }
+
+  private:
+    string value_;
+};
+
+MaybeLocal<String> NewOwnedExternalString(Isolate* isolate, string* value) {
+  if (value->empty() || !IsAscii(value->data(), value->size())) {
+    MaybeLocal<String> str = String::NewFromUtf8(
+        isolate, value->data(), NewStringType::kNormal,
+        static_cast<int>(value->size()));
+    value->clear();
+    return str;
+  }
+
+  OwnedStringResource* resource = new OwnedStringResource(value);
+  MaybeLocal<String> str = String::NewExternalOneByte(isolate, resource);
+  if (str.IsEmpty())
+    delete resource;
+  return str;
+}
+
+static MaybeLocal<String> NewSourceString(Isolate* isolate, const char* value,
+                                          size_t length) {
+  if (length > 0 && IsAscii(value, length)) {
+    MaybeLocal<String> str = NewPooledExternalString(isolate, value, length);
+    if (!str.IsEmpty())
+      return str;
+  }
+
+  return String::NewFromUtf8(isolate, value, NewStringType::kNormal,
+                             static_cast<int>(length));
+}
+
+// Internal fields of a lazy doc object
+enum LAZY_DOC_FIELD {
+  LAZY_DOC_TAG = 0,
+  LAZY_DOC_SOURCE,
+  LAZY_DOC_PARSED,
+  LAZY_DOC_FIELDS
+};
+
+static int lazy_doc_tag;
+
+static bool IsLazyDoc(Local<Object> obj) {
+  if (obj->InternalFieldCount() != LAZY_DOC_FIELDS)
+    return false;
+
+  Local<Value> tag = obj->GetInternalField(LAZY_DOC_TAG);
+  return tag->IsExternal() && tag.As<External>()->Value() == &lazy_doc_tag;
+}
+
+// Parses the doc on first touch, exception is left pending on failure
+static bool MaterializeDoc(Isolate* isolate, Local<Object> holder,
+                           Local<Object>* doc) {
+  Local<Value> parsed = holder->GetInternalField(LAZY_DOC_PARSED);
+  if (parsed->IsObject()) {
+    *doc = parsed.As<Object>();
+    return true;
+  }
+
+  Local<String> source = holder->GetInternalField(LAZY_DOC_SOURCE).As<String>();
+  Local<Value> result;
+  if (!JSON::Parse(isolate, source).ToLocal(&result))
+    return false;
+
+  if (!result->IsObject())
+    result = Object::New(isolate);
+
+  // Doc may get mutated from here on, so raw source is no longer valid.
+  // Dropping it also lets the pooled buffer go back once GC runs
+  holder->SetInternalField(LAZY_DOC_PARSED, result);
+  holder->SetInternalField(LAZY_DOC_SOURCE, Undefined(isolate));
+
+  *doc = result.As<Object>();
+  return true;
+}
+
+static void LazyDocGet(Local<Name> name,
+                       const PropertyCallbackInfo<Value>& info) {
+  if (name->IsSymbol()) return;
+
+  Local<Object> doc;
+  if (!MaterializeDoc(info.GetIsolate(), info.Holder(), &doc)) return;
+
+  // Unknown properties fall through to the prototype chain
+  Local<Context> context = info.GetIsolate()->GetCurrentContext();
+  Maybe<bool> has = doc->HasOwnProperty(context, name);
+  if (has.IsNothing() || !has.FromJust()) return;
+
+  Local<Value> value;
+  if (doc->Get(context, name).ToLocal(&value))
+    info.GetReturnValue().Set(value);
+}
+
+static void LazyDocSet(Local<Name> name, Local<Value> value,
+                       const PropertyCallbackInfo<Value>& info) {
+  if (name->IsSymbol()) return;
+
+  Local<Object> doc;
+  if (!MaterializeDoc(info.GetIsolate(), info.Holder(), &doc)) return;
+
+  Local<Context> context = info.GetIsolate()->GetCurrentContext();
+  if (doc->Set(context, name, value).FromMaybe(false))
+    info.GetReturnValue().Set(value);
+}
+
+static void LazyDocQuery(Local<Name> name,
+                         const PropertyCallbackInfo<Integer>& info) {
+  if (name->IsSymbol()) return;
+
+  Local<Object> doc;
+  if (!MaterializeDoc(info.GetIsolate(), info.Holder(), &doc)) return;
+
+  Local<Context> context = info.GetIsolate()->GetCurrentContext();
+  if (doc->HasOwnProperty(context, name).FromMaybe(false))
+    info.GetReturnValue().Set(Integer::New(info.GetIsolate(), None));
+}
+
+static void LazyDocDelete(Local<Name> name,
+                          const PropertyCallbackInfo<Boolean>& info) {
+  if (name->IsSymbol()) return;
+
+  Local<Object> doc;
+  if (!MaterializeDoc(info.GetIsolate(), info.Holder(), &doc)) return;
+
+  Local<Context> context = info.GetIsolate()->GetCurrentContext();
+  info.GetReturnValue().Set(doc->Delete(context, name).FromMaybe(false));
+}
+
+static void LazyDocEnumerate(const PropertyCallbackInfo<Array>& info) {
+  Local<Object> doc;
+  if (!MaterializeDoc(info.GetIsolate(), info.Holder(), &doc)) return;
+
+  Local<Context> context = info.GetIsolate()->GetCurrentContext();
+  Local<Array> names;
+  if (doc->GetOwnPropertyNames(context).ToLocal(&names))
+    info.GetReturnValue().Set(names);
+}
+
+Local<ObjectTemplate> MakeLazyDocTemplate(Isolate* isolate) {
+  EscapableHandleScope handle_scope(isolate);
+
+  Local<ObjectTemplate> result = ObjectTemplate::New(isolate);
+  result->SetInternalFieldCount(LAZY_DOC_FIELDS);
+  result->SetHandler(NamedPropertyHandlerConfiguration(LazyDocGet,
+                                                       LazyDocSet,
+                                                       LazyDocQuery,
+                                                       LazyDocDelete,
+                                                       LazyDocEnumerate));
+
+  return handle_scope.Escape(result);
+}
+
+static bool IsJSONObject(const char* value, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    switch (value[i]) {
+      case ' ': case '\t': case '\n': case '\r':
+        continue;
+      default:
+        return value[i] == '{';
+    }
+  }
+  return false;
+}
+
+Local<Value> NewDocValue(Isolate* isolate, Local<ObjectTemplate> lazy_template,
+                         const char* value, size_t length, bool is_json) {
+  EscapableHandleScope handle_scope(isolate);
+
+  Local<String> source;
+  if (!NewSourceString(isolate, value, length).ToLocal(&source))
+    return Local<Value>();
+
+  if (!is_json)
+    return handle_scope.Escape(source);
+
+  // Arrays and scalars are rare as documents, parse those upfront
+  if (!IsJSONObject(value, length)) {
+    Local<Value> parsed;
+    if (!JSON::Parse(isolate, source).ToLocal(&parsed))
+      return Local<Value>();
+    return handle_scope.Escape(parsed);
+  }
+
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Object> doc;
+  if (!lazy_template->NewInstance(context).ToLocal(&doc))
+    return Local<Value>();
+
+  doc->SetInternalField(LAZY_DOC_TAG, External::New(isolate, &lazy_doc_tag));
+  doc->SetInternalField(LAZY_DOC_SOURCE, source);
+  doc->SetInternalField(LAZY_DOC_PARSED, Undefined(isolate));
+
+  return handle_scope.Escape(doc);
+}
+
+bool LazyDocSource(Local<Value> value, string* out) {
+  if (!value->IsObject())
+    return false;
+
+  Local<Object> obj = value.As<Object>();
+  if (!IsLazyDoc(obj))
+    return false;
+
+  Local<Value> source = obj->GetInternalField(LAZY_DOC_SOURCE);
+  if (!source->IsString())
+    return false;
+
+  Local<String> str = source.As<String>();
+  if (str->IsExternalOneByte()) {
+    const String::ExternalOneByteStringResource* resource =
+        str->GetExternalOneByteStringResource();
+    out->assign(resource->data(), resource->length());
+  } else {
+    String::Utf8Value utf8_value(str);
+    out->assign(*utf8_value, utf8_value.length());
+  }
+  return true;
+}
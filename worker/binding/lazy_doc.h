@@ -0,0 +1,40 @@
+#ifndef __LAZY_DOC_H__
+#define __LAZY_DOC_H__
+
+#include <string>
+
+#include <include/v8.h>
+
+using namespace std;
+using namespace v8;
+
+// Document hand-off into V8 without copying DCP payloads into the V8 heap.
+//
+// ASCII payloads are copied once into a pooled buffer and exposed to V8 as
+// an external one-byte string, the buffer goes back to the pool once V8
+// garbage collects the string. JSON objects are further wrapped into a lazy
+// doc object, which parses the payload only when a handler touches one of
+// its properties. Handlers that only read meta never pay the parse cost.
+
+// Copies data into a pooled buffer and wraps it as an external one-byte
+// string, bytes aren't interpreted i.e. needn't be ASCII
+MaybeLocal<String> NewPooledExternalString(Isolate* isolate, const char* data,
+                                           size_t length);
+
+// Takes over contents of value without copying when it's ASCII, otherwise
+// decodes it as UTF-8 into a regular string. value is left empty
+MaybeLocal<String> NewOwnedExternalString(Isolate* isolate, string* value);
+
+// Template for lazy doc objects, one per isolate
+Local<ObjectTemplate> MakeLazyDocTemplate(Isolate* isolate);
+
+// Builds the doc argument passed to OnUpdate. value needn't outlive the
+// call, is_json selects between JSON and raw string docs
+Local<Value> NewDocValue(Isolate* isolate, Local<ObjectTemplate> lazy_template,
+                         const char* value, size_t length, bool is_json);
+
+// Returns raw JSON of a lazy doc that hasn't been parsed yet, allows
+// storing the doc back without a parse/stringify round trip
+bool LazyDocSource(Local<Value> value, string* out);
+
+#endif
@@ -0,0 +1,119 @@
+#include <map>
+#include <mutex>
+
+#include "local_queue.h"
+
+using namespace std;
+
+static const uint64_t kDefaultCapacity = 1 << 16;
+
+MPMCRing::MPMCRing(uint64_t capacity) {
+  uint64_t size = 2;
+  while (size < capacity)
+    size <<= 1;
+
+  slots_.reset(new Slot[size]);
+  for (uint64_t i = 0; i < size; i++)
+    slots_[i].seq.store(i, memory_order_relaxed);
+  mask_ = size - 1;
+  push_pos_.store(0, memory_order_relaxed);
+  pop_pos_.store(0, memory_order_relaxed);
+}
+
+bool MPMCRing::TryPush(string* value) {
+  uint64_t pos = push_pos_.load(memory_order_relaxed);
+  Slot* slot;
+
+  for (;;) {
+    slot = &slots_[pos & mask_];
+    uint64_t seq = slot->seq.load(memory_order_acquire);
+    int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+
+    if (diff == 0) {
+      if (push_pos_.compare_exchange_weak(pos, pos + 1,
+                                          memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = push_pos_.load(memory_order_relaxed);
+    }
+  }
+
+  slot->value.swap(*value);
+  slot->seq.store(pos + 1, memory_order_release);
+  return true;
+}
+
+bool MPMCRing::TryPop(string* value) {
+  uint64_t pos = pop_pos_.load(memory_order_relaxed);
+  Slot* slot;
+
+  for (;;) {
+    slot = &slots_[pos & mask_];
+    uint64_t seq = slot->seq.load(memory_order_acquire);
+    int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos + 1);
+
+    if (diff == 0) {
+      if (pop_pos_.compare_exchange_weak(pos, pos + 1,
+                                         memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = pop_pos_.load(memory_order_relaxed);
+    }
+  }
+
+  value->clear();
+  value->swap(slot->value);
+  slot->seq.store(pos + mask_ + 1, memory_order_release);
+  return true;
+}
+
+uint64_t MPMCRing::Size() {
+  uint64_t push_pos = push_pos_.load(memory_order_relaxed);
+  uint64_t pop_pos = pop_pos_.load(memory_order_relaxed);
+  return push_pos > pop_pos ? push_pos - pop_pos : 0;
+}
+
+// Rings outlive the apps using them, for as long as the process runs
+static mutex registry_m;
+static map<string, shared_ptr<MPMCRing> > registry;
+
+LocalQueue::LocalQueue(const QueueConfig& config) {
+  queue_name_ = config.queue_name;
+  capacity_ = config.capacity > 0 ? config.capacity : kDefaultCapacity;
+}
+
+// First app to open a queue name decides its capacity
+bool LocalQueue::Connect() {
+  lock_guard<mutex> lk(registry_m);
+
+  shared_ptr<MPMCRing>& ring = registry[queue_name_];
+  if (!ring)
+    ring.reset(new MPMCRing(capacity_));
+  ring_ = ring;
+  return true;
+}
+
+void LocalQueue::Push(vector<string>* values) {
+  enqueued += values->size();
+  for (size_t i = 0; i < values->size(); i++) {
+    if (ring_->TryPush(&(*values)[i]))
+      delivered++;
+    else
+      failed++;
+  }
+}
+
+bool LocalQueue::Pop(string* value) {
+  if (!ring_->TryPop(value))
+    return false;
+  dequeued++;
+  return true;
+}
+
+uint64_t LocalQueue::InFlight() {
+  return ring_->Size();
+}
@@ -0,0 +1,65 @@
+#ifndef __LOCAL_QUEUE_H__
+#define __LOCAL_QUEUE_H__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "queue_provider.h"
+
+using namespace std;
+
+// Bounded lock-free multi-producer multi-consumer ring of strings, after
+// Dmitry Vyukov's bounded MPMC queue. Values are moved in and out of the
+// slots, so an enqueued string reaches its consumer without being copied.
+class MPMCRing {
+  public:
+    // capacity is rounded up to a power of two
+    explicit MPMCRing(uint64_t capacity);
+
+    // Returns false if the ring is full, value is left untouched then
+    bool TryPush(string* value);
+
+    // Returns false if the ring is empty
+    bool TryPop(string* value);
+
+    uint64_t Size();
+
+  private:
+    struct Slot {
+      atomic<uint64_t> seq;
+      string value;
+    };
+
+    unique_ptr<Slot[]> slots_;
+    uint64_t mask_;
+
+    // Producers and consumers mostly touch their own cache line
+    char pad0_[64];
+    atomic<uint64_t> push_pos_;
+    char pad1_[64];
+    atomic<uint64_t> pop_pos_;
+    char pad2_[64];
+};
+
+// In-process queue provider. Rings are looked up by queue name in a process
+// wide registry, so that every app in the go_eventing process configured
+// with the same local queue_name shares it, for fan-out without a network
+// hop. A full ring rejects pushes rather than blocking the handler.
+class LocalQueue : public QueueProvider {
+  public:
+    explicit LocalQueue(const QueueConfig& config);
+
+    bool Connect() override;
+    void Push(vector<string>* values) override;
+    bool Pop(string* value) override;
+    uint64_t InFlight() override;
+
+  private:
+    string queue_name_;
+    uint64_t capacity_;
+    shared_ptr<MPMCRing> ring_;
+};
+
+#endif
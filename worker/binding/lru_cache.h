@@ -0,0 +1,144 @@
+#ifndef __LRU_CACHE_H__
+#define __LRU_CACHE_H__
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// Bounded LRU cache with optional TTL, entries are weighed in bytes by the
+// caller. Not thread safe, meant to be owned by a single isolate.
+// max_entries of 0 disables the cache i.e. Put is a no-op and every Get is
+// a miss.
+template <typename V>
+class LRUCache {
+  public:
+    LRUCache(size_t max_entries = 0, size_t max_bytes = 0, uint64_t ttl_ms = 0)
+        : hits(0), misses(0), evictions(0), expirations(0),
+          max_entries_(max_entries), max_bytes_(max_bytes), ttl_ms_(ttl_ms),
+          bytes_(0) {}
+
+    void Configure(size_t max_entries, size_t max_bytes, uint64_t ttl_ms) {
+      max_entries_ = max_entries;
+      max_bytes_ = max_bytes;
+      ttl_ms_ = ttl_ms;
+      Trim();
+    }
+
+    bool Enabled() const { return max_entries_ > 0; }
+
+    // Returns false on miss, expired entries are dropped and count as miss
+    bool Get(const string& key, V* out) {
+      if (!Enabled())
+        return false;
+
+      typename Index::iterator it = index_.find(key);
+      if (it == index_.end()) {
+        misses++;
+        return false;
+      }
+
+      if (ttl_ms_ > 0 && Clock::now() >= it->second->expires) {
+        expirations++;
+        misses++;
+        Remove(it);
+        return false;
+      }
+
+      entries_.splice(entries_.begin(), entries_, it->second);
+      *out = it->second->value;
+      hits++;
+      return true;
+    }
+
+    // Returns entry without touching recency or counters
+    V* Peek(const string& key) {
+      typename Index::iterator it = index_.find(key);
+      return it == index_.end() ? NULL : &it->second->value;
+    }
+
+    void Put(const string& key, const V& value, size_t weight) {
+      if (!Enabled())
+        return;
+
+      typename Index::iterator it = index_.find(key);
+      if (it != index_.end())
+        Remove(it);
+
+      // Never cache an entry that alone blows the byte budget
+      if (max_bytes_ > 0 && weight > max_bytes_)
+        return;
+
+      Entry entry;
+      entry.key = key;
+      entry.value = value;
+      entry.weight = weight;
+      if (ttl_ms_ > 0)
+        entry.expires = Clock::now() + chrono::milliseconds(ttl_ms_);
+
+      entries_.push_front(entry);
+      index_[key] = entries_.begin();
+      bytes_ += weight;
+      Trim();
+    }
+
+    void Erase(const string& key) {
+      typename Index::iterator it = index_.find(key);
+      if (it != index_.end())
+        Remove(it);
+    }
+
+    void Clear() {
+      entries_.clear();
+      index_.clear();
+      bytes_ = 0;
+    }
+
+    size_t Size() const { return index_.size(); }
+    size_t Bytes() const { return bytes_; }
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t expirations;
+
+  private:
+    typedef chrono::steady_clock Clock;
+
+    struct Entry {
+      string key;
+      V value;
+      size_t weight;
+      Clock::time_point expires;
+    };
+
+    typedef list<Entry> Entries;
+    typedef unordered_map<string, typename Entries::iterator> Index;
+
+    void Remove(typename Index::iterator it) {
+      bytes_ -= it->second->weight;
+      entries_.erase(it->second);
+      index_.erase(it);
+    }
+
+    void Trim() {
+      while (!entries_.empty() &&
+             (index_.size() > max_entries_ ||
+              (max_bytes_ > 0 && bytes_ > max_bytes_))) {
+        Remove(index_.find(entries_.back().key));
+        evictions++;
+      }
+    }
+
+    size_t max_entries_;
+    size_t max_bytes_;
+    uint64_t ttl_ms_;
+    size_t bytes_;
+
+    Entries entries_;
+    Index index_;
+};
+
+#endif
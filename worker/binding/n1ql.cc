@@ -1,9 +1,13 @@
 #include <cassert>
+#include <cctype>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -23,6 +27,33 @@
 using namespace std;
 using namespace v8;
 
+static const size_t kPreparedCacheSize = 128;
+
+// Rows buffered ahead of a stream iterator before control goes back to it
+static const size_t kStreamBatchRows = 64;
+static const size_t kStreamBatchBytes = 1024 * 1024;
+
+// Stream lcb instances kept connected for reuse once their stream is done
+static const size_t kIdleStreamInstances = 4;
+
+// Result caches by app name, alive as long as any isolate of the app is
+static std::mutex result_caches_lock;
+static map<string, std::weak_ptr<SharedResultCache> > result_caches;
+
+static std::shared_ptr<SharedResultCache> AppResultCache(
+    const string& app_name, const n1ql_config& config) {
+  std::lock_guard<std::mutex> lock(result_caches_lock);
+  std::shared_ptr<SharedResultCache> cache = result_caches[app_name].lock();
+  if (!cache) {
+    cache = std::make_shared<SharedResultCache>();
+    cache->cache.Configure(config.result_cache_size,
+                           config.result_cache_max_bytes,
+                           config.result_cache_ttl_ms);
+    result_caches[app_name] = cache;
+  }
+  return cache;
+}
+
 static void query_callback(lcb_t, int, const lcb_RESPN1QL *resp) {
     Rows *rows = reinterpret_cast<Rows*>(resp->cookie);
 
@@ -34,24 +65,181 @@ static void query_callback(lcb_t, int, const lcb_RESPN1QL *resp) {
     }
 }
 
+static void CancelStream(N1QLStream* stream) {
+  if (stream->handle && stream->instance)
+    lcb_n1ql_cancel(stream->instance, stream->handle);
+  stream->handle = NULL;
+  stream->done = true;
+}
+
+static void stream_callback(lcb_t instance, int, const lcb_RESPN1QL *resp) {
+    N1QLStream* stream = reinterpret_cast<N1QLStream*>(resp->cookie);
+
+    if (resp->rflags & LCB_RESP_F_FINAL) {
+        stream->rc = resp->rc;
+        stream->metadata.assign(resp->row, resp->nrow);
+        stream->handle = NULL;
+        stream->done = true;
+        if (stream->waiting)
+            lcb_breakout(instance);
+        return;
+    }
+
+    stream->rows.push_back(string(resp->row, resp->nrow));
+    stream->buffered_bytes += resp->nrow;
+    stream->rows_seen++;
+    stream->bytes_seen += resp->nrow;
+
+    if ((stream->max_rows > 0 && stream->rows_seen >= stream->max_rows) ||
+        (stream->max_bytes > 0 && stream->bytes_seen >= stream->max_bytes)) {
+        stream->truncated = true;
+        CancelStream(stream);
+    }
+
+    if (stream->waiting &&
+        (stream->done || stream->rows.size() >= kStreamBatchRows ||
+         stream->buffered_bytes >= kStreamBatchBytes))
+        lcb_breakout(instance);
+}
+
+static void StreamWeakCallback(const WeakCallbackInfo<N1QLStream>& data) {
+  N1QLStream* stream = data.GetParameter();
+  if (stream->n1ql)
+    stream->n1ql->ForgetStream(stream);
+  stream->holder.Reset();
+  delete stream;
+}
+
+static N1QLStream* UnwrapStream(Local<Object> obj) {
+  if (obj->InternalFieldCount() != 1)
+    return NULL;
+  Local<External> field = Local<External>::Cast(obj->GetInternalField(0));
+  return static_cast<N1QLStream*>(field->Value());
+}
+
+// Collapses whitespace outside of quoted literals and identifiers and
+// drops trailing semicolons, so that cosmetic differences between call
+// sites share one prepared statement
+static string NormalizeStatement(const string& statement) {
+  string result;
+  result.reserve(statement.size());
+
+  char quote = 0;
+  bool pending_space = false;
+  for (size_t i = 0; i < statement.size(); i++) {
+    char c = statement[i];
+    if (quote) {
+      result += c;
+      if (c == '\\' && i + 1 < statement.size())
+        result += statement[++i];
+      else if (c == quote)
+        quote = 0;
+      continue;
+    }
+
+    if (isspace(static_cast<unsigned char>(c))) {
+      pending_space = !result.empty();
+      continue;
+    }
+    if (pending_space) {
+      result += ' ';
+      pending_space = false;
+    }
+    if (c == '\'' || c == '"' || c == '`')
+      quote = c;
+    result += c;
+  }
+
+  while (!result.empty() && (result.back() == ';' || result.back() == ' '))
+    result.pop_back();
+  return result;
+}
+
+// Only reads are safe to answer from the result cache
+static bool IsSelect(const string& statement) {
+  static const char select[] = "select";
+  if (statement.size() < sizeof(select) - 1)
+    return false;
+
+  for (size_t i = 0; i < sizeof(select) - 1; i++) {
+    if (tolower(static_cast<unsigned char>(statement[i])) != select[i])
+      return false;
+  }
+  return statement.size() == sizeof(select) - 1 ||
+         !isalnum(static_cast<unsigned char>(statement[sizeof(select) - 1]));
+}
+
+static string JSONString(const string& value) {
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+  writer.String(value.c_str(), value.size());
+  return string(buffer.GetString(), buffer.GetSize());
+}
+
+// Query service errors that mean the prepared plan is gone or no longer
+// valid e.g. after a query node restart or an index change
+// Query service responded with errors, as opposed to not being reached
+static bool HasQueryErrors(const string& metadata) {
+  rapidjson::Document doc;
+  if (doc.Parse(metadata.c_str()).HasParseError() || !doc.IsObject())
+    return false;
+
+  rapidjson::Value::ConstMemberIterator errors = doc.FindMember("errors");
+  return errors != doc.MemberEnd() && errors->value.IsArray() &&
+         !errors->value.Empty();
+}
+
+static bool IsStalePlanError(const string& metadata) {
+  rapidjson::Document doc;
+  if (doc.Parse(metadata.c_str()).HasParseError() || !doc.IsObject())
+    return false;
+
+  rapidjson::Value::ConstMemberIterator errors = doc.FindMember("errors");
+  if (errors == doc.MemberEnd() || !errors->value.IsArray())
+    return false;
+
+  for (rapidjson::SizeType i = 0; i < errors->value.Size(); i++) {
+    const rapidjson::Value& error = errors->value[i];
+    if (!error.IsObject() || !error.HasMember("code") ||
+        !error["code"].IsInt())
+      continue;
+
+    switch (error["code"].GetInt()) {
+      case 4040:  // no such prepared statement
+      case 4050:  // unable to decode prepared statement
+      case 4070:  // encoded plan does not match prepared name
+        return true;
+    }
+  }
+  return false;
+}
+
 N1QL::N1QL(Worker* w,
           const char* bname, const char* ep,
-          const char* alias) {
+          const char* alias,
+          const n1ql_config& config) {
   isolate_ = w->GetIsolate();
   context_.Reset(isolate_, w->context_);
+  prepared_cache_.Configure(kPreparedCacheSize, 0, 0);
+  reprepares = 0;
+  stream_max_rows_ = config.stream_max_rows;
+  stream_max_bytes_ = config.stream_max_bytes;
+
+  result_cache_ = AppResultCache(w->app_name_, config);
+  request_plus_ = config.scan_consistency == "request_plus";
 
   bucket_name.assign(bname);
   endpoint.assign(ep);
   n1ql_alias.assign(alias);
 
-  string connstr = "couchbase://" + GetEndPoint() + "/" + GetBucketName();
+  connstr_ = "couchbase://" + GetEndPoint() + "/" + GetBucketName();
 
   // LCB setup
   lcb_create_st crst;
   memset(&crst, 0, sizeof crst);
 
   crst.version = 3;
-  crst.v.v3.connstr = connstr.c_str();
+  crst.v.v3.connstr = connstr_.c_str();
 
   lcb_create(&n1ql_lcb_obj, &crst);
   lcb_connect(n1ql_lcb_obj);
@@ -59,7 +247,28 @@ N1QL::N1QL(Worker* w,
 }
 
 N1QL::~N1QL() {
+    // Iterators may outlive the handle, their weak callbacks only free
+    // the stream itself
+    for (set<N1QLStream*>::iterator it = streams_.begin();
+         it != streams_.end(); ++it) {
+      N1QLStream* stream = *it;
+      CancelStream(stream);
+      if (stream->instance)
+        lcb_destroy(stream->instance);
+      stream->instance = NULL;
+      stream->n1ql = NULL;
+      stream->rows.clear();
+      stream->buffered_bytes = 0;
+    }
+    streams_.clear();
+    for (size_t i = 0; i < idle_stream_instances_.size(); i++)
+      lcb_destroy(idle_stream_instances_[i]);
+    idle_stream_instances_.clear();
+
     lcb_destroy(n1ql_lcb_obj);
+    execute_.Reset();
+    stream_.Reset();
+    stream_template_.Reset();
     context_.Reset();
 }
 
@@ -84,7 +293,7 @@ Local<ObjectTemplate> N1QL::MakeN1QLMapTemplate(
   EscapableHandleScope handle_scope(isolate);
 
   Local<ObjectTemplate> result = ObjectTemplate::New(isolate);
-  result->SetInternalFieldCount(2);
+  result->SetInternalFieldCount(3);
   result->SetHandler(NamedPropertyHandlerConfiguration(N1QLEnumGetCall));
 
   return handle_scope.Escape(result);
@@ -109,6 +318,17 @@ Local<Object> N1QL::WrapN1QLMap(map<string, string>* obj) {
 
   result->SetInternalField(0, map_ptr);
   result->SetInternalField(1, n1ql_lcb_obj_ptr);
+  result->SetInternalField(2, External::New(GetIsolate(), this));
+
+  // execute and stream are reserved names on the n1ql map, resolved ahead
+  // of treating the property name as a statement in N1QLEnumGetCall
+  execute_.Reset(GetIsolate(),
+                 Function::New(GetIsolate(), N1QLExecuteCall,
+                               External::New(GetIsolate(), this)));
+  stream_.Reset(GetIsolate(),
+                Function::New(GetIsolate(), N1QLStreamCall,
+                              External::New(GetIsolate(), this)));
+  stream_template_.Reset(GetIsolate(), MakeN1QLStreamTemplate(GetIsolate()));
 
   return handle_scope.Escape(result);
 }
@@ -135,46 +355,457 @@ bool N1QL::InstallMaps(map<string, string> *n1ql) {
   return true;
 }
 
-void N1QL::N1QLEnumGetCall(Local<Name> name,
-                           const PropertyCallbackInfo<Value>& info) {
-  if (name->IsSymbol()) return;
-
-  string query = ObjectToString(Local<String>::Cast(name));
-
-  lcb_t* n1ql_lcb_obj_ptr = UnwrapLcbInstance(info.Holder());
+static N1QL* UnwrapN1QL(Local<Object> obj) {
+  Local<External> field = Local<External>::Cast(obj->GetInternalField(2));
+  return static_cast<N1QL*>(field->Value());
+}
 
-  lcb_error_t rc;
-  lcb_N1QLPARAMS *params;
-  lcb_CMDN1QL qcmd= { 0 };
+bool N1QL::Prepare(const string& statement, PreparedStmt* prepared) {
   Rows rows;
+  lcb_CMDN1QL qcmd = { 0 };
+  lcb_N1QLPARAMS* params = lcb_n1p_new();
 
-  std::cout << "n1ql query fired: " << query << std::endl;
-  params = lcb_n1p_new();
-  rc = lcb_n1p_setstmtz(params, query.c_str());
+  string prepare = "PREPARE " + statement;
+  lcb_n1p_setstmtz(params, prepare.c_str());
   qcmd.callback = query_callback;
-  rc = lcb_n1p_mkcmd(params, &qcmd);
-  rc = lcb_n1ql_query(*n1ql_lcb_obj_ptr, &rows, &qcmd);
-  lcb_wait(*n1ql_lcb_obj_ptr);
+  lcb_n1p_mkcmd(params, &qcmd);
+  lcb_n1ql_query(n1ql_lcb_obj, &rows, &qcmd);
+  lcb_n1p_free(params);
+  lcb_wait(n1ql_lcb_obj);
 
-  auto begin = rows.rows.begin();
-  auto end = rows.rows.end();
+  if (rows.rc != LCB_SUCCESS || rows.rows.empty()) {
+    cerr << "Prepare failed! (" << int(rows.rc) << "). "
+         << lcb_strerror(NULL, rows.rc) << " " << rows.metadata << endl;
+
+    // Statement can't be prepared, e.g. CREATE INDEX, it's run as is
+    if (rows.rc != LCB_SUCCESS && HasQueryErrors(rows.metadata)) {
+      prepared->adhoc = true;
+      return true;
+    }
+    return false;
+  }
+
+  rapidjson::Document doc;
+  if (doc.Parse(rows.rows[0].c_str()).HasParseError() || !doc.IsObject() ||
+      !doc.HasMember("name") || !doc["name"].IsString() ||
+      !doc.HasMember("encoded_plan") || !doc["encoded_plan"].IsString())
+    return false;
+
+  prepared->name.assign(doc["name"].GetString(),
+                        doc["name"].GetStringLength());
+  prepared->encoded_plan.assign(doc["encoded_plan"].GetString(),
+                                doc["encoded_plan"].GetStringLength());
+  return true;
+}
+
+bool N1QL::GetPrepared(const string& statement, bool refresh,
+                       PreparedStmt* prepared) {
+  if (refresh) {
+    reprepares++;
+    prepared_cache_.Erase(statement);
+  } else if (prepared_cache_.Get(statement, prepared)) {
+    return true;
+  }
+
+  if (!Prepare(statement, prepared))
+    return false;
+  prepared_cache_.Put(statement, *prepared,
+                      statement.size() + prepared->encoded_plan.size());
+  return true;
+}
 
-  Handle<Array> result = Array::New(info.GetIsolate(), distance(begin, end));
+void N1QL::Issue(lcb_t instance, const string& statement,
+                 const PreparedStmt& prepared, const vector<string>& params,
+                 lcb_N1QLCALLBACK callback, void* cookie,
+                 lcb_N1QLHANDLE* handle) {
+  lcb_CMDN1QL qcmd = { 0 };
+  lcb_N1QLPARAMS* n1p = lcb_n1p_new();
+
+  if (prepared.adhoc) {
+    lcb_n1p_setstmtz(n1p, statement.c_str());
+  } else {
+    string name = JSONString(prepared.name);
+    string plan = JSONString(prepared.encoded_plan);
+    lcb_n1p_setopt(n1p, "prepared", -1, name.c_str(), name.size());
+    lcb_n1p_setopt(n1p, "encoded_plan", -1, plan.c_str(), plan.size());
+  }
+  for (size_t i = 0; i < params.size(); i++)
+    lcb_n1p_posparam(n1p, params[i].c_str(), params[i].size());
+  if (request_plus_)
+    lcb_n1p_setconsistency(n1p, LCB_N1P_CONSISTENCY_REQUEST);
+
+  qcmd.callback = callback;
+  qcmd.handle = handle;
+  lcb_n1p_mkcmd(n1p, &qcmd);
+  lcb_n1ql_query(instance, cookie, &qcmd);
+  lcb_n1p_free(n1p);
+}
+
+void N1QL::Run(const string& statement, const vector<string>& params,
+               Rows* rows) {
+  // Statement is still run, ad hoc, if it couldn't be prepared
+  PreparedStmt prepared;
+  if (!GetPrepared(statement, false, &prepared))
+    prepared.adhoc = true;
+
+  Issue(n1ql_lcb_obj, statement, prepared, params, query_callback, rows,
+        NULL);
+  lcb_wait(n1ql_lcb_obj);
+  if (prepared.adhoc || rows->rc == LCB_SUCCESS ||
+      !IsStalePlanError(rows->metadata))
+    return;
+
+  // Plan was invalidated on the query service, prepare once more and retry
+  if (!GetPrepared(statement, true, &prepared))
+    prepared.adhoc = true;
+
+  *rows = Rows();
+  Issue(n1ql_lcb_obj, statement, prepared, params, query_callback, rows,
+        NULL);
+  lcb_wait(n1ql_lcb_obj);
+}
+
+void N1QL::Query(const string& statement, const vector<string>& params,
+                 Rows* rows) {
+  string key = NormalizeStatement(statement);
+  std::cout << "n1ql query fired: " << key << std::endl;
+
+  bool cacheable = result_cache_->cache.Enabled() && !request_plus_ &&
+                   IsSelect(key);
+  string cache_key;
+  if (cacheable) {
+    cache_key = key;
+    for (size_t i = 0; i < params.size(); i++) {
+      cache_key += '\0';
+      cache_key += params[i];
+    }
+
+    CachedRows cached;
+    std::unique_lock<std::mutex> lock(result_cache_->lock);
+    if (result_cache_->cache.Get(cache_key, &cached)) {
+      result_cache_->time_saved_us += cached.exec_time_us;
+      lock.unlock();
+      rows->rows.swap(cached.rows);
+      rows->rc = LCB_SUCCESS;
+      return;
+    }
+  }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  Run(key, params, rows);
+  if (!cacheable || rows->rc != LCB_SUCCESS)
+    return;
+
+  CachedRows cached;
+  cached.rows = rows->rows;
+  cached.exec_time_us = chrono::duration_cast<chrono::microseconds>(
+      chrono::steady_clock::now() - start).count();
+
+  size_t weight = cache_key.size();
+  for (size_t i = 0; i < cached.rows.size(); i++)
+    weight += cached.rows[i].size();
+  std::lock_guard<std::mutex> lock(result_cache_->lock);
+  result_cache_->cache.Put(cache_key, cached, weight);
+}
+
+void N1QL::GetResultCacheStats(ResultCacheStats* stats) {
+  std::lock_guard<std::mutex> lock(result_cache_->lock);
+  const LRUCache<CachedRows>& cache = result_cache_->cache;
+  stats->hits = cache.hits;
+  stats->misses = cache.misses;
+  stats->evictions = cache.evictions;
+  stats->expirations = cache.expirations;
+  stats->entries = cache.Size();
+  stats->bytes = cache.Bytes();
+  stats->time_saved_us = result_cache_->time_saved_us;
+}
 
-  if (rows.rc == LCB_SUCCESS) {
+Local<Array> N1QL::RowsToArray(Isolate* isolate, Rows* rows) {
+  EscapableHandleScope handle_scope(isolate);
+
+  auto begin = rows->rows.begin();
+  auto end = rows->rows.end();
+
+  Local<Array> result = Array::New(isolate, distance(begin, end));
+
+  if (rows->rc == LCB_SUCCESS) {
       cout << "Query successful!, rows retrieved: " << distance(begin, end) << endl;
       int index = 0;
-      for (auto& row : rows.rows) {
-          result->Set(Integer::New(info.GetIsolate(), index),
-                      v8::JSON::Parse(createUtf8String(info.GetIsolate(),
-                                      row.c_str())));
+      for (auto& row : rows->rows) {
+          result->Set(Integer::New(isolate, index),
+                      v8::JSON::Parse(createUtf8String(isolate, row.c_str())));
           index++;
       }
   } else {
       cerr << "Query failed!";
-      cerr << "(" << int(rows.rc) << "). ";
-      cerr << lcb_strerror(NULL, rows.rc) << endl;
+      cerr << "(" << int(rows->rc) << "). ";
+      cerr << lcb_strerror(NULL, rows->rc) << endl;
+  }
+
+  return handle_scope.Escape(result);
+}
+
+void N1QL::N1QLEnumGetCall(Local<Name> name,
+                           const PropertyCallbackInfo<Value>& info) {
+  if (name->IsSymbol()) return;
+
+  string query = ObjectToString(Local<String>::Cast(name));
+  N1QL* n1ql = UnwrapN1QL(info.Holder());
+
+  if (query == "execute") {
+    info.GetReturnValue().Set(
+        Local<Function>::New(info.GetIsolate(), n1ql->execute_));
+    return;
+  }
+  if (query == "stream") {
+    info.GetReturnValue().Set(
+        Local<Function>::New(info.GetIsolate(), n1ql->stream_));
+    return;
+  }
+
+  Rows rows;
+  n1ql->Query(query, vector<string>(), &rows);
+  info.GetReturnValue().Set(n1ql->RowsToArray(info.GetIsolate(), &rows));
+}
+
+// JSON encodes positional parameters passed from builtin n1ql helpers
+static void ParamsFromArgs(const FunctionCallbackInfo<Value>& args,
+                           vector<string>* params) {
+  if (args.Length() < 2 || !args[1]->IsArray())
+    return;
+
+  Local<Array> param_arr = Local<Array>::Cast(args[1]);
+  params->resize(param_arr->Length());
+  for (uint32_t i = 0; i < param_arr->Length(); i++) {
+    Local<Value> param = param_arr->Get(i);
+    (*params)[i] = param->IsUndefined() ? "null" :
+                   ToString(args.GetIsolate(), param);
   }
+}
+
+void N1QL::N1QLExecuteCall(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+
+  if (args.Length() < 1 || !args[0]->IsString()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "execute expects a statement")));
+    return;
+  }
+
+  vector<string> params;
+  ParamsFromArgs(args, &params);
+
+  // Bound through function data, execute may be called detached from _n1ql
+  N1QL* n1ql = static_cast<N1QL*>(args.Data().As<External>()->Value());
+  Rows rows;
+  n1ql->Query(ObjectToString(args[0]), params, &rows);
+  args.GetReturnValue().Set(n1ql->RowsToArray(isolate, &rows));
+}
+
+Local<ObjectTemplate> N1QL::MakeN1QLStreamTemplate(Isolate* isolate) {
+  EscapableHandleScope handle_scope(isolate);
+
+  Local<ObjectTemplate> result = ObjectTemplate::New(isolate);
+  result->SetInternalFieldCount(1);
+
+  // Iterator protocol, so that handlers can use for...of. Breaking out of
+  // the loop calls return(), which cancels the query
+  result->Set(String::NewFromUtf8(isolate, "next"),
+              FunctionTemplate::New(isolate, N1QLStreamNext));
+  result->Set(String::NewFromUtf8(isolate, "return"),
+              FunctionTemplate::New(isolate, N1QLStreamReturn));
+  result->Set(String::NewFromUtf8(isolate, "close"),
+              FunctionTemplate::New(isolate, N1QLStreamReturn));
+  result->Set(Symbol::GetIterator(isolate),
+              FunctionTemplate::New(isolate, N1QLStreamSelf));
+  result->SetAccessor(String::NewFromUtf8(isolate, "truncated"),
+                      N1QLStreamTruncated);
+
+  return handle_scope.Escape(result);
+}
+
+lcb_t N1QL::AcquireStreamInstance() {
+  if (!idle_stream_instances_.empty()) {
+    lcb_t instance = idle_stream_instances_.back();
+    idle_stream_instances_.pop_back();
+    return instance;
+  }
+
+  lcb_create_st crst;
+  memset(&crst, 0, sizeof crst);
+  crst.version = 3;
+  crst.v.v3.connstr = connstr_.c_str();
+
+  lcb_t instance;
+  if (lcb_create(&instance, &crst) != LCB_SUCCESS)
+    return NULL;
+  lcb_connect(instance);
+  lcb_wait(instance);
+  if (lcb_get_bootstrap_status(instance) != LCB_SUCCESS) {
+    lcb_destroy(instance);
+    return NULL;
+  }
+  return instance;
+}
+
+void N1QL::ReleaseStreamInstance(N1QLStream* stream) {
+  CancelStream(stream);
+  if (!stream->instance)
+    return;
+
+  if (idle_stream_instances_.size() < kIdleStreamInstances)
+    idle_stream_instances_.push_back(stream->instance);
+  else
+    lcb_destroy(stream->instance);
+  stream->instance = NULL;
+}
+
+void N1QL::ForgetStream(N1QLStream* stream) {
+  ReleaseStreamInstance(stream);
+  streams_.erase(stream);
+}
+
+void N1QL::StartStream(N1QLStream* stream, bool refresh) {
+  if (!stream->instance)
+    stream->instance = AcquireStreamInstance();
+  if (!stream->instance) {
+    stream->rc = LCB_ERROR;
+    stream->done = true;
+    return;
+  }
+
+  PreparedStmt prepared;
+  if (!GetPrepared(stream->statement, refresh, &prepared))
+    prepared.adhoc = true;
+
+  stream->rc = LCB_SUCCESS;
+  stream->metadata.clear();
+  stream->done = false;
+  Issue(stream->instance, stream->statement, prepared, stream->params,
+        stream_callback, stream, &stream->handle);
+}
+
+void N1QL::N1QLStreamCall(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+
+  if (args.Length() < 1 || !args[0]->IsString()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "stream expects a statement")));
+    return;
+  }
+
+  // Bound through function data, stream may be called detached from _n1ql
+  N1QL* n1ql = static_cast<N1QL*>(args.Data().As<External>()->Value());
+  Local<ObjectTemplate> templ =
+      Local<ObjectTemplate>::New(isolate, n1ql->stream_template_);
+  Local<Object> iter;
+  if (!templ->NewInstance(isolate->GetCurrentContext()).ToLocal(&iter))
+    return;
+
+  N1QLStream* stream = new N1QLStream();
+  stream->n1ql = n1ql;
+  stream->instance = NULL;
+  stream->handle = NULL;
+  stream->statement = NormalizeStatement(ObjectToString(args[0]));
+  ParamsFromArgs(args, &stream->params);
+  stream->buffered_bytes = 0;
+  stream->rows_seen = 0;
+  stream->bytes_seen = 0;
+  stream->max_rows = n1ql->stream_max_rows_;
+  stream->max_bytes = n1ql->stream_max_bytes_;
+  stream->waiting = false;
+  stream->truncated = false;
+  stream->retried = false;
+
+  n1ql->streams_.insert(stream);
+  n1ql->StartStream(stream, false);
+
+  // Stream is freed, and its query cancelled, once the iterator is collected
+  iter->SetInternalField(0, External::New(isolate, stream));
+  stream->holder.Reset(isolate, iter);
+  stream->holder.SetWeak(stream, StreamWeakCallback,
+                         WeakCallbackType::kParameter);
+
+  args.GetReturnValue().Set(iter);
+}
+
+void N1QL::N1QLStreamNext(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+
+  N1QLStream* stream = UnwrapStream(args.This());
+  if (!stream) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "next called on a non n1ql stream")));
+    return;
+  }
+
+  N1QL* n1ql = stream->n1ql;
+  while (stream->rows.empty() && !stream->done) {
+    stream->waiting = true;
+    lcb_wait(stream->instance);
+    stream->waiting = false;
+
+    // Plan went stale before any row was handed out, safe to re-run
+    if (stream->done && stream->rows_seen == 0 && !stream->retried &&
+        stream->rc != LCB_SUCCESS && IsStalePlanError(stream->metadata)) {
+      stream->retried = true;
+      n1ql->StartStream(stream, true);
+    }
+  }
+
+  // Remaining rows are all buffered, instance can serve another stream
+  if (stream->done && n1ql)
+    n1ql->ReleaseStreamInstance(stream);
+
+  Local<Object> result = Object::New(isolate);
+  if (stream->rows.empty()) {
+    if (stream->rc != LCB_SUCCESS && !stream->truncated) {
+      cerr << "Query failed!";
+      cerr << "(" << int(stream->rc) << "). ";
+      cerr << lcb_strerror(NULL, stream->rc) << endl;
+    }
+    result->Set(String::NewFromUtf8(isolate, "value"), Undefined(isolate));
+    result->Set(String::NewFromUtf8(isolate, "done"), True(isolate));
+  } else {
+    string row;
+    row.swap(stream->rows.front());
+    stream->rows.pop_front();
+    stream->buffered_bytes -= row.size();
+
+    result->Set(String::NewFromUtf8(isolate, "value"),
+                v8::JSON::Parse(createUtf8String(isolate, row.c_str())));
+    result->Set(String::NewFromUtf8(isolate, "done"), False(isolate));
+  }
+
+  args.GetReturnValue().Set(result);
+}
+
+void N1QL::N1QLStreamReturn(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+
+  N1QLStream* stream = UnwrapStream(args.This());
+  if (stream) {
+    if (stream->n1ql)
+      stream->n1ql->ReleaseStreamInstance(stream);
+    stream->rows.clear();
+    stream->buffered_bytes = 0;
+  }
+
+  Local<Object> result = Object::New(isolate);
+  result->Set(String::NewFromUtf8(isolate, "done"), True(isolate));
+  args.GetReturnValue().Set(result);
+}
+
+void N1QL::N1QLStreamSelf(const FunctionCallbackInfo<Value>& args) {
+  args.GetReturnValue().Set(args.This());
+}
 
-  info.GetReturnValue().Set(result);
+void N1QL::N1QLStreamTruncated(Local<Name> name,
+                               const PropertyCallbackInfo<Value>& info) {
+  N1QLStream* stream = UnwrapStream(info.Holder());
+  info.GetReturnValue().Set(stream != NULL && stream->truncated);
 }
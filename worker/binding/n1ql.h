@@ -1,12 +1,21 @@
 #ifndef __N1QL_H__
 #define __N1QL_H__
 
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <include/v8.h>
 #include <include/libplatform/libplatform.h>
 
+#include <libcouchbase/n1ql.h>
+
+#include "lru_cache.h"
+#include "parse_deployment.h"
 #include "worker.h"
 
 using namespace std;
@@ -21,9 +30,76 @@ struct Rows {
     }
 };
 
+// Rows of a successful query kept in the result cache, along with how long
+// the query took to run
+struct CachedRows {
+    vector<string> rows;
+    uint64_t exec_time_us;
+};
+
+// Result cache shared by every isolate of an app, http ones included
+struct SharedResultCache {
+    std::mutex lock;
+    LRUCache<CachedRows> cache;
+    uint64_t time_saved_us;
+    SharedResultCache() : time_saved_us(0) {
+    }
+};
+
+// Result cache counters snapshot, app-wide
+struct ResultCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t expirations;
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t time_saved_us;
+};
+
+// Server side handle of a statement prepared by the query service. adhoc
+// marks statements it refused to prepare, DDL for one, those are sent as is
+struct PreparedStmt {
+    string name;
+    string encoded_plan;
+    bool adhoc;
+    PreparedStmt() : adhoc(false) {
+    }
+};
+
+class N1QL;
+
+// Rows of a n1qlStream`` query not yet handed to the handler. Every stream
+// runs on a lcb instance of its own, pumped only while its iterator asks
+// for more rows, so at most a batch is buffered ahead of it irrespective of
+// other queries or streams. The query is cancelled once the handler stops
+// iterating or the row/byte limit is hit. n1ql is reset if the N1QL handle
+// goes away before the iterator is collected
+struct N1QLStream {
+    N1QL* n1ql;
+    lcb_t instance;
+    lcb_N1QLHANDLE handle;
+    string statement;
+    vector<string> params;
+    deque<string> rows;
+    size_t buffered_bytes;
+    uint64_t rows_seen;
+    uint64_t bytes_seen;
+    uint64_t max_rows;
+    uint64_t max_bytes;
+    bool waiting;
+    bool done;
+    bool truncated;
+    bool retried;
+    lcb_error_t rc;
+    string metadata;
+    Global<Object> holder;
+};
+
 class N1QL {
   public:
-    N1QL(Worker* w, const char* bname, const char* ep, const char* alias);
+    N1QL(Worker* w, const char* bname, const char* ep, const char* alias,
+         const n1ql_config& config);
     ~N1QL();
 
     virtual bool Initialize(Worker* w,
@@ -33,10 +109,21 @@ class N1QL {
     string GetBucketName() { return bucket_name; }
     string GetEndPoint() { return endpoint; }
 
+    const LRUCache<PreparedStmt>& GetPreparedCache() { return prepared_cache_; }
+    void GetResultCacheStats(ResultCacheStats* stats);
+
+    // Cancels the stream's query if still running and hands its lcb
+    // instance back for reuse. Forget drops it altogether, once its
+    // iterator got collected
+    void ReleaseStreamInstance(N1QLStream* stream);
+    void ForgetStream(N1QLStream* stream);
+
     Global<ObjectTemplate> n1ql_map_template_;
 
     lcb_t n1ql_lcb_obj;
 
+    uint64_t reprepares;
+
   private:
     bool InstallMaps(map<string, string>* n1ql);
 
@@ -45,15 +132,83 @@ class N1QL {
     static void N1QLEnumGetCall(Local<Name> name,
                              const PropertyCallbackInfo<Value>& info);
 
+    // _n1ql.execute(statement, params), used by n1ql tagged template to
+    // bind template values as positional parameters
+    static void N1QLExecuteCall(const FunctionCallbackInfo<Value>& args);
+
+    // _n1ql.stream(statement, params), returns a row iterator for
+    // n1qlStream tagged template
+    static void N1QLStreamCall(const FunctionCallbackInfo<Value>& args);
+
+    static void N1QLStreamNext(const FunctionCallbackInfo<Value>& args);
+    static void N1QLStreamReturn(const FunctionCallbackInfo<Value>& args);
+    static void N1QLStreamSelf(const FunctionCallbackInfo<Value>& args);
+    static void N1QLStreamTruncated(Local<Name> name,
+                                    const PropertyCallbackInfo<Value>& info);
+
+    Local<ObjectTemplate> MakeN1QLStreamTemplate(Isolate* isolate);
+
+    // Issues the stream's statement, refresh re-prepares it first
+    void StartStream(N1QLStream* stream, bool refresh);
+
+    // Idle instance or a freshly connected one, NULL if it can't connect
+    lcb_t AcquireStreamInstance();
+
     Local<Object> WrapN1QLMap(map<string, string> *bucket);
 
+    // Runs statement as a prepared statement, preparing it on first use and
+    // again whenever query service reports the plan as stale. Statements
+    // that can't be prepared are run ad hoc. params are JSON encoded
+    // positional parameters
+    void Query(const string& statement, const vector<string>& params,
+               Rows* rows);
+
+    bool Prepare(const string& statement, PreparedStmt* prepared);
+
+    // Returns cached plan for the normalized statement, preparing it on a
+    // miss. refresh drops the cached plan first. Statements query service
+    // won't prepare are cached as adhoc, so PREPARE isn't retried for them
+    bool GetPrepared(const string& statement, bool refresh,
+                     PreparedStmt* prepared);
+
+    // Sends prepared statement on instance without waiting for the response,
+    // adhoc ones are sent as statement text
+    void Issue(lcb_t instance, const string& statement,
+               const PreparedStmt& prepared,
+               const vector<string>& params, lcb_N1QLCALLBACK callback,
+               void* cookie, lcb_N1QLHANDLE* handle);
+
+    void Run(const string& statement, const vector<string>& params,
+             Rows* rows);
+
+    Local<Array> RowsToArray(Isolate* isolate, Rows* rows);
+
     Isolate* isolate_;
     Persistent<Context> context_;
 
     string bucket_name;
     string endpoint;
     string n1ql_alias;
+    string connstr_;
+
+    // Keyed on normalized statement text
+    LRUCache<PreparedStmt> prepared_cache_;
+
+    // Opt-in, keyed on normalized statement text and parameters. Only
+    // SELECTs run with not_bounded consistency are cached, request_plus
+    // asks for results that reflect every prior mutation
+    std::shared_ptr<SharedResultCache> result_cache_;
+    bool request_plus_;
+
+    Global<Function> execute_;
+    Global<Function> stream_;
+    Global<ObjectTemplate> stream_template_;
+
+    uint64_t stream_max_rows_;
+    uint64_t stream_max_bytes_;
 
+    set<N1QLStream*> streams_;
+    vector<lcb_t> idle_stream_instances_;
 };
 
 #endif
@@ -1,3 +1,6 @@
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
 #include "parse_deployment.h"
 #include "event_assert.h"
 
@@ -41,6 +44,27 @@ deployment_config* ParseDeployment(const char* app_name) {
           bucket_info.push_back(bucket_name.GetString());
           bucket_info.push_back(alias.GetString());
 
+          // Optional, queue up handler writes and flush them once the
+          // handler returns
+          bool async_writes = buckets[i].HasMember("async_writes") &&
+                              buckets[i]["async_writes"].GetBool();
+          bucket_info.push_back(async_writes ? "true" : "false");
+
+          // Optional read-through document cache limits, cache_size of 0
+          // disables it
+          const char* cache_opts[] = { "cache_size", "cache_max_bytes",
+                                       "cache_ttl_ms" };
+          for (int j = 0; j < 3; j++) {
+              uint64_t opt = 0;
+              if (buckets[i].HasMember(cache_opts[j]))
+                  opt = buckets[i][cache_opts[j]].GetUint64();
+              bucket_info.push_back(to_string(opt));
+          }
+
+          bool dcp_invalidation = buckets[i].HasMember("cache_dcp_invalidation") &&
+                                  buckets[i]["cache_dcp_invalidation"].GetBool();
+          bucket_info.push_back(dcp_invalidation ? "true" : "false");
+
           buckets_info[alias.GetString()] = bucket_info;
       }
       config->component_configs["buckets"] = buckets_info;
@@ -51,18 +75,119 @@ deployment_config* ParseDeployment(const char* app_name) {
 
           rapidjson::Value& provider = queues[i]["provider"];
           rapidjson::Value& queue_name = queues[i]["queue_name"];
-          rapidjson::Value& endpoint = queues[i]["endpoint"];
           rapidjson::Value& alias = queues[i]["alias"];
 
+          // local provider has no endpoint
           queue_info.push_back(provider.GetString());
-          queue_info.push_back(endpoint.GetString());
+          queue_info.push_back(queues[i].HasMember("endpoint") ?
+                               queues[i]["endpoint"].GetString() : "");
           queue_info.push_back(alias.GetString());
           queue_info.push_back(queue_name.GetString());
 
+          // Optional, redis provider pushes over hiredis async API with at
+          // most max_in_flight values awaiting acknowledgement
+          bool async = queues[i].HasMember("async") &&
+                       queues[i]["async"].GetBool();
+          uint64_t max_in_flight = 0;
+          if (queues[i].HasMember("max_in_flight"))
+              max_in_flight = queues[i]["max_in_flight"].GetUint64();
+          queue_info.push_back(async ? "true" : "false");
+          queue_info.push_back(to_string(max_in_flight));
+
+          // Optional, slots of the in-process ring for local provider
+          uint64_t capacity = 0;
+          if (queues[i].HasMember("capacity"))
+              capacity = queues[i]["capacity"].GetUint64();
+          queue_info.push_back(to_string(capacity));
+
           queues_info[provider.GetString()] = queue_info;
       }
       config->component_configs["queue"] = queues_info;
 
+      // Optional limits on rows/bytes a n1qlStream`` iterator yields before
+      // its query gets cancelled, result cache limits and scan consistency
+      // for queries fired from handlers
+      config->n1ql.scan_consistency.assign("not_bounded");
+      const char* n1ql_opts[] = { "stream_max_rows", "stream_max_bytes",
+                                  "result_cache_size",
+                                  "result_cache_max_bytes",
+                                  "result_cache_ttl_ms" };
+      uint64_t* n1ql_vals[] = { &config->n1ql.stream_max_rows,
+                                &config->n1ql.stream_max_bytes,
+                                &config->n1ql.result_cache_size,
+                                &config->n1ql.result_cache_max_bytes,
+                                &config->n1ql.result_cache_ttl_ms };
+      for (int j = 0; j < 5; j++)
+          *n1ql_vals[j] = 0;
+
+      if (doc["depcfg"].HasMember("n1ql")) {
+          rapidjson::Value& n1ql = doc["depcfg"]["n1ql"];
+          assert(n1ql.IsObject());
+
+          for (int j = 0; j < 5; j++) {
+              if (n1ql.HasMember(n1ql_opts[j]))
+                  *n1ql_vals[j] = n1ql[n1ql_opts[j]].GetUint64();
+          }
+          if (n1ql.HasMember("scan_consistency"))
+              config->n1ql.scan_consistency.assign(
+                  n1ql["scan_consistency"].GetString());
+      }
+      if (config->n1ql.scan_consistency != "not_bounded" &&
+          config->n1ql.scan_consistency != "request_plus")
+          config->error.append("Invalid n1ql scan_consistency: " +
+                               config->n1ql.scan_consistency + "\n");
+
+      config->timers.horizon_min = 10;
+      config->timers.spill_batch_size = 1000;
+      if (doc["depcfg"].HasMember("timers")) {
+          rapidjson::Value& timers = doc["depcfg"]["timers"];
+          assert(timers.IsObject());
+
+          if (timers.HasMember("horizon_min"))
+              config->timers.horizon_min = timers["horizon_min"].GetUint64();
+          if (timers.HasMember("spill_batch_size"))
+              config->timers.spill_batch_size =
+                  timers["spill_batch_size"].GetUint64();
+      }
+
+      if (doc["depcfg"].HasMember("filter")) {
+          rapidjson::Value& filter = doc["depcfg"]["filter"];
+          assert(filter.IsObject());
+
+          if (filter.HasMember("key_prefixes")) {
+              rapidjson::Value& prefixes = filter["key_prefixes"];
+              assert(prefixes.IsArray());
+              for (rapidjson::SizeType i = 0; i < prefixes.Size(); i++)
+                  config->filter.key_prefixes.push_back(prefixes[i].GetString());
+          }
+          if (filter.HasMember("key_regex"))
+              config->filter.key_regex.assign(filter["key_regex"].GetString());
+          if (filter.HasMember("doc_type"))
+              config->filter.doc_type.assign(filter["doc_type"].GetString());
+          if (!config->filter.doc_type.empty() &&
+              config->filter.doc_type != "json" &&
+              config->filter.doc_type != "binary")
+              config->error.append("Invalid filter doc_type: " +
+                                   config->filter.doc_type + "\n");
+
+          if (filter.HasMember("fields")) {
+              rapidjson::Value& fields = filter["fields"];
+              assert(fields.IsArray());
+              for (rapidjson::SizeType i = 0; i < fields.Size(); i++) {
+                  field_predicate field;
+                  field.name.assign(fields[i]["name"].GetString());
+                  field.has_value = fields[i].HasMember("value");
+                  if (field.has_value) {
+                      rapidjson::StringBuffer buffer;
+                      rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+                      fields[i]["value"].Accept(writer);
+                      field.value.assign(buffer.GetString(), buffer.GetSize());
+                  }
+                  config->filter.fields.push_back(field);
+              }
+          }
+      }
+
       config->metadata_bucket.assign(workspace["metadata_bucket"].GetString());
       config->source_bucket.assign(source["source_bucket"].GetString());
       config->source_endpoint.assign("localhost");
@@ -1,3 +1,6 @@
+#ifndef __PARSE_DEPLOYMENT_H__
+#define __PARSE_DEPLOYMENT_H__
+
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -8,11 +11,58 @@
 
 using namespace std;
 
+// Optional depcfg.n1ql settings, zero values mean unlimited/disabled.
+// scan_consistency is either "not_bounded" or "request_plus"
+typedef struct n1ql_config_s {
+    uint64_t stream_max_rows;
+    uint64_t stream_max_bytes;
+    uint64_t result_cache_size;
+    uint64_t result_cache_max_bytes;
+    uint64_t result_cache_ttl_ms;
+    string scan_consistency;
+} n1ql_config;
+
+// Optional depcfg.timers settings. Timers due within horizon_min minutes
+// are kept in memory, later ones are spilled to the metadata bucket in
+// records of up to spill_batch_size timers
+typedef struct timer_config_s {
+    uint64_t horizon_min;
+    uint64_t spill_batch_size;
+} timer_config;
+
+// Top-level JSON field a document must have. When has_value is set the
+// field's value has to be value, JSON text of which e.g. "credit", 430 or
+// true is compared as is
+typedef struct field_predicate_s {
+    string name;
+    bool has_value;
+    string value;
+} field_predicate;
+
+// Optional depcfg.filter, mutations failing any of the configured
+// predicates never reach OnUpdate. A key has to start with one of
+// key_prefixes and contain a match of key_regex, doc_type is either
+// "json" or "binary"
+typedef struct filter_config_s {
+    vector<string> key_prefixes;
+    string key_regex;
+    string doc_type;
+    vector<field_predicate> fields;
+} filter_config;
+
 typedef struct deployment_config_s {
     string metadata_bucket;
     string source_bucket;
     string source_endpoint;
+    n1ql_config n1ql;
+    timer_config timers;
+    filter_config filter;
     map<string, map<string, vector<string> > > component_configs;
+
+    // Invalid optional settings, reported when the handler is loaded
+    string error;
 } deployment_config;
 
 deployment_config* ParseDeployment(const char* app_name);
+
+#endif
@@ -1,4 +1,3 @@
-
 #include <cassert>
 #include <cstdio>
 #include <cstring>
@@ -11,55 +10,61 @@
 #include <include/v8.h>
 #include <include/libplatform/libplatform.h>
 
+#include "lazy_doc.h"
+#include "local_queue.h"
 #include "queue.h"
+#include "redis_queue.h"
 
 using namespace std;
 using namespace v8;
 
-Queue::Queue(Worker* w,
-             const char* p, const char* ep,
-             const char* alias, const char* qname) {
+QueueProvider* NewQueueProvider(const QueueConfig& config) {
+  if (config.provider == "redis")
+    return new RedisQueue(config);
+  if (config.provider == "local")
+    return new LocalQueue(config);
+  return NULL;
+}
+
+Queue::Queue(Worker* w, const char* alias, const QueueConfig& config) {
   isolate_ = w->GetIsolate();
   context_.Reset(isolate_, w->context_);
 
-  provider.assign(p);
-  endpoint.assign(ep);
+  provider.assign(config.provider);
+  endpoint.assign(config.endpoint);
   queue_alias.assign(alias);
-  queue_name.assign(qname);
-
-  std::string delimiter = ":";
-  std::string hostname = endpoint.substr(0, endpoint.find(delimiter));
-  endpoint.erase(0, endpoint.find(delimiter) + delimiter.length());
-  std::string port = endpoint.substr(0, endpoint.find(delimiter));
-
-  // Setting up redis connection handle
-  struct timeval timeout = { 1, 500000 };
-  c = redisConnectWithTimeout(hostname.c_str(), std::stoi(port), timeout);
-  if (c == NULL || c->err) {
-      if (c) {
-          cout << "Connection error: " << c->errstr << endl;
-          redisFree(c);
-      } else {
-          cout << "Connection error: can't allocate redis context" << endl;
-      }
-      exit(1);
-  }
+  queue_name.assign(config.queue_name);
 
-  // Delete pre-existing list
-  redisReply* reply;
-  string del_command = "DEL ";
-  del_command.append(queue_name.c_str());
-  reply = (redisReply*) redisCommand(c, del_command.c_str());
-  freeReplyObject(reply);
+  provider_ = NewQueueProvider(config);
 }
 
 Queue::~Queue() {
-    redisFree(c);
+    delete provider_;
+    dequeue_.Reset();
+    context_.Reset();
+}
+
+void Queue::FlushPushes() {
+  if (pending_.empty())
+    return;
+
+  provider_->Push(&pending_);
+  pending_.clear();
 }
 
 bool Queue::Initialize(Worker* w, map<string, string>* queue) {
   HandleScope handle_scope(GetIsolate());
 
+  if (provider_ == NULL) {
+    cerr << "Unknown queue provider: " << provider << endl;
+    return false;
+  }
+  if (!provider_->Connect()) {
+    cerr << "Unable to connect " << provider << " queue: " << queue_name
+         << endl;
+    return false;
+  }
+
   Local<Context> context = Local<Context>::New(GetIsolate(), w->context_);
   context_.Reset(GetIsolate(), context);
 
@@ -95,12 +100,12 @@ Local<Object> Queue::WrapQueueMap(map<string, string>* obj) {
       templ->NewInstance(GetIsolate()->GetCurrentContext()).ToLocalChecked();
 
   Local<External> map_ptr = External::New(GetIsolate(), obj);
-  Local<External> redis_conn_obj = External::New(GetIsolate(), c);
-  Local<External> qname = External::New(GetIsolate(), &queue_name);
+  Local<External> provider_ptr = External::New(GetIsolate(), provider_);
+  Local<External> queue_ptr = External::New(GetIsolate(), this);
 
   result->SetInternalField(0, map_ptr);
-  result->SetInternalField(1, redis_conn_obj);
-  result->SetInternalField(2, qname);
+  result->SetInternalField(1, provider_ptr);
+  result->SetInternalField(2, queue_ptr);
 
   return handle_scope.Escape(result);
 }
@@ -125,34 +130,56 @@ bool Queue::InstallQueueMaps(map<string, string> *queue) {
             queue_obj)
       .FromJust();
 
-  return true;
-}
+  // dequeue(queue) pops a single value, null when queue is empty
+  dequeue_.Reset(GetIsolate(),
+                 Function::New(GetIsolate(), QueueDequeueCall,
+                               External::New(GetIsolate(), this)));
+  context->Global()
+      ->Set(context, String::NewFromUtf8(GetIsolate(), "dequeue"),
+            Local<Function>::New(GetIsolate(), dequeue_))
+      .FromJust();
 
-redisContext* UnwrapRedisContext(Local<Object> obj) {
-  Local<External> field = Local<External>::Cast(obj->GetInternalField(1));
-  void* ptr = field->Value();
-  return static_cast<redisContext*>(ptr);
+  return true;
 }
 
-const char* UnwrapQueueName(Local<Object> obj) {
+static Queue* UnwrapQueue(Local<Object> obj) {
   Local<External> field = Local<External>::Cast(obj->GetInternalField(2));
-  void* ptr = field->Value();
-  return static_cast<const char*>(ptr);
+  return static_cast<Queue*>(field->Value());
 }
 
+// Pushes are buffered until the handler returns, see Worker::FlushWrites
 void Queue::QueueGetCall(Local<Name> name,
                          const PropertyCallbackInfo<Value>& info) {
   if (name->IsSymbol()) return;
 
-  string doc = ObjectToString(Local<String>::Cast(name));
+  Queue* queue = UnwrapQueue(info.Holder());
+  queue->pending_.push_back(ObjectToString(Local<String>::Cast(name)));
+}
 
-  redisContext* redis_context = UnwrapRedisContext(info.Holder());
-  string qname(UnwrapQueueName(info.Holder()));
+void Queue::QueueDequeueCall(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+
+  Queue* queue = static_cast<Queue*>(args.Data().As<External>()->Value());
+
+  // Only the queue object this function was installed for is accepted
+  Local<Object> queue_obj;
+  if (args.Length() > 0 && args[0]->IsObject())
+    queue_obj = args[0].As<Object>();
+  if (queue_obj.IsEmpty() || queue_obj->InternalFieldCount() != 3 ||
+      !queue_obj->GetInternalField(2)->IsExternal() ||
+      UnwrapQueue(queue_obj) != queue) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "dequeue expects a queue")));
+    return;
+  }
 
-  // TODO: Why is `16` showing up in buffer when const char* is fetched
-  // from isolate heap
-  qname.erase(0, 1);
-  redisReply* reply = (redisReply*)redisCommand(redis_context,
-                                   "LPUSH %s %s", qname.c_str(), doc.c_str());
-  freeReplyObject(reply);
+  // Value is handed to V8 without another copy
+  string value;
+  Local<String> result;
+  if (queue->provider_->Pop(&value) &&
+      NewOwnedExternalString(isolate, &value).ToLocal(&result))
+    args.GetReturnValue().Set(result);
+  else
+    args.GetReturnValue().SetNull();
 }
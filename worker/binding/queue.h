@@ -3,31 +3,34 @@
 
 #include <string>
 #include <map>
-
-#include <hiredis.h>
+#include <vector>
 
 #include <include/v8.h>
 #include <include/libplatform/libplatform.h>
 
+#include "queue_provider.h"
 #include "worker.h"
 
 using namespace std;
 using namespace v8;
 
+// V8 binding for a queue, backed by whichever QueueProvider the queue's
+// depcfg entry names
 class Queue {
   public:
-    Queue(Worker* w, const char* provider, const char* ep,
-          const char* alias, const char* qname);
+    Queue(Worker* w, const char* alias, const QueueConfig& config);
     ~Queue();
 
     virtual bool Initialize(Worker* w,
                             map<string, string>* queue);
 
     Isolate* GetIsolate() { return isolate_; }
+    QueueProvider* GetProvider() { return provider_; }
 
-    Global<ObjectTemplate> queue_map_template_;
+    // Hands pushes buffered during a handler invocation to the provider
+    void FlushPushes();
 
-    redisContext *c;
+    Global<ObjectTemplate> queue_map_template_;
 
   private:
     bool InstallQueueMaps(map<string, string>* queue);
@@ -37,6 +40,8 @@ class Queue {
     static void QueueGetCall(Local<Name> name,
                              const PropertyCallbackInfo<Value>& info);
 
+    static void QueueDequeueCall(const FunctionCallbackInfo<Value>& args);
+
     Local<Object> WrapQueueMap(map<string, string> *queue);
 
     Isolate* isolate_;
@@ -46,6 +51,10 @@ class Queue {
     string queue_name;
     string endpoint;
     string queue_alias;
+
+    QueueProvider* provider_;
+    vector<string> pending_;
+    Global<Function> dequeue_;
 };
 
 #endif
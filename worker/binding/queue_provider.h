@@ -0,0 +1,54 @@
+#ifndef __QUEUE_PROVIDER_H__
+#define __QUEUE_PROVIDER_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Queue entry of the deployment config, provider selects the backend
+struct QueueConfig {
+    string provider;
+    string endpoint;
+    string queue_name;
+
+    // redis only, push over hiredis async API with at most max_in_flight
+    // values awaiting acknowledgement
+    bool async;
+    uint64_t max_in_flight;
+
+    // local only, slots in the in-process ring
+    uint64_t capacity;
+};
+
+// Backend behind enqueue()/dequeue(). Push is called once per handler
+// invocation with the values enqueued during it. Counters are read from
+// other threads for stats.
+class QueueProvider {
+  public:
+    QueueProvider() : enqueued(0), delivered(0), failed(0), dequeued(0) {}
+    virtual ~QueueProvider() {}
+
+    // Returns false if the backend can't be reached
+    virtual bool Connect() = 0;
+
+    // Values may be moved from
+    virtual void Push(vector<string>* values) = 0;
+
+    // Returns false if the queue is empty
+    virtual bool Pop(string* value) = 0;
+
+    // Values accepted but not yet acknowledged or consumed
+    virtual uint64_t InFlight() = 0;
+
+    atomic<uint64_t> enqueued;
+    atomic<uint64_t> delivered;
+    atomic<uint64_t> failed;
+    atomic<uint64_t> dequeued;
+};
+
+// Returns NULL for an unknown provider
+QueueProvider* NewQueueProvider(const QueueConfig& config);
+
+#endif
@@ -0,0 +1,132 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include "recursion_filter.h"
+
+using namespace std;
+
+// 4M bits(512KB) per generation with 4 hashes keeps false positive rate
+// well under 0.1% for up to ~200K writes per window
+static const uint64_t kBloomBits = 1ULL << 22;
+static const int kBloomHashes = 4;
+static const chrono::seconds kRotateWindow(30);
+
+static uint64_t bloom[2][kBloomBits / 64];
+static atomic<int> current_gen(0);
+
+static mutex filter_m;
+static unordered_map<uint64_t, uint64_t> tracked;   // fingerprint -> epoch
+static uint64_t epoch = 0;
+static chrono::steady_clock::time_point rotated_at = chrono::steady_clock::now();
+
+static atomic<uint64_t> writes_recorded(0);
+static atomic<uint64_t> mutations_checked(0);
+static atomic<uint64_t> self_writes_dropped(0);
+static atomic<uint64_t> bloom_false_positives(0);
+
+static uint64_t Mix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t Fingerprint(uint64_t scope, const char* key, size_t key_len,
+                            uint64_t cas) {
+  // FNV-1a over key, mixed with scope and cas
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < key_len; i++) {
+    h ^= static_cast<unsigned char>(key[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return Mix64(h ^ Mix64(cas) ^ Mix64(scope + 1));
+}
+
+static uint64_t BloomIndex(uint64_t fp, int i) {
+  uint64_t h2 = Mix64(fp) | 1;
+  return (fp + i * h2) & (kBloomBits - 1);
+}
+
+static bool BloomTest(int gen, uint64_t fp) {
+  for (int i = 0; i < kBloomHashes; i++) {
+    uint64_t idx = BloomIndex(fp, i);
+    uint64_t word = __atomic_load_n(&bloom[gen][idx / 64], __ATOMIC_RELAXED);
+    if (!(word & (1ULL << (idx % 64))))
+      return false;
+  }
+  return true;
+}
+
+// Expects filter_m to be held
+static void MaybeRotate() {
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  if (now - rotated_at < kRotateWindow)
+    return;
+
+  // Generation being recycled holds writes older than two windows
+  int next = 1 - current_gen.load();
+  for (uint64_t i = 0; i < kBloomBits / 64; i++)
+    __atomic_store_n(&bloom[next][i], 0, __ATOMIC_RELAXED);
+
+  epoch++;
+  for (auto it = tracked.begin(); it != tracked.end();) {
+    if (it->second + 1 < epoch)
+      it = tracked.erase(it);
+    else
+      ++it;
+  }
+
+  current_gen.store(next);
+  rotated_at = now;
+}
+
+void RecursionFilterAdd(uint64_t scope, const char* key, size_t key_len,
+                        uint64_t cas) {
+  uint64_t fp = Fingerprint(scope, key, key_len, cas);
+
+  lock_guard<mutex> lk(filter_m);
+  MaybeRotate();
+
+  int gen = current_gen.load();
+  for (int i = 0; i < kBloomHashes; i++) {
+    uint64_t idx = BloomIndex(fp, i);
+    __atomic_fetch_or(&bloom[gen][idx / 64], 1ULL << (idx % 64),
+                      __ATOMIC_RELAXED);
+  }
+  tracked[fp] = epoch;
+  writes_recorded++;
+}
+
+bool RecursionFilterCheck(uint64_t scope, const char* key, size_t key_len,
+                          uint64_t cas) {
+  mutations_checked++;
+  uint64_t fp = Fingerprint(scope, key, key_len, cas);
+
+  int gen = current_gen.load();
+  if (!BloomTest(gen, fp) && !BloomTest(1 - gen, fp))
+    return false;
+
+  lock_guard<mutex> lk(filter_m);
+  auto it = tracked.find(fp);
+  if (it == tracked.end()) {
+    bloom_false_positives++;
+    return false;
+  }
+
+  tracked.erase(it);
+  self_writes_dropped++;
+  return true;
+}
+
+void RecursionFilterStats(recursion_filter_stats* stats) {
+  stats->writes_recorded = writes_recorded.load();
+  stats->mutations_checked = mutations_checked.load();
+  stats->self_writes_dropped = self_writes_dropped.load();
+  stats->bloom_false_positives = bloom_false_positives.load();
+
+  lock_guard<mutex> lk(filter_m);
+  stats->tracked_writes = tracked.size();
+}
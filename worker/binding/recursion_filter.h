@@ -0,0 +1,37 @@
+#ifndef __RECURSION_FILTER_H__
+#define __RECURSION_FILTER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Process-wide filter of recent (key, CAS) pairs written by handlers, used
+// to drop DCP mutations generated by a handler's own writes without any
+// KV round trips.
+//
+// A rotating two generation Bloom filter answers the common "not a self
+// write" case lock-free. Positives are confirmed against an exact set of
+// fingerprints, so a Bloom false positive never drops a genuine mutation.
+// Entries live for at most two rotation windows, the DCP echo of a write
+// usually arrives within milliseconds.
+
+struct recursion_filter_stats {
+    uint64_t writes_recorded;
+    uint64_t mutations_checked;
+    uint64_t self_writes_dropped;
+    uint64_t bloom_false_positives;
+    uint64_t tracked_writes;
+};
+
+// scope isolates apps from each other, so that writes of one app still
+// trigger handlers of another app listening on the same bucket
+void RecursionFilterAdd(uint64_t scope, const char* key, size_t key_len,
+                        uint64_t cas);
+
+// Returns true if the mutation was generated by a handler write in the
+// same scope. A matching entry is consumed
+bool RecursionFilterCheck(uint64_t scope, const char* key, size_t key_len,
+                          uint64_t cas);
+
+void RecursionFilterStats(recursion_filter_stats* stats);
+
+#endif
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <poll.h>
+
+#include "redis_queue.h"
+
+using namespace std;
+
+// Values per LPUSH command, keeps individual commands reasonably sized
+static const size_t kMaxPushValues = 512;
+static const uint64_t kDefaultMaxInFlight = 10000;
+static const chrono::seconds kAsyncReconnectInterval(1);
+
+static void BuildPushArgv(const string& qname, const vector<string>& values,
+                          size_t off, size_t count,
+                          vector<const char*>* argv, vector<size_t>* argvlen) {
+  argv->clear();
+  argvlen->clear();
+
+  argv->push_back("LPUSH");
+  argvlen->push_back(5);
+  argv->push_back(qname.c_str());
+  argvlen->push_back(qname.size());
+  for (size_t i = off; i < off + count; i++) {
+    argv->push_back(values[i].c_str());
+    argvlen->push_back(values[i].size());
+  }
+}
+
+// Async context is freed by hiredis once it disconnects or fails to
+// connect, both callbacks run with async_m_ held
+static void AsyncConnectCallback(const redisAsyncContext* ac, int status) {
+  if (status != REDIS_OK) {
+    cout << "Async connection error: " << ac->errstr << endl;
+    *static_cast<redisAsyncContext**>(ac->data) = NULL;
+  }
+}
+
+static void AsyncDisconnectCallback(const redisAsyncContext* ac, int status) {
+  if (status != REDIS_OK)
+    cout << "Async connection lost: " << ac->errstr << endl;
+  *static_cast<redisAsyncContext**>(ac->data) = NULL;
+}
+
+RedisQueue::RedisQueue(const QueueConfig& config) {
+  string delimiter = ":";
+  string endpoint = config.endpoint;
+  hostname_ = endpoint.substr(0, endpoint.find(delimiter));
+  endpoint.erase(0, endpoint.find(delimiter) + delimiter.length());
+  port_ = std::stoi(endpoint.substr(0, endpoint.find(delimiter)));
+  queue_name_ = config.queue_name;
+
+  c_ = NULL;
+  async_ = config.async;
+  max_in_flight_ = config.max_in_flight > 0 ? config.max_in_flight :
+                   kDefaultMaxInFlight;
+  in_flight_ = 0;
+  ac_ = NULL;
+  async_running_ = false;
+}
+
+RedisQueue::~RedisQueue() {
+  if (async_running_) {
+    // Give outstanding pushes a chance to get acknowledged
+    {
+      unique_lock<mutex> lk(async_m_);
+      window_cv_.wait_for(lk, chrono::seconds(1),
+                          [this]() { return in_flight_ == 0 || ac_ == NULL; });
+    }
+
+    async_running_ = false;
+    async_thread_.join();
+  }
+  if (ac_)
+    redisAsyncFree(ac_);
+  if (c_)
+    redisFree(c_);
+}
+
+bool RedisQueue::Connect() {
+  struct timeval timeout = { 1, 500000 };
+  c_ = redisConnectWithTimeout(hostname_.c_str(), port_, timeout);
+  if (c_ == NULL || c_->err) {
+      if (c_) {
+          cout << "Connection error: " << c_->errstr << endl;
+          redisFree(c_);
+          c_ = NULL;
+      } else {
+          cout << "Connection error: can't allocate redis context" << endl;
+      }
+      return false;
+  }
+
+  // Delete pre-existing list
+  redisReply* reply = (redisReply*) redisCommand(c_, "DEL %b",
+                                                 queue_name_.c_str(),
+                                                 queue_name_.size());
+  if (reply)
+    freeReplyObject(reply);
+
+  if (!async_)
+    return true;
+
+  {
+    lock_guard<mutex> lk(async_m_);
+    if (!ConnectAsync())
+      return false;
+  }
+
+  async_running_ = true;
+  async_thread_ = thread(&RedisQueue::AsyncLoop, this);
+  return true;
+}
+
+bool RedisQueue::ConnectAsync() {
+  next_reconnect_ = chrono::steady_clock::now() + kAsyncReconnectInterval;
+
+  ac_ = redisAsyncConnect(hostname_.c_str(), port_);
+  if (ac_ == NULL || ac_->err) {
+      cout << "Async connection error: "
+           << (ac_ ? ac_->errstr : "can't allocate redis context") << endl;
+      if (ac_)
+        redisAsyncFree(ac_);
+      ac_ = NULL;
+      return false;
+  }
+  ac_->data = &ac_;
+  redisAsyncSetConnectCallback(ac_, AsyncConnectCallback);
+  redisAsyncSetDisconnectCallback(ac_, AsyncDisconnectCallback);
+  return true;
+}
+
+void RedisQueue::AsyncLoop() {
+  while (async_running_) {
+    int fd = -1;
+    {
+      lock_guard<mutex> lk(async_m_);
+      if (ac_) {
+        // Pushes are written from the handler thread, whatever didn't fit
+        // in the socket buffer then is written out here
+        redisAsyncHandleWrite(ac_);
+        if (ac_)
+          fd = ac_->c.fd;
+      }
+    }
+
+    if (fd < 0) {
+      this_thread::sleep_for(chrono::milliseconds(10));
+      continue;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 10) > 0) {
+      lock_guard<mutex> lk(async_m_);
+      if (ac_)
+        redisAsyncHandleRead(ac_);
+    }
+  }
+}
+
+void RedisQueue::PushCallback(redisAsyncContext* ac, void* r, void* privdata) {
+  RedisQueue* queue = static_cast<RedisQueue*>(privdata);
+  redisReply* reply = static_cast<redisReply*>(r);
+
+  // Replies arrive in command order, reply to LPUSH is the list length so
+  // number of values each command carried is tracked on the side
+  uint64_t count = queue->async_counts_.front();
+  queue->async_counts_.pop_front();
+
+  if (reply && reply->type == REDIS_REPLY_INTEGER) {
+    queue->delivered += count;
+  } else {
+    if (reply && reply->type == REDIS_REPLY_ERROR)
+      cout << "LPUSH failed: " << reply->str << endl;
+    queue->failed += count;
+  }
+  queue->in_flight_ -= count;
+  queue->window_cv_.notify_all();
+}
+
+void RedisQueue::SendAsync(const vector<string>& values) {
+  vector<const char*> argv;
+  vector<size_t> argvlen;
+  size_t chunk = min<uint64_t>(kMaxPushValues, max_in_flight_);
+
+  for (size_t off = 0; off < values.size(); off += chunk) {
+    size_t count = min(chunk, values.size() - off);
+
+    unique_lock<mutex> lk(async_m_);
+    window_cv_.wait(lk, [this, count]() {
+      return ac_ == NULL || in_flight_ + count <= max_in_flight_;
+    });
+    if (ac_ == NULL && chrono::steady_clock::now() >= next_reconnect_)
+      ConnectAsync();
+    if (ac_ == NULL) {
+      failed += count;
+      continue;
+    }
+
+    BuildPushArgv(queue_name_, values, off, count, &argv, &argvlen);
+    async_counts_.push_back(count);
+    in_flight_ += count;
+    if (redisAsyncCommandArgv(ac_, PushCallback, this, argv.size(),
+                              &argv[0], &argvlen[0]) != REDIS_OK) {
+      async_counts_.pop_back();
+      in_flight_ -= count;
+      failed += count;
+      continue;
+    }
+    redisAsyncHandleWrite(ac_);
+  }
+}
+
+void RedisQueue::SendSync(const vector<string>& values) {
+  vector<const char*> argv;
+  vector<size_t> argvlen;
+  vector<size_t> counts;
+
+  // All chunks are written before any reply is read
+  for (size_t off = 0; off < values.size(); off += kMaxPushValues) {
+    size_t count = min(kMaxPushValues, values.size() - off);
+    BuildPushArgv(queue_name_, values, off, count, &argv, &argvlen);
+    if (redisAppendCommandArgv(c_, argv.size(), &argv[0],
+                               &argvlen[0]) != REDIS_OK) {
+      failed += values.size() - off;
+      break;
+    }
+    counts.push_back(count);
+  }
+
+  for (size_t i = 0; i < counts.size(); i++) {
+    redisReply* reply = NULL;
+    if (redisGetReply(c_, (void**)&reply) != REDIS_OK) {
+      cout << "LPUSH failed: " << c_->errstr << endl;
+      for (; i < counts.size(); i++)
+        failed += counts[i];
+      break;
+    }
+
+    if (reply->type == REDIS_REPLY_INTEGER) {
+      delivered += counts[i];
+    } else {
+      if (reply->type == REDIS_REPLY_ERROR)
+        cout << "LPUSH failed: " << reply->str << endl;
+      failed += counts[i];
+    }
+    freeReplyObject(reply);
+  }
+}
+
+void RedisQueue::Push(vector<string>* values) {
+  enqueued += values->size();
+  if (async_)
+    SendAsync(*values);
+  else
+    SendSync(*values);
+}
+
+// Consumers pop from the opposite end, so that the list is FIFO
+bool RedisQueue::Pop(string* value) {
+  redisReply* reply = (redisReply*) redisCommand(c_, "RPOP %b",
+                                                 queue_name_.c_str(),
+                                                 queue_name_.size());
+  if (reply == NULL)
+    return false;
+
+  bool found = reply->type == REDIS_REPLY_STRING;
+  if (found) {
+    value->assign(reply->str, reply->len);
+    dequeued++;
+  }
+  freeReplyObject(reply);
+  return found;
+}
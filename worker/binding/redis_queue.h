@@ -0,0 +1,65 @@
+#ifndef __REDIS_QUEUE_H__
+#define __REDIS_QUEUE_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hiredis.h>
+#include <async.h>
+
+#include "queue_provider.h"
+
+using namespace std;
+
+// Pushes values onto a Redis list with multi-value LPUSHes, pipelined over
+// a blocking connection or, in async mode, over the hiredis async API
+class RedisQueue : public QueueProvider {
+  public:
+    explicit RedisQueue(const QueueConfig& config);
+    ~RedisQueue();
+
+    bool Connect() override;
+    void Push(vector<string>* values) override;
+    bool Pop(string* value) override;
+    uint64_t InFlight() override { return in_flight_; }
+
+  private:
+    void SendSync(const vector<string>& values);
+    void SendAsync(const vector<string>& values);
+
+    // Sets up ac_, expects async_m_ to be held
+    bool ConnectAsync();
+
+    static void PushCallback(redisAsyncContext* ac, void* r, void* privdata);
+    void AsyncLoop();
+
+    string hostname_;
+    int port_;
+    string queue_name_;
+
+    redisContext* c_;
+
+    // Async mode, pushes are written from the handler thread and replies
+    // are read by async_thread_. hiredis async context isn't thread safe,
+    // async_m_ guards it. At most max_in_flight_ values are awaiting a reply.
+    // A lost connection is re-established by the next push, at most once
+    // per kAsyncReconnectInterval
+    bool async_;
+    uint64_t max_in_flight_;
+    atomic<uint64_t> in_flight_;
+    redisAsyncContext* ac_;
+    deque<uint64_t> async_counts_;
+    mutex async_m_;
+    condition_variable window_cv_;
+    chrono::steady_clock::time_point next_reconnect_;
+    thread async_thread_;
+    atomic<bool> async_running_;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "ring_buffer.h"
+
+using namespace std;
+
+static uint64_t RoundUpPowerOfTwo(uint64_t v) {
+  uint64_t p = 1;
+  while (p < v) p <<= 1;
+  return p;
+}
+
+ring_buffer* ring_buffer_new(uint64_t capacity) {
+  ring_buffer* r = NULL;
+  if (posix_memalign(reinterpret_cast<void**>(&r), 64, sizeof(ring_buffer)) != 0)
+    return NULL;
+  memset(r, 0, sizeof(ring_buffer));
+
+  r->capacity = RoundUpPowerOfTwo(capacity < 4096 ? 4096 : capacity);
+  if (posix_memalign(reinterpret_cast<void**>(&r->data), 64, r->capacity) != 0) {
+    free(r);
+    return NULL;
+  }
+
+#ifdef __linux__
+  r->doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  r->wait_fd = r->doorbell_fd;
+  bool doorbell_ok = r->doorbell_fd >= 0;
+#else
+  int fds[2];
+  bool doorbell_ok = pipe(fds) == 0;
+  if (doorbell_ok) {
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    r->wait_fd = fds[0];
+    r->doorbell_fd = fds[1];
+  }
+#endif
+
+  if (!doorbell_ok) {
+    cerr << "Failed to create ring buffer doorbell: " << strerror(errno) << endl;
+    free(r->data);
+    free(r);
+    return NULL;
+  }
+
+  return r;
+}
+
+void ring_buffer_free(ring_buffer* r) {
+  if (r == NULL) return;
+
+  close(r->doorbell_fd);
+  if (r->wait_fd != r->doorbell_fd)
+    close(r->wait_fd);
+  free(r->data);
+  free(r);
+}
+
+void ring_buffer_wait(ring_buffer* r, int timeout_ms) {
+  struct pollfd pfd;
+  pfd.fd = r->wait_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  if (poll(&pfd, 1, timeout_ms) > 0) {
+    // Drain the doorbell, eventfd hands back the counter in one read
+    // whereas a pipe could have several pending writes
+    char buf[64];
+    while (read(r->wait_fd, buf, sizeof(buf)) > 0) {
+      if (r->wait_fd == r->doorbell_fd) break;
+    }
+    __atomic_fetch_add(&r->consumer_wakeups, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void ring_buffer_wakeup(ring_buffer* r) {
+  uint64_t one = 1;
+  ssize_t rc = write(r->doorbell_fd, &one, sizeof(one));
+  (void)rc;
+}
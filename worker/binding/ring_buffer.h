@@ -0,0 +1,107 @@
+#ifndef __RING_BUFFER_H__
+#define __RING_BUFFER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Single producer/single consumer byte ring shared between the Go DCP
+// goroutine (producer) and the C++ thread owning the isolate (consumer).
+//
+// Producer copies length-prefixed records into data, then publishes them by
+// atomically bumping tail. Consumer processes records from head and
+// atomically bumps head once a record is consumed. Both counters grow
+// monotonically, offset into data is counter & (capacity - 1).
+//
+// Record layout, every record is 8 byte aligned:
+// ring_record_hdr | value '\0' | meta '\0' | type '\0' | padding
+//
+// DCP_MUTATIONs carry binary metadata instead of a JSON meta string:
+// ring_record_hdr | event_meta | key | value | padding
+// with value_len set to length of value and meta_len to sizeof(event_meta),
+// key length is part of event_meta. Same layout is used for batches sent
+// via worker_send_mutations.
+//
+// If a record doesn't fit in the contiguous space left before the end of
+// data, producer writes a RING_RECORD_PADDING header (only size and kind
+// are valid) and wraps around.
+
+#define RING_RECORD_UPDATE   1
+#define RING_RECORD_DELETE   2
+#define RING_RECORD_PADDING  3
+#define RING_RECORD_MUTATION 4
+
+#define RING_RECORD_ALIGN 8
+
+typedef struct ring_record_hdr_s {
+    uint32_t size;
+    uint32_t kind;
+    uint32_t value_len;
+    uint32_t meta_len;
+    uint32_t type_len;
+    uint32_t reserved;
+} ring_record_hdr;
+
+#define EVENT_DATATYPE_JSON   1
+#define EVENT_DATATYPE_BINARY 2
+
+typedef struct event_meta_s {
+    uint64_t cas;
+    uint64_t seqno;
+    uint32_t expiry;
+    uint32_t key_len;
+    uint16_t vbucket;
+    uint8_t datatype;
+    uint8_t reserved[5];
+} event_meta;
+
+typedef struct ring_buffer_s {
+    // Written by producer only
+    uint64_t tail;
+    char pad0[56];
+
+    // Written by consumer only
+    uint64_t head;
+    char pad1[56];
+
+    // Set by consumer before it blocks on the doorbell, producer writes an
+    // 8 byte value to doorbell_fd after publishing if it is set
+    uint32_t consumer_sleeping;
+    int32_t doorbell_fd;
+    int32_t wait_fd;
+    uint64_t capacity;
+    char* data;
+
+    // Producer side counters
+    uint64_t records_written;
+    uint64_t bytes_written;
+    uint64_t producer_full_waits;
+    uint64_t doorbells_rung;
+
+    // Consumer side counters
+    uint64_t records_read;
+    uint64_t records_failed;
+    uint64_t consumer_wakeups;
+} ring_buffer;
+
+// capacity is rounded up to next power of two
+ring_buffer* ring_buffer_new(uint64_t capacity);
+void ring_buffer_free(ring_buffer* r);
+
+#ifdef __cplusplus
+} // extern "C"
+
+// Consumer side helpers, used from the thread owning the isolate
+
+// Blocks on the doorbell until the producer has published data or
+// timeout_ms has elapsed
+void ring_buffer_wait(ring_buffer* r, int timeout_ms);
+
+// Wakes up the consumer irrespective of consumer_sleeping, used on shutdown
+void ring_buffer_wakeup(ring_buffer* r);
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+#include <utility>
+
+#include "timer_wheel.h"
+
+using namespace std;
+
+TimerWheel::TimerWheel(uint64_t tick_ms, uint64_t now_ms)
+    : tick_ms_(tick_ms > 0 ? tick_ms : 1), size_(0) {
+  current_tick_ = now_ms / tick_ms_;
+
+  slots_[0].resize(kL0Size);
+  for (int level = 1; level < kLevels; level++)
+    slots_[level].resize(kLnSize);
+}
+
+void TimerWheel::Add(TimerEntry&& entry) {
+  Place(std::move(entry));
+  size_++;
+}
+
+// Timer fires on the first tick at or after due_ms, never early
+void TimerWheel::Place(TimerEntry&& entry) {
+  uint64_t due_tick = (entry.due_ms + tick_ms_ - 1) / tick_ms_;
+
+  if (due_tick < current_tick_) {
+    slots_[0][current_tick_ & (kL0Size - 1)].push_back(std::move(entry));
+    return;
+  }
+
+  uint64_t delta = due_tick - current_tick_;
+  if (delta < kL0Size) {
+    slots_[0][due_tick & (kL0Size - 1)].push_back(std::move(entry));
+    return;
+  }
+
+  for (int level = 1; level < kLevels; level++) {
+    int shift = kL0Bits + (level - 1) * kLnBits;
+    if (delta < (1ULL << (shift + kLnBits))) {
+      slots_[level][(due_tick >> shift) & (kLnSize - 1)]
+          .push_back(std::move(entry));
+      return;
+    }
+  }
+
+  // Beyond the span of the wheel
+  int shift = kL0Bits + (kLevels - 2) * kLnBits;
+  uint64_t last_tick = current_tick_ + (1ULL << (shift + kLnBits)) - 1;
+  slots_[kLevels - 1][(last_tick >> shift) & (kLnSize - 1)]
+      .push_back(std::move(entry));
+}
+
+// Re-places timers of the current slot of level, returns the slot index
+// so that the caller knows whether the level itself wrapped around
+uint64_t TimerWheel::Cascade(int level) {
+  int shift = kL0Bits + (level - 1) * kLnBits;
+  uint64_t index = (current_tick_ >> shift) & (kLnSize - 1);
+
+  vector<TimerEntry> entries;
+  entries.swap(slots_[level][index]);
+  for (size_t i = 0; i < entries.size(); i++)
+    Place(std::move(entries[i]));
+
+  return index;
+}
+
+void TimerWheel::Advance(uint64_t now_ms, vector<TimerEntry>* due) {
+  uint64_t target_tick = now_ms / tick_ms_;
+
+  while (current_tick_ <= target_tick) {
+    // Nothing to cascade or fire, jump straight to the target
+    if (size_ == 0) {
+      current_tick_ = target_tick + 1;
+      break;
+    }
+
+    uint64_t index = current_tick_ & (kL0Size - 1);
+    if (index == 0) {
+      for (int level = 1; level < kLevels; level++) {
+        if (Cascade(level) != 0)
+          break;
+      }
+    }
+
+    vector<TimerEntry>& slot = slots_[0][index];
+    size_ -= slot.size();
+    for (size_t i = 0; i < slot.size(); i++)
+      due->push_back(std::move(slot[i]));
+    slot.clear();
+
+    current_tick_++;
+  }
+}
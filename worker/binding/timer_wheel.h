@@ -0,0 +1,62 @@
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Timer registered by a handler through registerCallback. callback indexes
+// into the worker's table of interned callback names
+struct TimerEntry {
+    uint64_t due_ms;
+    uint32_t callback;
+    string doc_id;
+
+    TimerEntry() : due_ms(0), callback(0) {}
+    TimerEntry(uint64_t due, uint32_t cb, const string& id)
+        : due_ms(due), callback(cb), doc_id(id) {}
+};
+
+// Hierarchical timing wheel, same layout as the classic kernel timer wheel.
+// Level 0 has 256 slots of tick_ms each, every upper level has 64 slots
+// each spanning a full turn of the level below. Add is O(1), timers are
+// cascaded one level down whenever the level below wraps around, so a
+// timer is moved at most once per level before it fires.
+//
+// Timers due further out than the wheel spans are parked in the last
+// slot of the top level and get re-placed as it cascades. Not thread
+// safe, meant to be owned by a single isolate.
+class TimerWheel {
+  public:
+    TimerWheel(uint64_t tick_ms, uint64_t now_ms);
+
+    // Timers already due fire on next Advance
+    void Add(TimerEntry&& entry);
+
+    // Moves every timer due at or before now_ms to the end of due
+    void Advance(uint64_t now_ms, vector<TimerEntry>* due);
+
+    size_t Size() const { return size_; }
+    uint64_t TickMs() const { return tick_ms_; }
+
+  private:
+    static const int kLevels = 4;
+    static const int kL0Bits = 8;
+    static const int kLnBits = 6;
+    static const uint64_t kL0Size = 1ULL << kL0Bits;
+    static const uint64_t kLnSize = 1ULL << kLnBits;
+
+    void Place(TimerEntry&& entry);
+    uint64_t Cascade(int level);
+
+    uint64_t tick_ms_;
+    uint64_t current_tick_;
+    size_t size_;
+
+    vector<vector<TimerEntry> > slots_[kLevels];
+};
+
+#endif
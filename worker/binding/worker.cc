@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
@@ -5,12 +6,15 @@
 #include <cstring>
 #include <ctime>
 #include <curl/curl.h>
+#include <iterator>
 #include <mutex>
 #include <regex>
 #include <sstream>
 #include <thread>
 #include <typeinfo>
 
+#include <sys/stat.h>
+
 #include <phosphor/phosphor.h>
 
 #include <rapidjson/document.h>
@@ -18,10 +22,14 @@
 #include <rapidjson/stringbuffer.h>
 
 #include "bucket.h"
+#include "event_filter.h"
+#include "event_meta.h"
 #include "http_response.h"
+#include "lazy_doc.h"
 #include "n1ql.h"
 #include "parse_deployment.h"
 #include "queue.h"
+#include "recursion_filter.h"
 #include "event_assert.h"
 
 using namespace v8;
@@ -36,7 +44,8 @@ enum RETURN_CODE
     FAILED_INIT_QUEUE_HANDLE,
     RAPIDJSON_FAILED_PARSE,
     ON_UPDATE_CALL_FAIL,
-    ON_DELETE_CALL_FAIL
+    ON_DELETE_CALL_FAIL,
+    INVALID_DEPLOYMENT_CONFIG
 };
 
 string cb_cluster_endpoint;
@@ -48,6 +57,21 @@ string set_breakpoint_result;
 string clear_breakpoint_result;
 string list_breakpoint_result;
 
+// Resolution of the registerCallback timing wheel
+static const uint64_t kTimerTickMs = 100;
+
+// Spilled timers of a minute are split over this many shards. Catching up
+// loads at most kTimerLoadMinutes minutes per scheduled batch
+static const uint32_t kTimerSpillShards = 16;
+static const uint64_t kTimerLoadMinutes = 60;
+
+// Isolates of an app with dcp invalidation on, by app name. DCP events of
+// a vbucket reach a single isolate while any of them, http ones included,
+// may have cached the doc
+static std::mutex invalidation_registry_lock;
+static map<string, vector<Worker*> > invalidation_registry;
+static const size_t kMaxQueuedInvalidations = 10000;
+
 std::condition_variable cv;
 std::mutex debug_cv_m;
 std::atomic_bool data_ready(false);
@@ -306,6 +330,21 @@ static void op_get_callback(lcb_t instance, int cbtype, const lcb_RESPBASE *rb)
 
 static void op_set_callback(lcb_t instance, int cbtype, const lcb_RESPBASE *rb) {
     // cerr << "lcb set response code: " << lcb_strerror(instance, rb->rc) << endl;
+    Result *result = reinterpret_cast<Result*>(rb->cookie);
+    if (result != NULL)
+        result->status = rb->rc;
+}
+
+// Counter value is handed back as decimal string, same as a GET of the
+// counter doc would return
+static void op_counter_callback(lcb_t instance, int cbtype, const lcb_RESPBASE *rb) {
+    const lcb_RESPCOUNTER *resp = reinterpret_cast<const lcb_RESPCOUNTER*>(rb);
+    Result *result = reinterpret_cast<Result*>(rb->cookie);
+
+    result->status = resp->rc;
+    result->value.clear();
+    if (resp->rc == LCB_SUCCESS)
+        result->value = to_string(resp->value);
 }
 
 
@@ -322,6 +361,11 @@ string ObjectToString(Local<Value> value) {
 string ToString(Isolate* isolate, Handle<Value> object) {
   HandleScope handle_scope(isolate);
 
+  // Untouched docs are stored back as is, skipping parse and stringify
+  string raw_doc;
+  if (LazyDocSource(object, &raw_doc))
+    return raw_doc;
+
   Local<Context> context = isolate->GetCurrentContext();
   Local<Object> global = context->Global();
 
@@ -402,27 +446,17 @@ void Print(const FunctionCallbackInfo<Value>& args) {
   fflush(stdout);
 }
 
-string ConvertToISO8601(string timestamp) {
-  char buf[sizeof "2016-08-09T10:11:12"];
-  string buf_s;
-  time_t now;
-
-  int timerValue = atoi(timestamp.c_str());
+static uint64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
 
-  // Expiry timers more than 30 days will mention epoch
-  // otherwise it will mention seconds from when key
-  // was set
-  if (timerValue > 25920000) {
-    now = timerValue;
-    strftime(buf, sizeof buf, "%FT%T", gmtime(&now));
-    buf_s.assign(buf);
-  } else {
-    time(&now);
-    now += timerValue;
-    strftime(buf, sizeof buf, "%FT%T", gmtime(&now));
-    buf_s.assign(buf);
-  }
-  return buf_s;
+// Expiry timers more than 30 days will mention epoch otherwise it will
+// mention seconds from when key was set. Fractional seconds are honoured
+static uint64_t TimerDueMs(double expiry) {
+  if (expiry > 25920000)
+    return static_cast<uint64_t>(expiry * 1000);
+  return NowMs() + static_cast<uint64_t>(expiry * 1000);
 }
 
 void RegisterCallback(const FunctionCallbackInfo<Value>& args) {
@@ -431,97 +465,19 @@ void RegisterCallback(const FunctionCallbackInfo<Value>& args) {
   String::Utf8Value documentID(args[1]);
   String::Utf8Value startTimestamp(args[2]);
 
-  // Store a blob in KV store, blob structure:
-  // {
-  //    "callback_func": CallbackFunc1,
-  //    "document_id": docid,
-  //    "start_timestamp": timestamp
-  // }
-  string callback_func, doc_id, startTs, timestamp, value;
-  callback_func.assign(string(*callbackFuncName));
-  doc_id.assign(string(*documentID));
-  startTs.assign(string(*startTimestamp));
-
   // If the doc not supposed to expire, skip
   // setting up timer callback for it
-  if (atoi(startTs.c_str()) == 0) {
+  double expiry = strtod(*startTimestamp, NULL);
+  if (expiry <= 0) {
       fprintf(stdout,
               "Skipping timer callback setup for doc_id: %s doc won't expire\n",
-              doc_id.c_str());
+              *documentID);
       return;
   }
 
-  timestamp = ConvertToISO8601(startTs);
-
-  rapidjson::StringBuffer s;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(s);
-
-  writer.StartObject();
-
-  writer.Key("callback_func");
-  writer.String(callback_func.c_str(), callback_func.length());
-  writer.Key("doc_id");
-  writer.String(doc_id.c_str(), doc_id.length());
-  writer.Key("start_timestamp");
-  writer.String(timestamp.c_str(), timestamp.length());
-
-  writer.EndObject();
-
-  value.assign(s.GetString());
-
-  lcb_t* bucket_cb_handle = reinterpret_cast<lcb_t*>(args.GetIsolate()->GetData(1));
-
-  lcb_CMDSTORE scmd = { 0 };
-  LCB_CMD_SET_KEY(&scmd, doc_id.c_str(), doc_id.length());
-  LCB_CMD_SET_VALUE(&scmd, value.c_str(), value.length());
-  scmd.operation = LCB_SET;
-  scmd.flags = 0x2000000;
-
-  lcb_sched_enter(*bucket_cb_handle);
-  lcb_store3(*bucket_cb_handle, NULL, &scmd);
-  lcb_sched_leave(*bucket_cb_handle);
-  lcb_wait(*bucket_cb_handle);
-
-  // Append doc_id to key that keeps tracks of doc_ids for which
-  // callbacks need to be triggered at any given point in time
-
-  Result result;
-  lcb_CMDGET gcmd = { 0 };
-  LCB_CMD_SET_KEY(&gcmd, timestamp.c_str(), timestamp.length());
-  lcb_sched_enter(*bucket_cb_handle);
-  lcb_get3(*bucket_cb_handle, &result, &gcmd);
-  lcb_sched_leave(*bucket_cb_handle);
-  lcb_wait(*bucket_cb_handle);
-
-  if (result.status != LCB_SUCCESS) {
-    // LCB_ADD to KV
-    // TODO: error catching by setting up store_callback
-    string timestamp_marker("");
-    lcb_CMDSTORE acmd = { 0 };
-    LCB_CMD_SET_KEY(&acmd, timestamp.c_str(), timestamp.length());
-    LCB_CMD_SET_VALUE(&acmd, timestamp_marker.c_str(), timestamp_marker.length());
-    acmd.operation = LCB_ADD;
-
-    lcb_sched_enter(*bucket_cb_handle);
-    lcb_store3(*bucket_cb_handle, NULL, &acmd);
-    lcb_sched_leave(*bucket_cb_handle);
-    lcb_wait(*bucket_cb_handle);
-  }
-
-  // appending delimiter ";"
-  doc_id.append(";");
-  lcb_CMDSTORE cmd = { 0 };
-  lcb_IOV iov[2];
-  cmd.operation = LCB_APPEND;
-  iov[0].iov_base = (void *)doc_id.c_str();
-  iov[0].iov_len = doc_id.length();
-
-  LCB_CMD_SET_VALUEIOV(&cmd, iov, 1);
-  LCB_CMD_SET_KEY(&cmd, timestamp.c_str(), timestamp.length());
-  lcb_sched_enter(*bucket_cb_handle);
-  lcb_store3(*bucket_cb_handle, NULL, &cmd);
-  lcb_sched_leave(*bucket_cb_handle);
-  lcb_wait(*bucket_cb_handle);
+  Worker* w = static_cast<Worker*>(args.GetIsolate()->GetData(0));
+  w->ScheduleTimer(string(*callbackFuncName), string(*documentID),
+                   TimerDueMs(expiry));
 }
 
 void PostMail(char* app_name, char* to, char* subject, char* body) {
@@ -660,9 +616,140 @@ vector<string> split(const string &s, char delim) {
     return elems;
 }
 
+static string Base64Decode(const char* in) {
+  static const string chars =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  string out;
+  uint32_t buf = 0;
+  int bits = 0;
+
+  for (; *in != '\0' && *in != '='; in++) {
+    size_t pos = chars.find(*in);
+    if (pos == string::npos)
+      continue;
+    buf = (buf << 6) | static_cast<uint32_t>(pos);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out.push_back(static_cast<char>((buf >> bits) & 0xFF));
+    }
+  }
+  return out;
+}
+
+// builtin.js is read from disk once per process
+void LoadBuiltins(string* out) {
+  static std::once_flag builtins_once;
+  static string builtins;
+
+  std::call_once(builtins_once, []() {
+    ifstream ifs("builtin.js");
+    builtins.assign((istreambuf_iterator<char> (ifs)),
+                    (istreambuf_iterator<char>()));
+  });
+  out->assign(builtins);
+}
+
+// Optional startup snapshot with builtin.js already compiled and run, so
+// that new isolates deserialize builtins instead of compiling them from
+// source. Blob is built lazily on first isolate creation after snapshot
+// mode gets enabled and is kept around for the lifetime of the process.
+static std::mutex snapshot_m;
+static bool use_startup_snapshot = false;
+static StartupData startup_snapshot = { NULL, 0 };
+
+static StartupData* GetStartupSnapshot() {
+  std::lock_guard<std::mutex> lk(snapshot_m);
+  if (!use_startup_snapshot)
+    return NULL;
+
+  if (startup_snapshot.data == NULL) {
+    string builtins;
+    LoadBuiltins(&builtins);
+
+    startup_snapshot = V8::CreateSnapshotDataBlob(builtins.c_str());
+    if (startup_snapshot.data == NULL) {
+      cerr << "Failed to create startup snapshot, falling back to "
+           << "compiling builtins per isolate" << endl;
+      use_startup_snapshot = false;
+      return NULL;
+    }
+  }
+  return &startup_snapshot;
+}
+
+void v8_set_startup_snapshot(int enabled) {
+  std::lock_guard<std::mutex> lk(snapshot_m);
+  use_startup_snapshot = enabled != 0;
+}
+
+// Compiled code cache for handler scripts, persisted under
+// ./apps/.code_cache/<app_name>_<source hash>. Entries are also kept in
+// memory so that additional isolates of an app skip the disk read.
+static const char* code_cache_dir = "./apps/.code_cache/";
+static std::mutex code_cache_m;
+static map<string, string> code_cache_entries;
+
+static string CodeCachePath(const string& app_name, const string& source) {
+  std::ostringstream path;
+  path << code_cache_dir << app_name << "_" << std::hex
+       << std::hash<string>()(source + V8::GetVersion());
+  return path.str();
+}
+
+static bool LoadCodeCache(const string& path, string* out) {
+  std::lock_guard<std::mutex> lk(code_cache_m);
+  map<string, string>::iterator it = code_cache_entries.find(path);
+  if (it != code_cache_entries.end()) {
+    out->assign(it->second);
+    return true;
+  }
+
+  ifstream ifs(path.c_str(), std::ios::binary);
+  if (!ifs.good())
+    return false;
+
+  out->assign((istreambuf_iterator<char> (ifs)),
+              (istreambuf_iterator<char>()));
+  if (out->empty())
+    return false;
+
+  code_cache_entries[path] = *out;
+  return true;
+}
+
+static void StoreCodeCache(const string& path, const char* data, int length) {
+  std::lock_guard<std::mutex> lk(code_cache_m);
+  code_cache_entries[path].assign(data, length);
+
+  mkdir(code_cache_dir, 0755);
+
+  // Write to a temp file and rename, so that a concurrent reader never
+  // sees a partially written cache
+  string tmp_path = path + ".tmp";
+  ofstream ofs(tmp_path.c_str(), std::ios::binary | std::ios::trunc);
+  ofs.write(data, length);
+  ofs.close();
+  if (ofs.fail() || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    cerr << "Failed to persist code cache: " << path << endl;
+    remove(tmp_path.c_str());
+  }
+}
+
+static void DropCodeCache(const string& path) {
+  std::lock_guard<std::mutex> lk(code_cache_m);
+  code_cache_entries.erase(path);
+  remove(path.c_str());
+}
+
 Worker::Worker(int tindex, const char* app_name) {
   Isolate::CreateParams create_params;
   create_params.array_buffer_allocator = &allocator;
+
+  StartupData* snapshot = GetStartupSnapshot();
+  create_params.snapshot_blob = snapshot;
+  builtins_in_snapshot_ = snapshot != NULL;
+
   isolate_ = Isolate::New(create_params);
   Locker locker(isolate_);
   Isolate::Scope isolate_scope(isolate_);
@@ -671,6 +758,33 @@ Worker::Worker(int tindex, const char* app_name) {
   isolate_->SetCaptureStackTraceForUncaughtExceptions(true);
   isolate_->SetData(0, this);
   table_index = tindex;
+  ring_ = NULL;
+  n1ql_handle = NULL;
+  queue_handle = NULL;
+  ring_running_ = false;
+  dcp_invalidation_ = false;
+  self_writes_skipped = 0;
+  invalidate_all_ = false;
+  has_invalidations_ = false;
+  events_filtered = 0;
+  events_passed = 0;
+  code_cache_hits = 0;
+  code_cache_misses = 0;
+  code_cache_rejects = 0;
+  compile_time_us = 0;
+  timer_spill_pending_ = 0;
+  timers_scheduled = 0;
+  timers_fired = 0;
+  timers_failed = 0;
+  timers_spilled = 0;
+  timers_loaded = 0;
+  timer_ticks = 0;
+  timer_tick_last_us = 0;
+  timer_tick_max_us = 0;
+  timer_tick_total_us = 0;
+  timer_lag_ms = 0;
+  timer_lag_max_ms = 0;
+  timer_checkpoint_read_ = false;
   Local<ObjectTemplate> global = ObjectTemplate::New(GetIsolate());
 
   TryCatch try_catch;
@@ -695,13 +809,34 @@ Worker::Worker(int tindex, const char* app_name) {
   Local<Context> context = Context::New(GetIsolate(), NULL, global);
   context_.Reset(GetIsolate(), context);
 
+  lazy_doc_template_.Reset(GetIsolate(), MakeLazyDocTemplate(GetIsolate()));
+  event_meta_template_.Reset(GetIsolate(), MakeEventMetaTemplate(GetIsolate()));
+
   app_name_ = app_name;
+  timer_key_prefix_ = app_name_;
+  recursion_scope = std::hash<string>()(app_name_);
   start_debug_flag = false;
   deployment_config* result = ParseDeployment(app_name);
 
   cb_cluster_endpoint.assign(result->source_endpoint);
   cb_cluster_bucket.assign(result->source_bucket);
 
+  // Minutes entirely within the horizon never spill, same as once
+  // FireTimers runs. Spilled records of those, and of any earlier minutes a
+  // previous run did not get to, are loaded on the first FireTimers call
+  // from the persisted checkpoint on
+  uint64_t now_ms = NowMs();
+  timer_wheel_ = new TimerWheel(kTimerTickMs, now_ms);
+  timer_horizon_ms_ = result->timers.horizon_min * 60000;
+  timer_loaded_minute_ = (now_ms + timer_horizon_ms_) / 60000 - 1;
+  timer_spill_batch_ = result->timers.spill_batch_size > 0 ?
+                       result->timers.spill_batch_size : 1;
+
+  event_filter_ = new EventFilter(result->filter);
+  config_error_ = result->error;
+  if (!event_filter_->Error().empty())
+    config_error_.append(event_filter_->Error() + "\n");
+
  //context->Enter();
 
   map<string, map<string, vector<string> > >::iterator it = result->component_configs.begin();
@@ -713,39 +848,61 @@ Worker::Worker(int tindex, const char* app_name) {
           for (; bucket != result->component_configs["buckets"].end(); bucket++) {
             string bucket_alias = bucket->first;
             string bucket_name = result->component_configs["buckets"][bucket_alias][0];
+            vector<string>& bucket_info = result->component_configs["buckets"][bucket_alias];
+            bool async_writes = bucket_info[2] == "true";
             string endpoint(cb_cluster_endpoint);
 
+            BucketCacheConfig cache_config;
+            cache_config.max_entries = strtoull(bucket_info[3].c_str(), NULL, 10);
+            cache_config.max_bytes = strtoull(bucket_info[4].c_str(), NULL, 10);
+            cache_config.ttl_ms = strtoull(bucket_info[5].c_str(), NULL, 10);
+            cache_config.dcp_invalidation = bucket_info[6] == "true" &&
+                                            bucket_name == cb_cluster_bucket;
+
             bucket_handle = new Bucket(this,
                            bucket_name.c_str(),
                            endpoint.c_str(),
-                           bucket_alias.c_str());
+                           bucket_alias.c_str(),
+                           async_writes,
+                           cache_config);
+            bucket_handles_.push_back(bucket_handle);
+            if (cache_config.dcp_invalidation)
+              dcp_invalidation_ = true;
           }
       }
 
       n1ql_handle = new N1QL(this,
                    cb_cluster_bucket.c_str(),
                    cb_cluster_endpoint.c_str(),
-                   "_n1ql");
+                   "_n1ql",
+                   result->n1ql);
 
       if (it->first == "queue") {
           map<string, vector<string> >::iterator queue = result->component_configs["queue"].begin();
           for (; queue != result->component_configs["queue"].end(); queue++) {
-            string provider = queue->first;
-            string endpoint = result->component_configs["queue"][provider][1];
-            string queue_alias = result->component_configs["queue"][provider][2];
-            string queue_name = result->component_configs["queue"][provider][3];
-
-            queue_handle = new Queue(this,
-                          provider.c_str(),
-                          endpoint.c_str(),
-                          queue_alias.c_str(),
-                          queue_name.c_str());
+            vector<string>& queue_info = queue->second;
+
+            QueueConfig queue_config;
+            queue_config.provider = queue_info[0];
+            queue_config.endpoint = queue_info[1];
+            queue_config.queue_name = queue_info[3];
+            queue_config.async = queue_info[4] == "true";
+            queue_config.max_in_flight = stoull(queue_info[5]);
+            queue_config.capacity = stoull(queue_info[6]);
+
+            queue_handle = new Queue(this, queue_info[2].c_str(),
+                                     queue_config);
           }
 
       }
   }
   http_response_handle = new HTTPResponse(this);
 
+  if (dcp_invalidation_) {
+    std::lock_guard<std::mutex> lock(invalidation_registry_lock);
+    invalidation_registry[app_name_].push_back(this);
+  }
+
   // Register a lcb_t handle for storing timer based callbacks in CB
   // TODO: Fix the hardcoding i.e. allow customer to create
   // bucket with any name and it should be picked from config file
@@ -766,21 +923,25 @@ Worker::Worker(int tindex, const char* app_name) {
 
   lcb_install_callback3(cb_instance, LCB_CALLBACK_GET, op_get_callback);
   lcb_install_callback3(cb_instance, LCB_CALLBACK_STORE, op_set_callback);
-
+  lcb_install_callback3(cb_instance, LCB_CALLBACK_COUNTER, op_counter_callback);
 }
 
 Worker::~Worker() {
+  for (size_t i = 0; i < timer_functions_.size(); i++)
+    timer_functions_[i].Reset();
   context_.Reset();
   on_delete_.Reset();
   on_update_.Reset();
-}
-
-void LoadBuiltins(string* out) {
-    ifstream ifs("builtin.js");
-    string content((istreambuf_iterator<char> (ifs)),
-                   (istreambuf_iterator<char>()));
-    out->assign(content);
-    return;
+  delete event_filter_;
+
+  if (dcp_invalidation_) {
+    std::lock_guard<std::mutex> lock(invalidation_registry_lock);
+    vector<Worker*>& workers = invalidation_registry[app_name_];
+    workers.erase(std::remove(workers.begin(), workers.end(), this),
+                  workers.end());
+    if (workers.empty())
+      invalidation_registry.erase(app_name_);
+  }
 }
 
 int Worker::WorkerLoad(char* name_s, char* source_s) {
@@ -793,14 +954,28 @@ int Worker::WorkerLoad(char* name_s, char* source_s) {
 
   TryCatch try_catch;
 
+  if (!config_error_.empty()) {
+    last_exception = config_error_;
+    return INVALID_DEPLOYMENT_CONFIG;
+  }
+
+  // Preprocessor regexes are compiled once per process
+  static const std::regex enqueue("(enqueue\\((.*)\\, (.*)\\))");
+  static const std::regex n1ql_ttl("(n1ql(?:Stream)?\\(\")(.*)(\"\\))");
+  static const std::regex re_prefix("\\(\"");
+  static const std::regex re_suffix("\"\\)");
+
   string temp, script_to_execute;
   string content, builtin_functions;
-  LoadBuiltins(&builtin_functions);
+
+  // Builtins are already part of the context when isolate was created
+  // from the startup snapshot
+  if (!builtins_in_snapshot_)
+    LoadBuiltins(&builtin_functions);
 
   content.assign(source_s);
 
   // Preprocessor for allowing queue operations
-  std::regex enqueue("(enqueue\\((.*)\\, (.*)\\))");
   std::smatch queue_m;
 
   while (std::regex_search(content, queue_m, enqueue)) {
@@ -814,16 +989,14 @@ int Worker::WorkerLoad(char* name_s, char* source_s) {
   temp += content;
 
   // TODO: Figure out if there is a cleaner way to do preprocessing for n1ql
-  // Converting n1ql("<query>") to tagged template literal i.e. n1ql`<query>`
-  std::regex n1ql_ttl("(n1ql\\(\")(.*)(\"\\))");
+  // Converting n1ql("<query>") to tagged template literal i.e. n1ql`<query>`,
+  // same for n1qlStream("<query>")
   std::smatch n1ql_m;
 
   while (std::regex_search(temp, n1ql_m, n1ql_ttl)) {
       script_to_execute += n1ql_m.prefix();
-      std::regex re_prefix("n1ql\\(\"");
-      std::regex re_suffix("\"\\)");
       script_to_execute += std::regex_replace(n1ql_m[1].str(),
-                                              re_prefix, "n1ql`");
+                                              re_prefix, "`");
       script_to_execute += n1ql_m[2].str();
       script_to_execute += std::regex_replace(n1ql_m[3].str(),
                                               re_suffix, "`");
@@ -839,7 +1012,7 @@ int Worker::WorkerLoad(char* name_s, char* source_s) {
   script_to_execute_ = script_to_execute;
   // cout << "script to execute: " << script_to_execute << endl;
 
-  if (!ExecuteScript(source))
+  if (!ExecuteScript(source, script_to_execute))
       return FAILED_TO_COMPILE_JS;
 
   Local<String> on_update =
@@ -884,8 +1057,8 @@ int Worker::WorkerLoad(char* name_s, char* source_s) {
   on_http_post_.Reset(GetIsolate(), on_http_post_fun);
 
   //TODO: return proper exit codes
-  if (bucket_handle) {
-    if (!bucket_handle->Initialize(this, &bucket)) {
+  for (size_t i = 0; i < bucket_handles_.size(); i++) {
+    if (!bucket_handles_[i]->Initialize(this, &bucket)) {
       cerr << "Error initializing bucket handler" << endl;
       return FAILED_INIT_BUCKET_HANDLE;
     }
@@ -906,15 +1079,56 @@ int Worker::WorkerLoad(char* name_s, char* source_s) {
   return SUCCESS;
 }
 
-bool Worker::ExecuteScript(Local<String> script) {
+bool Worker::ExecuteScript(Local<String> script, const string& source) {
   HandleScope handle_scope(GetIsolate());
 
   TryCatch try_catch(GetIsolate());
 
   Local<Context> context(GetIsolate()->GetCurrentContext());
 
+  string cache_path = CodeCachePath(app_name_, source);
+  string cache_data;
+  bool cache_found = LoadCodeCache(cache_path, &cache_data);
+
+  ScriptCompiler::CompileOptions options = ScriptCompiler::kProduceCodeCache;
+  ScriptCompiler::CachedData* cached = NULL;
+  if (cache_found) {
+    options = ScriptCompiler::kConsumeCodeCache;
+    cached = new ScriptCompiler::CachedData(
+        reinterpret_cast<const uint8_t*>(cache_data.data()),
+        cache_data.length());
+  }
+
+  // Source takes ownership of cached, cache_data outlives it
+  ScriptCompiler::Source script_source(script, cached);
+
+  auto start = std::chrono::steady_clock::now();
+
   Local<Script> compiled_script;
-  if (!Script::Compile(context, script).ToLocal(&compiled_script)) {
+  bool compiled = ScriptCompiler::Compile(context, &script_source, options)
+                    .ToLocal(&compiled_script);
+
+  compile_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+  if (compiled) {
+    const ScriptCompiler::CachedData* cache = script_source.GetCachedData();
+    if (!cache_found) {
+      code_cache_misses++;
+      if (cache != NULL && cache->data != NULL)
+        StoreCodeCache(cache_path,
+                       reinterpret_cast<const char*>(cache->data),
+                       cache->length);
+    } else if (cache != NULL && cache->rejected) {
+      // V8 recompiled from source, stale cache is regenerated on next load
+      code_cache_rejects++;
+      DropCodeCache(cache_path);
+    } else {
+      code_cache_hits++;
+    }
+  }
+
+  if (!compiled) {
     assert(try_catch.HasCaught());
     last_exception = ExceptionString(GetIsolate(), &try_catch);
     // printf("Logged: %s\n", last_exception.c_str());
@@ -933,10 +1147,215 @@ bool Worker::ExecuteScript(Local<String> script) {
   return true;
 }
 
+// Own caches are invalidated right away, other isolates of the app apply
+// it ahead of their next doc cache read
+void Worker::InvalidateCachedDocs(const string& key, lcb_CAS cas) {
+  for (size_t i = 0; i < bucket_handles_.size(); i++)
+    bucket_handles_[i]->InvalidateDoc(key, cas);
+
+  std::lock_guard<std::mutex> lock(invalidation_registry_lock);
+  const vector<Worker*>& workers = invalidation_registry[app_name_];
+  for (size_t i = 0; i < workers.size(); i++) {
+    if (workers[i] != this)
+      workers[i]->QueueInvalidation(key, cas);
+  }
+}
+
+void Worker::QueueInvalidation(const string& key, lcb_CAS cas) {
+  std::lock_guard<std::mutex> lock(invalidations_lock_);
+  if (invalidate_all_)
+    return;
+
+  // Isolates that don't read for long, e.g. idle http ones, would
+  // otherwise queue up invalidations without bound
+  if (invalidations_.size() >= kMaxQueuedInvalidations) {
+    invalidations_.clear();
+    invalidate_all_ = true;
+  } else {
+    invalidations_.push_back(make_pair(key, cas));
+  }
+  has_invalidations_.store(true, std::memory_order_release);
+}
+
+void Worker::ApplyInvalidations() {
+  if (!has_invalidations_.load(std::memory_order_acquire))
+    return;
+
+  vector<pair<string, lcb_CAS> > invalidations;
+  bool invalidate_all;
+  {
+    std::lock_guard<std::mutex> lock(invalidations_lock_);
+    invalidations.swap(invalidations_);
+    invalidate_all = invalidate_all_;
+    invalidate_all_ = false;
+    has_invalidations_.store(false, std::memory_order_relaxed);
+  }
+
+  for (size_t i = 0; i < bucket_handles_.size(); i++) {
+    if (invalidate_all) {
+      bucket_handles_[i]->InvalidateAllDocs();
+      continue;
+    }
+    for (size_t j = 0; j < invalidations.size(); j++)
+      bucket_handles_[i]->InvalidateDoc(invalidations[j].first,
+                                        invalidations[j].second);
+  }
+}
+
+// Bucket writes queued up in async mode and queue pushes are sent out once
+// per handler invocation, irrespective of whether the handler threw
+void Worker::FlushWrites() {
+  for (size_t i = 0; i < bucket_handles_.size(); i++)
+    bucket_handles_[i]->FlushWrites();
+  if (queue_handle)
+    queue_handle->FlushPushes();
+}
+
 const char* Worker::WorkerLastException() {
   return last_exception.c_str();
 }
 
+// Doc caches, prepared statements and the timing wheel are only touched
+// by whichever thread holds the isolate, stats are read under the same
+// lock so that Go's stats ticker and /get_stats/ can call in concurrently
+string Worker::WorkerStats() {
+  Locker locker(GetIsolate());
+
+  rapidjson::StringBuffer buffer;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+  writer.StartObject();
+  writer.Key("code_cache_hits");
+  writer.Uint64(code_cache_hits);
+  writer.Key("code_cache_misses");
+  writer.Uint64(code_cache_misses);
+  writer.Key("code_cache_rejects");
+  writer.Uint64(code_cache_rejects);
+  writer.Key("compile_time_us");
+  writer.Uint64(compile_time_us);
+
+  uint64_t hits = 0, misses = 0, evictions = 0, expirations = 0, entries = 0;
+  for (size_t i = 0; i < bucket_handles_.size(); i++) {
+    const LRUCache<CachedDoc>& cache = bucket_handles_[i]->GetDocCache();
+    hits += cache.hits;
+    misses += cache.misses;
+    evictions += cache.evictions;
+    expirations += cache.expirations;
+    entries += cache.Size();
+  }
+  writer.Key("doc_cache_hits");
+  writer.Uint64(hits);
+  writer.Key("doc_cache_misses");
+  writer.Uint64(misses);
+  writer.Key("doc_cache_evictions");
+  writer.Uint64(evictions);
+  writer.Key("doc_cache_expirations");
+  writer.Uint64(expirations);
+  writer.Key("doc_cache_entries");
+  writer.Uint64(entries);
+
+  if (n1ql_handle) {
+    const LRUCache<PreparedStmt>& prepared = n1ql_handle->GetPreparedCache();
+    writer.Key("n1ql_prepared_hits");
+    writer.Uint64(prepared.hits);
+    writer.Key("n1ql_prepared_misses");
+    writer.Uint64(prepared.misses);
+    writer.Key("n1ql_prepared_evictions");
+    writer.Uint64(prepared.evictions);
+    writer.Key("n1ql_prepared_entries");
+    writer.Uint64(prepared.Size());
+    writer.Key("n1ql_reprepares");
+    writer.Uint64(n1ql_handle->reprepares);
+
+    // Result cache is shared by the app's isolates, every one of them
+    // reports the same app-wide counters
+    ResultCacheStats results;
+    n1ql_handle->GetResultCacheStats(&results);
+    writer.Key("n1ql_result_cache_hits");
+    writer.Uint64(results.hits);
+    writer.Key("n1ql_result_cache_misses");
+    writer.Uint64(results.misses);
+    writer.Key("n1ql_result_cache_evictions");
+    writer.Uint64(results.evictions);
+    writer.Key("n1ql_result_cache_expirations");
+    writer.Uint64(results.expirations);
+    writer.Key("n1ql_result_cache_entries");
+    writer.Uint64(results.entries);
+    writer.Key("n1ql_result_cache_bytes");
+    writer.Uint64(results.bytes);
+    writer.Key("n1ql_result_cache_time_saved_us");
+    writer.Uint64(results.time_saved_us);
+  }
+
+  QueueProvider* queue = queue_handle ? queue_handle->GetProvider() : NULL;
+  if (queue) {
+    writer.Key("queue_enqueued");
+    writer.Uint64(queue->enqueued);
+    writer.Key("queue_delivered");
+    writer.Uint64(queue->delivered);
+    writer.Key("queue_failed");
+    writer.Uint64(queue->failed);
+    writer.Key("queue_dequeued");
+    writer.Uint64(queue->dequeued);
+    writer.Key("queue_in_flight");
+    writer.Uint64(queue->InFlight());
+  }
+
+  writer.Key("timers_scheduled");
+  writer.Uint64(timers_scheduled);
+  writer.Key("timers_fired");
+  writer.Uint64(timers_fired);
+  writer.Key("timers_failed");
+  writer.Uint64(timers_failed);
+  writer.Key("timers_spilled");
+  writer.Uint64(timers_spilled);
+  writer.Key("timers_loaded");
+  writer.Uint64(timers_loaded);
+  writer.Key("timers_in_memory");
+  writer.Uint64(timer_wheel_->Size() + timer_spill_pending_);
+
+  // Only ticks that fired at least one timer are accounted for
+  writer.Key("timer_ticks");
+  writer.Uint64(timer_ticks);
+  writer.Key("timer_tick_last_us");
+  writer.Uint64(timer_tick_last_us);
+  writer.Key("timer_tick_max_us");
+  writer.Uint64(timer_tick_max_us);
+  writer.Key("timer_tick_avg_us");
+  uint64_t ticks = timer_ticks;
+  writer.Uint64(ticks == 0 ? 0 : timer_tick_total_us / ticks);
+  writer.Key("timer_lag_ms");
+  writer.Uint64(timer_lag_ms);
+  writer.Key("timer_lag_max_ms");
+  writer.Uint64(timer_lag_max_ms);
+
+  // Recursion filter counters other than self_writes_skipped are
+  // process-wide
+  recursion_filter_stats filter;
+  RecursionFilterStats(&filter);
+  writer.Key("self_writes_skipped");
+  writer.Uint64(self_writes_skipped);
+  writer.Key("filter_passed");
+  writer.Uint64(events_passed);
+  writer.Key("filter_dropped");
+  writer.Uint64(events_filtered);
+  writer.Key("recursion_filter_writes");
+  writer.Uint64(filter.writes_recorded);
+  writer.Key("recursion_filter_checks");
+  writer.Uint64(filter.mutations_checked);
+  writer.Key("recursion_filter_tracked");
+  writer.Uint64(filter.tracked_writes);
+  writer.Key("recursion_filter_false_positives");
+  writer.Uint64(filter.bloom_false_positives);
+  writer.Key("recursion_filter_fp_rate");
+  uint64_t genuine = filter.mutations_checked - filter.self_writes_dropped;
+  writer.Double(genuine == 0 ? 0.0 :
+                static_cast<double>(filter.bloom_false_positives) / genuine);
+  writer.EndObject();
+
+  return string(buffer.GetString(), buffer.GetSize());
+}
+
 const char* worker_version() {
     return V8::GetVersion();
 }
@@ -945,7 +1364,18 @@ const char* Worker::WorkerVersion() {
   return V8::GetVersion();
 }
 
-const char* Worker::SendHTTPGet(const char* http_req) {
+const char* Worker::SendHTTPGet(const char* http_req, uint64_t* length) {
+  return SendHTTPRequest(on_http_get_, http_req, length);
+}
+
+const char* Worker::SendHTTPPost(const char* http_req, uint64_t* length) {
+  return SendHTTPRequest(on_http_post_, http_req, length);
+}
+
+// Response body is serialized into a buffer owned by http_response_handle,
+// it's overwritten by the next request
+const char* Worker::SendHTTPRequest(Persistent<Function>& handler,
+                                    const char* http_req, uint64_t* length) {
   Locker locker(GetIsolate());
   Isolate::Scope isolate_scope(GetIsolate());
   HandleScope handle_scope(GetIsolate());
@@ -955,98 +1385,481 @@ const char* Worker::SendHTTPGet(const char* http_req) {
 
   TryCatch try_catch(GetIsolate());
 
-  this->http_response_handle->http_body->http_body.clear();
+  Local<Object> response = this->http_response_handle->NewResponse();
   Handle<Value> args[2];
   args[0] = v8::JSON::Parse(String::NewFromUtf8(GetIsolate(), http_req));
-  args[1] = this->http_response_handle->WrapHTTPResponseMap();
+  args[1] = response;
 
   if(try_catch.HasCaught()) {
     last_exception = ExceptionString(GetIsolate(), &try_catch);
     printf("Logged: %s\n", last_exception.c_str());
   }
 
-  Local<Function> on_http_get = Local<Function>::New(GetIsolate(), on_http_get_);
+  Local<Function> on_http = Local<Function>::New(GetIsolate(), handler);
 
-  on_http_get->Call(context->Global(), 2, args);
+  on_http->Call(context->Global(), 2, args);
+  FlushWrites();
 
-  return this->http_response_handle->ConvertMapToJson();
+  return this->http_response_handle->Serialize(response, length);
 }
 
-const char* Worker::SendHTTPPost(const char* http_req) {
+// Drains timers stored in KV by earlier versions. Blobs of every key in the
+// tick are fetched in one scheduled batch before the isolate is entered,
+// and removed in another one once their callbacks ran
+void Worker::SendTimerCallback(const char* k) {
+  vector<string> keys = split(k, ';');
+  keys.erase(std::remove(keys.begin(), keys.end(), string()), keys.end());
+  if (keys.empty())
+    return;
+
+  auto start = std::chrono::steady_clock::now();
+
+  // cb_instance is shared with FireTimers and handlers' registerCallback
+  // on the isolate's own thread, lcb_t isn't thread safe
   Locker locker(GetIsolate());
+
+  vector<Result> results(keys.size());
+  lcb_sched_enter(cb_instance);
+  for (size_t i = 0; i < keys.size(); i++) {
+    lcb_CMDGET gcmd = { 0 };
+    LCB_CMD_SET_KEY(&gcmd, keys[i].c_str(), keys[i].length());
+    lcb_get3(cb_instance, &results[i], &gcmd);
+  }
+  lcb_sched_leave(cb_instance);
+  lcb_wait(cb_instance);
+
   Isolate::Scope isolate_scope(GetIsolate());
   HandleScope handle_scope(GetIsolate());
 
   Local<Context> context = Local<Context>::New(GetIsolate(), context_);
   Context::Scope context_scope(context);
 
-  TryCatch try_catch(GetIsolate());
+  uint64_t fired = 0, failed = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    if (results[i].status != LCB_SUCCESS)
+      continue;
+
+    rapidjson::Document doc;
+    if (doc.Parse(results[i].value.c_str()).HasParseError() ||
+        !doc.IsObject() ||
+        !doc.HasMember("callback_func") || !doc["callback_func"].IsString() ||
+        !doc.HasMember("doc_id") || !doc["doc_id"].IsString()) {
+      cerr << "Skipping malformed timer blob " << keys[i] << endl;
+      continue;
+    }
 
-  this->http_response_handle->http_body->http_body.clear();
-  Handle<Value> args[2];
-  args[0] = v8::JSON::Parse(String::NewFromUtf8(GetIsolate(), http_req));
-  args[1] = this->http_response_handle->WrapHTTPResponseMap();
+    rapidjson::Value& id = doc["doc_id"];
+    uint32_t callback = TimerCallbackId(doc["callback_func"].GetString());
+    if (CallTimerCallback(context, callback, id.GetString(),
+                          id.GetStringLength()))
+      fired++;
+    else
+      failed++;
+  }
 
-  if(try_catch.HasCaught()) {
-    last_exception = ExceptionString(GetIsolate(), &try_catch);
-    printf("Logged: %s\n", last_exception.c_str());
+  timers_fired += fired;
+  timers_failed += failed;
+  RecordTimerTick(start);
+
+  lcb_sched_enter(cb_instance);
+  for (size_t i = 0; i < keys.size(); i++) {
+    lcb_CMDREMOVE dcmd = { 0 };
+    LCB_CMD_SET_KEY(&dcmd, keys[i].c_str(), keys[i].length());
+    lcb_remove3(cb_instance, NULL, &dcmd);
   }
+  lcb_sched_leave(cb_instance);
+  lcb_wait(cb_instance);
+}
 
-  Local<Function> on_http_post = Local<Function>::New(GetIsolate(), on_http_post_);
+uint32_t Worker::TimerCallbackId(const string& callback) {
+  map<string, uint32_t>::iterator it = timer_callback_ids_.find(callback);
+  if (it != timer_callback_ids_.end())
+    return it->second;
 
-  on_http_post->Call(context->Global(), 2, args);
+  uint32_t id = timer_callbacks_.size();
+  timer_callbacks_.push_back(callback);
+  timer_callback_ids_[callback] = id;
+  return id;
+}
 
-  return this->http_response_handle->ConvertMapToJson();
+// Spilled timers of a minute are sharded by doc_id hash, so that records
+// and counters of a hot minute spread over vbuckets. Counter doc of a
+// shard holds the number of records spilled for it, records are keyed
+// <counter key>::<1..count>
+string Worker::TimerSpillKey(uint64_t minute, uint32_t shard) {
+  return timer_key_prefix_ + "::timer_spill::" + to_string(minute) + "::" +
+         to_string(shard);
 }
 
-void Worker::SendTimerCallback(const char* k) {
-  vector<string> keys = split(k, ';');
+// Last minute whose spilled timers were loaded, lets a restarted worker
+// catch up on minutes it missed
+string Worker::TimerCheckpointKey() {
+  return timer_key_prefix_ + "::timer_checkpoint";
+}
 
-  if (keys.size() > 0) {
-    Locker locker(GetIsolate());
-    Isolate::Scope isolate_scope(GetIsolate());
-    HandleScope handle_scope(GetIsolate());
+void Worker::SetTimerScope(const char* scope) {
+  timer_key_prefix_ = app_name_ + "::" + scope;
+}
 
-    Local<Context> context = Local<Context>::New(GetIsolate(), context_);
-    Context::Scope context_scope(context);
+// Expects the caller to hold the isolate lock, same as every other access
+// to the wheel
+void Worker::ScheduleTimer(const string& callback, const string& doc_id,
+                           uint64_t due_ms) {
+  timers_scheduled++;
+  TimerEntry entry(due_ms, TimerCallbackId(callback), doc_id);
 
-    for (auto key : keys) {
-      Result result;
-      lcb_CMDGET gcmd = { 0 };
-      LCB_CMD_SET_KEY(&gcmd, key.c_str(), key.length());
-      lcb_sched_enter(cb_instance);
-      lcb_get3(cb_instance, &result, &gcmd);
-      lcb_sched_leave(cb_instance);
-      lcb_wait(cb_instance);
+  uint64_t minute = due_ms / 60000;
+  if (minute <= timer_loaded_minute_) {
+    timer_wheel_->Add(std::move(entry));
+    return;
+  }
 
-      rapidjson::Document doc;
-      if (doc.Parse(result.value.c_str()).HasParseError()) {
-          return;
-      }
+  uint32_t shard = std::hash<string>()(doc_id) % kTimerSpillShards;
+  timer_spill_[make_pair(minute, shard)].push_back(std::move(entry));
+  if (++timer_spill_pending_ >= timer_spill_batch_)
+    SpillTimers();
+}
 
-      string callback_func, doc_id, start_timestamp;
-      assert(doc.IsObject());
-      {
-          rapidjson::Value& cf = doc["callback_func"];
-          rapidjson::Value& id = doc["doc_id"];
-          rapidjson::Value& sts = doc["start_timestamp"];
+// Record value is a JSON array of [due_ms, callback, doc_id] triples
+static string EncodeTimers(const vector<TimerEntry>& entries,
+                           const vector<string>& callbacks) {
+  rapidjson::StringBuffer s;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(s);
 
-          callback_func.assign(cf.GetString());
-          doc_id.assign(id.GetString());
-          start_timestamp.assign(sts.GetString());
-      }
+  writer.StartArray();
+  for (size_t i = 0; i < entries.size(); i++) {
+    const string& callback = callbacks[entries[i].callback];
+    writer.StartArray();
+    writer.Uint64(entries[i].due_ms);
+    writer.String(callback.c_str(), callback.length());
+    writer.String(entries[i].doc_id.c_str(), entries[i].doc_id.length());
+    writer.EndArray();
+  }
+  writer.EndArray();
 
-      // TODO: check for anonymous JS functions. Disallow them completely
-      Handle<Value> val = context->Global()->Get(
-              createUtf8String(GetIsolate(), callback_func.c_str()));
-      Handle<Function> cb_func = Handle<Function>::Cast(val);
+  return string(s.GetString(), s.GetSize());
+}
 
-      Handle<Value> arg[1];
-      arg[0] = String::NewFromUtf8(GetIsolate(), doc_id.c_str());
+// Buffered timers are written out in two scheduled batches, one bumping
+// the record counter of every minute and shard involved and one storing
+// the records.
+// Timers that fail to spill are kept in the wheel instead, which spans
+// far beyond any sane horizon
+void Worker::SpillTimers() {
+  if (timer_spill_pending_ == 0)
+    return;
 
-      cb_func->Call(context->Global(), 1, arg);
+  struct SpillRecord {
+    string counter_key;
+    string key;
+    string value;
+    vector<TimerEntry> entries;
+    Result seq;
+    Result stored;
+  };
+
+  vector<SpillRecord> records;
+  for (auto& it : timer_spill_) {
+    vector<TimerEntry>& entries = it.second;
+    for (size_t i = 0; i < entries.size(); i += timer_spill_batch_) {
+      size_t end = std::min(entries.size(), i + timer_spill_batch_);
+      records.emplace_back();
+      records.back().counter_key = TimerSpillKey(it.first.first,
+                                                 it.first.second);
+      records.back().entries.assign(
+          std::make_move_iterator(entries.begin() + i),
+          std::make_move_iterator(entries.begin() + end));
     }
   }
+  timer_spill_.clear();
+  timer_spill_pending_ = 0;
+
+  lcb_sched_enter(cb_instance);
+  for (size_t i = 0; i < records.size(); i++) {
+    lcb_CMDCOUNTER ccmd = { 0 };
+    LCB_CMD_SET_KEY(&ccmd, records[i].counter_key.c_str(),
+                    records[i].counter_key.length());
+    ccmd.delta = 1;
+    ccmd.initial = 1;
+    ccmd.create = 1;
+    lcb_error_t rc = lcb_counter3(cb_instance, &records[i].seq, &ccmd);
+    if (rc != LCB_SUCCESS)
+      records[i].seq.status = rc;
+  }
+  lcb_sched_leave(cb_instance);
+  lcb_wait(cb_instance);
+
+  lcb_sched_enter(cb_instance);
+  for (size_t i = 0; i < records.size(); i++) {
+    SpillRecord& record = records[i];
+    if (record.seq.status != LCB_SUCCESS)
+      continue;
+
+    record.key = record.counter_key + "::" + record.seq.value;
+    record.value = EncodeTimers(record.entries, timer_callbacks_);
+
+    lcb_CMDSTORE scmd = { 0 };
+    LCB_CMD_SET_KEY(&scmd, record.key.c_str(), record.key.length());
+    LCB_CMD_SET_VALUE(&scmd, record.value.c_str(), record.value.length());
+    scmd.operation = LCB_SET;
+    lcb_error_t rc = lcb_store3(cb_instance, &record.stored, &scmd);
+    if (rc != LCB_SUCCESS)
+      record.stored.status = rc;
+  }
+  lcb_sched_leave(cb_instance);
+  lcb_wait(cb_instance);
+
+  for (size_t i = 0; i < records.size(); i++) {
+    SpillRecord& record = records[i];
+    lcb_error_t rc = record.seq.status != LCB_SUCCESS ?
+                     record.seq.status : record.stored.status;
+    if (rc == LCB_SUCCESS) {
+      timers_spilled += record.entries.size();
+      continue;
+    }
+
+    cerr << "Failed to spill timers to " << record.counter_key << ": "
+         << lcb_strerror(cb_instance, rc) << endl;
+    for (size_t j = 0; j < record.entries.size(); j++)
+      timer_wheel_->Add(std::move(record.entries[j]));
+  }
+}
+
+// Lowers timer_loaded_minute_ to the persisted checkpoint, so that minutes
+// which went by while no worker was loading them are caught up on
+void Worker::ReadTimerCheckpoint() {
+  string key = TimerCheckpointKey();
+
+  Result checkpoint;
+  lcb_CMDGET gcmd = { 0 };
+  LCB_CMD_SET_KEY(&gcmd, key.c_str(), key.length());
+  lcb_sched_enter(cb_instance);
+  lcb_get3(cb_instance, &checkpoint, &gcmd);
+  lcb_sched_leave(cb_instance);
+  lcb_wait(cb_instance);
+
+  if (checkpoint.status != LCB_SUCCESS)
+    return;
+
+  uint64_t minute = strtoull(checkpoint.value.c_str(), NULL, 10);
+  if (minute > 0 && minute < timer_loaded_minute_)
+    timer_loaded_minute_ = minute;
+}
+
+// Moves timers of minutes first..last into the wheel, both the ones still
+// buffered and the ones spilled to the metadata bucket. Every shard of
+// every minute is fetched in the same scheduled batch. Loaded records are
+// removed and the checkpoint advanced in one final batch
+void Worker::LoadSpilledTimers(uint64_t first, uint64_t last) {
+  map<pair<uint64_t, uint32_t>, vector<TimerEntry> >::iterator it =
+      timer_spill_.lower_bound(make_pair(first, 0U));
+  while (it != timer_spill_.end() && it->first.first <= last) {
+    timer_spill_pending_ -= it->second.size();
+    for (size_t i = 0; i < it->second.size(); i++)
+      timer_wheel_->Add(std::move(it->second[i]));
+    it = timer_spill_.erase(it);
+  }
+
+  vector<string> counter_keys;
+  for (uint64_t minute = first; minute <= last; minute++) {
+    for (uint32_t shard = 0; shard < kTimerSpillShards; shard++)
+      counter_keys.push_back(TimerSpillKey(minute, shard));
+  }
+
+  vector<Result> counts(counter_keys.size());
+  lcb_sched_enter(cb_instance);
+  for (size_t i = 0; i < counter_keys.size(); i++) {
+    lcb_CMDGET gcmd = { 0 };
+    LCB_CMD_SET_KEY(&gcmd, counter_keys[i].c_str(), counter_keys[i].length());
+    lcb_get3(cb_instance, &counts[i], &gcmd);
+  }
+  lcb_sched_leave(cb_instance);
+  lcb_wait(cb_instance);
+
+  // Shards nothing was spilled for have no counter doc
+  vector<string> keys, spilled_counters;
+  for (size_t i = 0; i < counter_keys.size(); i++) {
+    if (counts[i].status != LCB_SUCCESS)
+      continue;
+
+    uint64_t record_count = strtoull(counts[i].value.c_str(), NULL, 10);
+    for (uint64_t j = 1; j <= record_count; j++)
+      keys.push_back(counter_keys[i] + "::" + to_string(j));
+    spilled_counters.push_back(counter_keys[i]);
+  }
+
+  vector<Result> results(keys.size());
+  lcb_sched_enter(cb_instance);
+  for (size_t i = 0; i < keys.size(); i++) {
+    lcb_CMDGET rcmd = { 0 };
+    LCB_CMD_SET_KEY(&rcmd, keys[i].c_str(), keys[i].length());
+    lcb_get3(cb_instance, &results[i], &rcmd);
+  }
+  lcb_sched_leave(cb_instance);
+  lcb_wait(cb_instance);
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    // Counter bumped but record never stored, its timers were kept in
+    // memory by the spilling worker
+    if (results[i].status != LCB_SUCCESS)
+      continue;
+
+    rapidjson::Document doc;
+    if (doc.Parse(results[i].value.c_str()).HasParseError() ||
+        !doc.IsArray()) {
+      cerr << "Skipping malformed timer record " << keys[i] << endl;
+      continue;
+    }
+
+    for (rapidjson::SizeType j = 0; j < doc.Size(); j++) {
+      rapidjson::Value& t = doc[j];
+      if (!t.IsArray() || t.Size() != 3 || !t[0].IsUint64() ||
+          !t[1].IsString() || !t[2].IsString())
+        continue;
+
+      TimerEntry entry(t[0].GetUint64(), TimerCallbackId(t[1].GetString()),
+                       string(t[2].GetString(), t[2].GetStringLength()));
+      timer_wheel_->Add(std::move(entry));
+      timers_loaded++;
+    }
+  }
+
+  keys.insert(keys.end(), spilled_counters.begin(), spilled_counters.end());
+  string checkpoint_key = TimerCheckpointKey();
+  string checkpoint = to_string(last);
+
+  lcb_sched_enter(cb_instance);
+  for (size_t i = 0; i < keys.size(); i++) {
+    lcb_CMDREMOVE dcmd = { 0 };
+    LCB_CMD_SET_KEY(&dcmd, keys[i].c_str(), keys[i].length());
+    lcb_remove3(cb_instance, NULL, &dcmd);
+  }
+  lcb_CMDSTORE scmd = { 0 };
+  LCB_CMD_SET_KEY(&scmd, checkpoint_key.c_str(), checkpoint_key.length());
+  LCB_CMD_SET_VALUE(&scmd, checkpoint.c_str(), checkpoint.length());
+  scmd.operation = LCB_SET;
+  lcb_store3(cb_instance, NULL, &scmd);
+  lcb_sched_leave(cb_instance);
+  lcb_wait(cb_instance);
+}
+
+// Driven by a periodic tick from Go. Spilled minutes are pulled in once
+// they are entirely within the horizon, then every due timer is fired
+// under a single isolate entry. Returns number of timers fired
+int Worker::FireTimers() {
+  Locker locker(GetIsolate());
+  Isolate::Scope isolate_scope(GetIsolate());
+  HandleScope handle_scope(GetIsolate());
+
+  Local<Context> context = Local<Context>::New(GetIsolate(), context_);
+  Context::Scope context_scope(context);
+
+  if (!timer_checkpoint_read_) {
+    ReadTimerCheckpoint();
+    timer_checkpoint_read_ = true;
+  }
+
+  uint64_t now_ms = NowMs();
+  uint64_t last_minute = (now_ms + timer_horizon_ms_) / 60000 - 1;
+  while (timer_loaded_minute_ < last_minute) {
+    uint64_t first = timer_loaded_minute_ + 1;
+    uint64_t last = std::min(last_minute, first + kTimerLoadMinutes - 1);
+    LoadSpilledTimers(first, last);
+    timer_loaded_minute_ = last;
+  }
+  SpillTimers();
+
+  vector<TimerEntry> due;
+  timer_wheel_->Advance(now_ms, &due);
+  if (due.empty()) {
+    timer_lag_ms = 0;
+    return 0;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  // How far behind wall clock the most overdue timer fired
+  uint64_t oldest_ms = now_ms;
+  for (size_t i = 0; i < due.size(); i++)
+    oldest_ms = std::min(oldest_ms, due[i].due_ms);
+  timer_lag_ms = now_ms - oldest_ms;
+  if (timer_lag_ms > timer_lag_max_ms)
+    timer_lag_max_ms = timer_lag_ms.load();
+
+  uint64_t failed = 0;
+  for (size_t i = 0; i < due.size(); i++) {
+    if (!CallTimerCallback(context, due[i].callback, due[i].doc_id.c_str(),
+                           due[i].doc_id.length()))
+      failed++;
+  }
+
+  timers_fired += due.size() - failed;
+  timers_failed += failed;
+  RecordTimerTick(start);
+
+  if (start_debug_flag)
+    Debug::ProcessDebugMessages(GetIsolate());
+
+  return due.size();
+}
+
+// Global handles of timer callbacks are resolved on first use and kept
+// for the lifetime of the worker, handler script is never reloaded
+Local<Function> Worker::TimerFunction(Local<Context> context,
+                                      uint32_t callback) {
+  if (timer_functions_.size() < timer_callbacks_.size())
+    timer_functions_.resize(timer_callbacks_.size());
+
+  Global<Function>& cached = timer_functions_[callback];
+  if (!cached.IsEmpty())
+    return Local<Function>::New(GetIsolate(), cached);
+
+  // TODO: check for anonymous JS functions. Disallow them completely
+  Local<Value> val;
+  if (!context->Global()->Get(context,
+          createUtf8String(GetIsolate(), timer_callbacks_[callback].c_str()))
+        .ToLocal(&val) || !val->IsFunction())
+    return Local<Function>();
+
+  Local<Function> func = Local<Function>::Cast(val);
+  cached.Reset(GetIsolate(), func);
+  return func;
+}
+
+// Expects the caller to have entered the isolate and context
+bool Worker::CallTimerCallback(Local<Context> context, uint32_t callback,
+                               const char* doc_id, size_t doc_id_len) {
+  HandleScope handle_scope(GetIsolate());
+  TryCatch try_catch(GetIsolate());
+
+  Local<Function> func = TimerFunction(context, callback);
+  if (func.IsEmpty())
+    return false;
+
+  Local<Value> arg[1];
+  if (!String::NewFromUtf8(GetIsolate(), doc_id, NewStringType::kNormal,
+                           doc_id_len).ToLocal(&arg[0]))
+    return false;
+
+  func->Call(context->Global(), 1, arg);
+  FlushWrites();
+
+  if (try_catch.HasCaught()) {
+    last_exception = ExceptionString(GetIsolate(), &try_catch);
+    return false;
+  }
+  return true;
+}
+
+void Worker::RecordTimerTick(std::chrono::steady_clock::time_point start) {
+  uint64_t elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+  timer_ticks++;
+  timer_tick_last_us = elapsed_us;
+  timer_tick_total_us += elapsed_us;
+  if (elapsed_us > timer_tick_max_us)
+    timer_tick_max_us = elapsed_us;
 }
 
 const char* Worker::SendContinueRequest(const char* command) {
@@ -1143,18 +1956,191 @@ int Worker::SendUpdate(const char* value, const char* meta, const char* type ) {
   Local<Context> context = Local<Context>::New(GetIsolate(), context_);
   Context::Scope context_scope(context);
 
-  // cout << "value: " << value << " meta: " << meta << " type: " << type << endl;
+  Local<Function> on_doc_update = Local<Function>::New(GetIsolate(), on_update_);
+  int rc = ProcessUpdate(context, on_doc_update, value, meta, type);
+
+  if (start_debug_flag)
+    Debug::ProcessDebugMessages(GetIsolate());
+
+  data_ready = true;
+  cv.notify_all();
+
+  TRACE_EVENT_END("worker", "Worker::SendUpdate()/cgo_binding", "");
+  return rc;
+}
+
+// Runs OnUpdate for every (value, meta, type) tuple under a single isolate
+// entry, so the Locker/scope setup is paid once per batch instead of once
+// per mutation. Per-event return codes are written to results, the return
+// value is the number of events whose OnUpdate call failed.
+int Worker::SendUpdateBatch(int count, const char** values,
+                            const char** metas, const char** types,
+                            int* results) {
+  TRACE_EVENT_START("worker", "Worker::SendUpdateBatch()/cgo_binding", "");
+  Locker locker(GetIsolate());
+  Isolate::Scope isolate_scope(GetIsolate());
+  HandleScope handle_scope(GetIsolate());
+
+  Local<Context> context = Local<Context>::New(GetIsolate(), context_);
+  Context::Scope context_scope(context);
+
+  Local<Function> on_doc_update = Local<Function>::New(GetIsolate(), on_update_);
+
+  int failed = 0;
+  for (int i = 0; i < count; i++) {
+    results[i] = ProcessUpdate(context, on_doc_update,
+                               values[i], metas[i], types[i]);
+    if (results[i] != SUCCESS)
+      failed++;
+  }
+
+  if (start_debug_flag)
+    Debug::ProcessDebugMessages(GetIsolate());
+
+  data_ready = true;
+  cv.notify_all();
+
+  TRACE_EVENT_END("worker", "Worker::SendUpdateBatch()/cgo_binding", "");
+  return failed;
+}
+
+int Worker::SendMutations(const char* buf, uint64_t length, int* results) {
+  TRACE_EVENT_START("worker", "Worker::SendMutations()/cgo_binding", "");
+  Locker locker(GetIsolate());
+  Isolate::Scope isolate_scope(GetIsolate());
+  HandleScope handle_scope(GetIsolate());
+
+  Local<Context> context = Local<Context>::New(GetIsolate(), context_);
+  Context::Scope context_scope(context);
+
+  Local<Function> on_doc_update = Local<Function>::New(GetIsolate(), on_update_);
+
+  int failed = 0;
+  uint64_t offset = 0;
+  for (int i = 0; offset < length; i++) {
+    const ring_record_hdr* hdr =
+        reinterpret_cast<const ring_record_hdr*>(buf + offset);
+    results[i] = ProcessMutation(context, on_doc_update, hdr);
+    if (results[i] != SUCCESS)
+      failed++;
+    offset += hdr->size;
+  }
+
+  if (start_debug_flag)
+    Debug::ProcessDebugMessages(GetIsolate());
+
+  data_ready = true;
+  cv.notify_all();
+
+  TRACE_EVENT_END("worker", "Worker::SendMutations()/cgo_binding", "");
+  return failed;
+}
+
+// Expects the caller to have entered the isolate and context, hdr points
+// to a RING_RECORD_MUTATION record
+int Worker::ProcessMutation(Local<Context> context, Local<Function> on_doc_update,
+                            const ring_record_hdr* hdr) {
+  HandleScope handle_scope(GetIsolate());
+
   TryCatch try_catch(GetIsolate());
 
+  const event_meta* meta = reinterpret_cast<const event_meta*>(hdr + 1);
+  const char* key = reinterpret_cast<const char*>(meta + 1);
+  const char* value = key + meta->key_len;
+
+  // Mutation is the DCP echo of a write made by this app's handlers
+  if (RecursionFilterCheck(recursion_scope, key, meta->key_len, meta->cas)) {
+    self_writes_skipped++;
+    return SUCCESS;
+  }
+
+  if (dcp_invalidation_)
+    InvalidateCachedDocs(string(key, meta->key_len), meta->cas);
+
+  if (!PassesFilter(key, meta->key_len, value, hdr->value_len,
+                    meta->datatype == EVENT_DATATYPE_JSON))
+    return SUCCESS;
+
+  Local<ObjectTemplate> lazy_doc_template =
+      Local<ObjectTemplate>::New(GetIsolate(), lazy_doc_template_);
+  Local<ObjectTemplate> event_meta_template =
+      Local<ObjectTemplate>::New(GetIsolate(), event_meta_template_);
+
   Handle<Value> args[2];
-  string doc_type(type);
-  if (doc_type.compare("json") == 0) {
-      args[0] = v8::JSON::Parse(String::NewFromUtf8(GetIsolate(), value));
+  args[0] = NewDocValue(GetIsolate(), lazy_doc_template, value, hdr->value_len,
+                        meta->datatype == EVENT_DATATYPE_JSON);
+  args[1] = NewEventMeta(GetIsolate(), event_meta_template, meta, key);
+
+  if (try_catch.HasCaught()) {
+    last_exception = ExceptionString(GetIsolate(), &try_catch);
+    fprintf(stderr, "Logged: %s\n", last_exception.c_str());
+    fflush(stderr);
   }
-  else {
-      args[0] = String::NewFromUtf8(GetIsolate(), value);
+
+  if (args[0].IsEmpty())
+    args[0] = Undefined(GetIsolate());
+  if (args[1].IsEmpty())
+    return ON_UPDATE_CALL_FAIL;
+
+  TRACE_EVENT_START("worker", "Worker::SendMutations()/js-callback", "");
+  on_doc_update->Call(context->Global(), 2, args);
+  FlushWrites();
+  TRACE_EVENT_END("worker", "Worker::SendMutations()/js-callback", "");
+
+  if (try_catch.HasCaught()) {
+    cout << "Exception message: "
+         <<  ExceptionString(GetIsolate(), &try_catch) << endl;
+    return ON_UPDATE_CALL_FAIL;
   }
 
+  return SUCCESS;
+}
+
+// Mutations dropped by depcfg.filter are reported as processed
+bool Worker::PassesFilter(const char* key, size_t key_len, const char* value,
+                          size_t value_len, bool is_json) {
+  if (!event_filter_->Enabled())
+    return true;
+
+  if (event_filter_->Match(key, key_len, value, value_len, is_json)) {
+    events_passed++;
+    return true;
+  }
+  events_filtered++;
+  return false;
+}
+
+// Expects the caller to have entered the isolate and context
+int Worker::ProcessUpdate(Local<Context> context, Local<Function> on_doc_update,
+                          const char* value, const char* meta,
+                          const char* type) {
+  if (event_filter_->Enabled()) {
+    // JSON meta is only parsed when the filter looks at keys
+    string key;
+    if (event_filter_->NeedsKey()) {
+      rapidjson::Document doc;
+      if (!doc.Parse(meta).HasParseError() && doc.IsObject() &&
+          doc.HasMember("key") && doc["key"].IsString())
+        key.assign(doc["key"].GetString(), doc["key"].GetStringLength());
+    }
+    if (!PassesFilter(key.data(), key.length(), value, strlen(value),
+                      strcmp(type, "json") == 0))
+      return SUCCESS;
+  }
+
+  HandleScope handle_scope(GetIsolate());
+
+  // cout << "value: " << value << " meta: " << meta << " type: " << type << endl;
+  TryCatch try_catch(GetIsolate());
+
+  Handle<Value> args[2];
+  Local<ObjectTemplate> lazy_doc_template =
+      Local<ObjectTemplate>::New(GetIsolate(), lazy_doc_template_);
+  args[0] = NewDocValue(GetIsolate(), lazy_doc_template, value, strlen(value),
+                        strcmp(type, "json") == 0);
+  if (args[0].IsEmpty())
+      args[0] = Undefined(GetIsolate());
+
   args[1] = v8::JSON::Parse(String::NewFromUtf8(GetIsolate(), meta));
 
   if(try_catch.HasCaught()) {
@@ -1163,18 +2149,11 @@ int Worker::SendUpdate(const char* value, const char* meta, const char* type ) {
     fflush(stderr);
   }
 
-  Local<Function> on_doc_update = Local<Function>::New(GetIsolate(), on_update_);
   TRACE_EVENT_START("worker", "Worker::SendUpdate()/js-callback", "");
   on_doc_update->Call(context->Global(), 2, args);
+  FlushWrites();
   TRACE_EVENT_END("worker", "Worker::SendUpdate()/js-callback", "");
 
-  if (start_debug_flag)
-    Debug::ProcessDebugMessages(GetIsolate());
-
-  data_ready = true;
-  cv.notify_all();
-
-  TRACE_EVENT_END("worker", "Worker::SendUpdate()/cgo_binding", "");
   if (try_catch.HasCaught()) {
     cout << "Exception message: "
          <<  ExceptionString(GetIsolate(), &try_catch) << endl;
@@ -1193,25 +2172,45 @@ int Worker::SendDelete(const char *msg) {
   Local<Context> context = Local<Context>::New(GetIsolate(), context_);
   Context::Scope context_scope(context);
 
+  Local<Function> on_doc_delete = Local<Function>::New(GetIsolate(), on_delete_);
+  int rc = ProcessDelete(context, on_doc_delete, msg);
+
+  if (start_debug_flag)
+    Debug::ProcessDebugMessages(GetIsolate());
+
+  data_ready = true;
+  cv.notify_all();
+
+  TRACE_EVENT_END("worker", "Worker::SendDelete()/cgo_binding_end", "");
+  return rc;
+}
+
+// Expects the caller to have entered the isolate and context
+int Worker::ProcessDelete(Local<Context> context, Local<Function> on_doc_delete,
+                          const char* msg) {
+  HandleScope handle_scope(GetIsolate());
+
   TryCatch try_catch;
 
+  // msg is the JSON encoded DCP event, with key as base64
+  if (dcp_invalidation_) {
+    rapidjson::Document doc;
+    if (!doc.Parse(msg).HasParseError() && doc.IsObject() &&
+        doc.HasMember("Key") && doc["Key"].IsString()) {
+      InvalidateCachedDocs(Base64Decode(doc["Key"].GetString()), 0);
+    }
+  }
+
   Local<Value> args[1];
   args[0] = String::NewFromUtf8(GetIsolate(), msg);
 
   assert(!try_catch.HasCaught());
 
-  Local<Function> on_doc_delete = Local<Function>::New(GetIsolate(), on_delete_);
   TRACE_EVENT_START("worker", "Worker::SendDelete()/js-callback", "");
   on_doc_delete->Call(context->Global(), 1, args);
+  FlushWrites();
   TRACE_EVENT_END("worker", "Worker::SendDelete()/js-callback-end", "");
 
-  if (start_debug_flag)
-    Debug::ProcessDebugMessages(GetIsolate());
-
-  data_ready = true;
-  cv.notify_all();
-
-  TRACE_EVENT_END("worker", "Worker::SendDelete()/cgo_binding_end", "");
   if (try_catch.HasCaught()) {
     //last_exception = ExceptionString(GetIsolate(), &try_catch);
     return ON_DELETE_CALL_FAIL;
@@ -1220,6 +2219,101 @@ int Worker::SendDelete(const char *msg) {
   return SUCCESS;
 }
 
+ring_buffer* Worker::StartRingConsumer(uint64_t capacity) {
+  if (ring_ != NULL)
+    return ring_;
+
+  ring_ = ring_buffer_new(capacity);
+  if (ring_ == NULL)
+    return NULL;
+
+  ring_running_ = true;
+  ring_consumer_ = std::thread(&Worker::RingConsumerLoop, this);
+  return ring_;
+}
+
+void Worker::StopRingConsumer() {
+  if (ring_ == NULL)
+    return;
+
+  ring_running_ = false;
+  ring_buffer_wakeup(ring_);
+  ring_consumer_.join();
+
+  ring_buffer_free(ring_);
+  ring_ = NULL;
+}
+
+// Drains records published by the Go producer. Isolate is entered once per
+// drained chunk and released in between, so that http requests and timer
+// callbacks still get their turn on the isolate.
+void Worker::RingConsumerLoop() {
+  const int kMaxRecordsPerEntry = 1024;
+  const uint64_t mask = ring_->capacity - 1;
+
+  while (ring_running_) {
+    uint64_t head = ring_->head;
+    uint64_t tail = __atomic_load_n(&ring_->tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+      __atomic_store_n(&ring_->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+      tail = __atomic_load_n(&ring_->tail, __ATOMIC_SEQ_CST);
+      if (head == tail)
+        ring_buffer_wait(ring_, 100);
+      __atomic_store_n(&ring_->consumer_sleeping, 0, __ATOMIC_SEQ_CST);
+      continue;
+    }
+
+    TRACE_EVENT_START("worker", "Worker::RingConsumerLoop()/drain", "");
+    Locker locker(GetIsolate());
+    Isolate::Scope isolate_scope(GetIsolate());
+    HandleScope handle_scope(GetIsolate());
+
+    Local<Context> context = Local<Context>::New(GetIsolate(), context_);
+    Context::Scope context_scope(context);
+
+    Local<Function> on_doc_update = Local<Function>::New(GetIsolate(), on_update_);
+    Local<Function> on_doc_delete = Local<Function>::New(GetIsolate(), on_delete_);
+
+    for (int i = 0; i < kMaxRecordsPerEntry && head != tail; i++) {
+      const char* rec = ring_->data + (head & mask);
+      const ring_record_hdr* hdr = reinterpret_cast<const ring_record_hdr*>(rec);
+      int rc = SUCCESS;
+
+      if (hdr->kind == RING_RECORD_UPDATE) {
+        const char* value = rec + sizeof(ring_record_hdr);
+        const char* meta = value + hdr->value_len + 1;
+        const char* type = meta + hdr->meta_len + 1;
+        rc = ProcessUpdate(context, on_doc_update, value, meta, type);
+      } else if (hdr->kind == RING_RECORD_MUTATION) {
+        rc = ProcessMutation(context, on_doc_update, hdr);
+      } else if (hdr->kind == RING_RECORD_DELETE) {
+        const char* msg = rec + sizeof(ring_record_hdr);
+        rc = ProcessDelete(context, on_doc_delete, msg);
+      }
+
+      if (hdr->kind != RING_RECORD_PADDING) {
+        __atomic_fetch_add(&ring_->records_read, 1, __ATOMIC_RELAXED);
+        if (rc != SUCCESS)
+          __atomic_fetch_add(&ring_->records_failed, 1, __ATOMIC_RELAXED);
+      }
+
+      head += hdr->size;
+      __atomic_store_n(&ring_->head, head, __ATOMIC_RELEASE);
+
+      if (head == tail)
+        tail = __atomic_load_n(&ring_->tail, __ATOMIC_ACQUIRE);
+    }
+
+    if (start_debug_flag)
+      Debug::ProcessDebugMessages(GetIsolate());
+
+    data_ready = true;
+    cv.notify_all();
+    TRACE_EVENT_END("worker", "Worker::RingConsumerLoop()/drain", "");
+  }
+}
+
 int worker_send_update(worker* w, const char* value,
                        const char* meta, const char* type) {
 
@@ -1227,18 +2321,39 @@ int worker_send_update(worker* w, const char* value,
   return w->w->SendUpdate(value, meta, type);
 }
 
+int worker_send_update_batch(worker* w, int count, const char** values,
+                             const char** metas, const char** types,
+                             int* results) {
+  return w->w->SendUpdateBatch(count, values, metas, types, results);
+}
+
+int worker_send_mutations(worker* w, const char* buf, uint64_t length,
+                          int* results) {
+  return w->w->SendMutations(buf, length, results);
+}
+
+ring_buffer* worker_ring_start(worker* w, uint64_t capacity) {
+  return w->w->StartRingConsumer(capacity);
+}
+
+void worker_ring_stop(worker* w) {
+  w->w->StopRingConsumer();
+}
+
 int worker_send_delete(worker* w, const char* msg) {
 
   // TODO: return proper errorcode
   return w->w->SendDelete(msg);
 }
 
-const char* worker_send_http_get(worker* w, const char* uri_path) {
-  return w->w->SendHTTPGet(uri_path);
+const char* worker_send_http_get(worker* w, const char* uri_path,
+                                 uint64_t* length) {
+  return w->w->SendHTTPGet(uri_path, length);
 }
 
-const char* worker_send_http_post(worker* w, const char* uri_path) {
-  return w->w->SendHTTPPost(uri_path);
+const char* worker_send_http_post(worker* w, const char* uri_path,
+                                  uint64_t* length) {
+  return w->w->SendHTTPPost(uri_path, length);
 }
 
 static ArrayBufferAllocator array_buffer_allocator;
@@ -1260,6 +2375,10 @@ const char* worker_last_exception(worker* w) {
     return w->w->WorkerLastException();
 }
 
+char* worker_stats(worker* w) {
+    return strdup(w->w->WorkerStats().c_str());
+}
+
 int worker_load(worker* w, char* name_s, char* source_s) {
     return w->w->WorkerLoad(name_s, source_s);
 }
@@ -1268,6 +2387,14 @@ void worker_send_timer_callback(worker* w, const char* keys) {
     w->w->SendTimerCallback(keys);
 }
 
+void worker_set_timer_scope(worker* w, const char* scope) {
+    w->w->SetTimerScope(scope);
+}
+
+int worker_fire_timers(worker* w) {
+    return w->w->FireTimers();
+}
+
 void start_v8_debugger(worker* w) {
     w->w->StartV8Debugger();
 }
@@ -1317,6 +2444,7 @@ void worker_dispose(worker* w) {
 }
 
 void Worker::WorkerDispose() {
+  StopRingConsumer();
   isolate_->Dispose();
   //delete(w);
   // TODO:: Cleanup resources neatly
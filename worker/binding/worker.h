@@ -1,7 +1,13 @@
 #ifndef __WORKER_H__
 #define __WORKER_H__
 
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include <include/v8.h>
 #include <include/v8-debug.h>
 #include <include/libplatform/libplatform.h>
@@ -10,6 +16,7 @@
 #include <libcouchbase/couchbase.h>
 
 #include "binding.h"
+#include "timer_wheel.h"
 
 using namespace v8;
 using namespace std;
@@ -19,6 +26,7 @@ extern "C" {
 #endif*/
 
 class Bucket;
+class EventFilter;
 class HTTPResponse;
 class N1QL;
 class Queue;
@@ -69,14 +77,37 @@ class Worker {
 
     int WorkerLoad(char* name_s, char* source_s);
     const char* WorkerLastException();
+    // Serialized under the isolate lock, safe from any thread
+    string WorkerStats();
     const char* WorkerVersion();
 
     int SendUpdate(const char* value, const char* meta, const char* doc_type);
+    int SendUpdateBatch(int count, const char** values, const char** metas,
+                        const char** types, int* results);
+    int SendMutations(const char* buf, uint64_t length, int* results);
     int SendDelete(const char* msg);
-    const char* SendHTTPGet(const char* http_req);
-    const char* SendHTTPPost(const char* http_req);
+    // Returned response is valid until next SendHTTPGet/SendHTTPPost
+    const char* SendHTTPGet(const char* http_req, uint64_t* length);
+    const char* SendHTTPPost(const char* http_req, uint64_t* length);
     void SendTimerCallback(const char* keys);
 
+    // Applies doc cache invalidations queued up by other isolates of the
+    // app, called ahead of doc cache reads
+    void ApplyInvalidations();
+
+    // Timers registered through registerCallback, see worker.cc
+    void ScheduleTimer(const string& callback, const string& doc_id,
+                       uint64_t due_ms);
+    int FireTimers();
+
+    // Namespaces spilled timers and the timer checkpoint, so that every
+    // isolate of an app only loads timers it spilled itself. Has to be
+    // stable across restarts and set ahead of the handler getting loaded
+    void SetTimerScope(const char* scope);
+
+    ring_buffer* StartRingConsumer(uint64_t capacity);
+    void StopRingConsumer();
+
     void StartV8Debugger();
     void StopV8Debugger();
 
@@ -102,15 +133,43 @@ class Worker {
     Persistent<Function> on_http_post_;
 
     Global<ObjectTemplate> worker_template;
+    Global<ObjectTemplate> lazy_doc_template_;
+    Global<ObjectTemplate> event_meta_template_;
 
     lcb_t cb_instance;
     string script_to_execute_;
     int table_index;
     string app_name_;
+    uint64_t recursion_scope;
     bool start_debug_flag;
+    bool builtins_in_snapshot_;
 
   private:
-    bool ExecuteScript(Local<String> script);
+    bool ExecuteScript(Local<String> script, const string& source);
+    int ProcessUpdate(Local<Context> context, Local<Function> on_doc_update,
+                      const char* value, const char* meta, const char* type);
+    int ProcessMutation(Local<Context> context, Local<Function> on_doc_update,
+                        const ring_record_hdr* hdr);
+    bool PassesFilter(const char* key, size_t key_len, const char* value,
+                      size_t value_len, bool is_json);
+    const char* SendHTTPRequest(Persistent<Function>& handler,
+                                const char* http_req, uint64_t* length);
+    int ProcessDelete(Local<Context> context, Local<Function> on_doc_delete,
+                      const char* msg);
+    void RingConsumerLoop();
+    void FlushWrites();
+    void InvalidateCachedDocs(const string& key, lcb_CAS cas);
+    void QueueInvalidation(const string& key, lcb_CAS cas);
+    uint32_t TimerCallbackId(const string& callback);
+    string TimerSpillKey(uint64_t minute, uint32_t shard);
+    string TimerCheckpointKey();
+    void SpillTimers();
+    void ReadTimerCheckpoint();
+    void LoadSpilledTimers(uint64_t first, uint64_t last);
+    Local<Function> TimerFunction(Local<Context> context, uint32_t callback);
+    bool CallTimerCallback(Local<Context> context, uint32_t callback,
+                           const char* doc_id, size_t doc_id_len);
+    void RecordTimerTick(std::chrono::steady_clock::time_point start);
 
     int x;
 
@@ -119,14 +178,69 @@ class Worker {
 
     string last_exception;
 
+    // Invalid depcfg settings, handler loads fail with it
+    string config_error_;
+
+    // Script compile diagnostics, reported by WorkerStats
+    std::atomic<uint64_t> code_cache_hits;
+    std::atomic<uint64_t> code_cache_misses;
+    std::atomic<uint64_t> code_cache_rejects;
+    std::atomic<uint64_t> compile_time_us;
+
     Bucket* bucket_handle;
+    vector<Bucket*> bucket_handles_;
+    bool dcp_invalidation_;
+    std::atomic<uint64_t> self_writes_skipped;
+
+    // DCP invalidations seen by other isolates of the app, past
+    // kMaxQueuedInvalidations the whole doc cache is dropped instead
+    std::mutex invalidations_lock_;
+    vector<pair<string, lcb_CAS> > invalidations_;
+    bool invalidate_all_;
+    std::atomic<bool> has_invalidations_;
+
+    // depcfg.filter, counters stay 0 unless a filter is configured
+    EventFilter* event_filter_;
+    std::atomic<uint64_t> events_filtered;
+    std::atomic<uint64_t> events_passed;
+
     N1QL* n1ql_handle;
     HTTPResponse* http_response_handle;
     Queue* queue_handle;
 
+    // Timers due within the horizon live in timer_wheel_, later ones are
+    // buffered per (minute, shard) in timer_spill_ until written to the
+    // metadata bucket. Minutes up to timer_loaded_minute_ never spill
+    TimerWheel* timer_wheel_;
+    vector<string> timer_callbacks_;
+    vector<Global<Function> > timer_functions_;
+    map<string, uint32_t> timer_callback_ids_;
+    map<pair<uint64_t, uint32_t>, vector<TimerEntry> > timer_spill_;
+    uint64_t timer_spill_pending_;
+    uint64_t timer_loaded_minute_;
+    bool timer_checkpoint_read_;
+    string timer_key_prefix_;
+    uint64_t timer_horizon_ms_;
+    uint64_t timer_spill_batch_;
+    std::atomic<uint64_t> timers_scheduled;
+    std::atomic<uint64_t> timers_fired;
+    std::atomic<uint64_t> timers_failed;
+    std::atomic<uint64_t> timers_spilled;
+    std::atomic<uint64_t> timers_loaded;
+    std::atomic<uint64_t> timer_ticks;
+    std::atomic<uint64_t> timer_tick_last_us;
+    std::atomic<uint64_t> timer_tick_max_us;
+    std::atomic<uint64_t> timer_tick_total_us;
+    std::atomic<uint64_t> timer_lag_ms;
+    std::atomic<uint64_t> timer_lag_max_ms;
+
     map<string, string> bucket;
     map<string, string> n1ql;
     map<string, string> queue;
+
+    ring_buffer* ring_;
+    std::thread ring_consumer_;
+    std::atomic<bool> ring_running_;
 };
 
 const char* worker_version();
@@ -0,0 +1,124 @@
+package worker
+
+/*
+#include <stdlib.h>
+#include "binding/binding.h"
+*/
+import "C"
+
+import (
+	"unsafe"
+)
+
+const eventMetaSize = uint64(unsafe.Sizeof(C.event_meta{}))
+
+// EventMeta - DCP_MUTATION metadata, handed over to v8 as a fixed layout
+// struct instead of JSON. OnUpdate sees it as meta with key, cas, expiry,
+// type, vbucket and seqno fields
+type EventMeta struct {
+	Cas     uint64
+	Seqno   uint64
+	Expiry  uint32
+	Vbucket uint16
+	JSON    bool
+}
+
+// MutationBatch packs DCP_MUTATIONs into a single buffer, using the same
+// record layout as the shared ring, so that a batch crosses cgo without
+// any per mutation allocations
+type MutationBatch struct {
+	buf   []byte
+	count int
+}
+
+func mutationRecordSize(key, value []byte) uint64 {
+	return ringAlign(ringRecordHdrSize + eventMetaSize + uint64(len(key)+len(value)))
+}
+
+// encodeMutation expects rec to be 8 byte aligned and at least
+// mutationRecordSize bytes long
+func encodeMutation(rec []byte, size uint64, meta *EventMeta, key, value []byte) {
+	hdr := (*C.ring_record_hdr)(unsafe.Pointer(&rec[0]))
+	hdr.size = C.uint32_t(size)
+	hdr.kind = C.RING_RECORD_MUTATION
+	hdr.value_len = C.uint32_t(len(value))
+	hdr.meta_len = C.uint32_t(eventMetaSize)
+	hdr.type_len = 0
+
+	m := (*C.event_meta)(unsafe.Pointer(&rec[ringRecordHdrSize]))
+	m.cas = C.uint64_t(meta.Cas)
+	m.seqno = C.uint64_t(meta.Seqno)
+	m.expiry = C.uint32_t(meta.Expiry)
+	m.key_len = C.uint32_t(len(key))
+	m.vbucket = C.uint16_t(meta.Vbucket)
+	if meta.JSON {
+		m.datatype = C.EVENT_DATATYPE_JSON
+	} else {
+		m.datatype = C.EVENT_DATATYPE_BINARY
+	}
+
+	off := ringRecordHdrSize + eventMetaSize
+	off += uint64(copy(rec[off:], key))
+	copy(rec[off:], value)
+}
+
+// Add appends a mutation to the batch, key and value are copied
+func (b *MutationBatch) Add(meta *EventMeta, key, value []byte) {
+	size := mutationRecordSize(key, value)
+	off := uint64(len(b.buf))
+	if uint64(cap(b.buf))-off < size {
+		buf := make([]byte, off, 2*uint64(cap(b.buf))+size)
+		copy(buf, b.buf)
+		b.buf = buf
+	}
+	b.buf = b.buf[:off+size]
+	encodeMutation(b.buf[off:], size, meta, key, value)
+	b.count++
+}
+
+// Len returns number of mutations in the batch
+func (b *MutationBatch) Len() int {
+	return b.count
+}
+
+// Reset empties the batch, retaining the underlying buffer
+func (b *MutationBatch) Reset() {
+	b.buf = b.buf[:0]
+	b.count = 0
+}
+
+// SendMutations sends a batch of DCP_MUTATIONs to v8 in a single cgo call,
+// returns per-mutation status codes
+func (w *Worker) SendMutations(b *MutationBatch) []int {
+	results := make([]int, b.count)
+	if b.count == 0 {
+		return results
+	}
+
+	cResults := make([]C.int, b.count)
+	C.worker_send_mutations(w.worker.cWorker,
+		(*C.char)(unsafe.Pointer(&b.buf[0])), C.uint64_t(len(b.buf)),
+		&cResults[0])
+
+	for i, rc := range cResults {
+		results[i] = int(rc)
+	}
+	return results
+}
+
+// RingSendMutation copies DCP_MUTATION into shared ring, OnUpdate gets
+// invoked asynchronously by the C++ consumer thread
+func (w *Worker) RingSendMutation(meta *EventMeta, key, value []byte) {
+	size := mutationRecordSize(key, value)
+	rec, tail, need := w.ringReserve(size)
+	if rec == nil {
+		w.RingDrain()
+		var batch MutationBatch
+		batch.Add(meta, key, value)
+		w.SendMutations(&batch)
+		return
+	}
+
+	encodeMutation(rec, size, meta, key, value)
+	w.ringCommit(tail, need, size)
+}
@@ -0,0 +1,244 @@
+package worker
+
+/*
+#include <stdlib.h>
+#include "binding/binding.h"
+*/
+import "C"
+import "errors"
+
+import (
+	"sync/atomic"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+const (
+	ringRecordAlign   = C.RING_RECORD_ALIGN
+	ringRecordHdrSize = uint64(unsafe.Sizeof(C.ring_record_hdr{}))
+	ringMaxCapacity   = 1 << 30
+)
+
+var ringDoorbell = [8]byte{1}
+
+// RingStats captures backpressure counters of the shared memory ring
+// between Go producer and the C++ thread owning the isolate
+type RingStats struct {
+	Capacity          uint64
+	Used              uint64
+	RecordsWritten    uint64
+	BytesWritten      uint64
+	ProducerFullWaits uint64
+	DoorbellsRung     uint64
+	RecordsRead       uint64
+	RecordsFailed     uint64
+	ConsumerWakeups   uint64
+}
+
+// StartRing allocates a ring of given size(in bytes) shared with the C++
+// binding and spawns a thread on C++ side that owns the isolate and drains
+// the ring. Once started, RingSendUpdate/RingSendDelete hand over mutations
+// without blocking on JS execution
+func (w *Worker) StartRing(size uint64) error {
+	if w.worker.ring != nil {
+		return nil
+	}
+	if size > ringMaxCapacity {
+		size = ringMaxCapacity
+	}
+
+	r := C.worker_ring_start(w.worker.cWorker, C.uint64_t(size))
+	if r == nil {
+		return errors.New("failed to allocate ring buffer")
+	}
+
+	capacity := uint64(r.capacity)
+	w.worker.ringData = (*[ringMaxCapacity]byte)(unsafe.Pointer(r.data))[:capacity:capacity]
+	w.worker.ring = r
+	return nil
+}
+
+// StopRing stops the C++ consumer thread and frees up the ring, records
+// not yet consumed are dropped
+func (w *Worker) StopRing() {
+	if w.worker.ring == nil {
+		return
+	}
+	w.worker.ring = nil
+	w.worker.ringData = nil
+	C.worker_ring_stop(w.worker.cWorker)
+}
+
+// RingEnabled returns true if mutations could be sent via shared ring
+func (w *Worker) RingEnabled() bool {
+	return w.worker.ring != nil
+}
+
+// RingSendUpdate copies DCP_MUTATION into shared ring, OnUpdate gets
+// invoked asynchronously by the C++ consumer thread
+func (w *Worker) RingSendUpdate(value, meta, docType string) {
+	if !w.ringWrite(C.RING_RECORD_UPDATE, value, meta, docType) {
+		w.RingDrain()
+		w.SendUpdate(value, meta, docType)
+	}
+}
+
+// RingSendDelete copies DCP_DELETION into shared ring
+func (w *Worker) RingSendDelete(msg string) {
+	if !w.ringWrite(C.RING_RECORD_DELETE, msg, "", "") {
+		w.RingDrain()
+		w.SendDelete(msg)
+	}
+}
+
+// RingDrain blocks till the consumer has caught up with the producer
+func (w *Worker) RingDrain() {
+	r := w.worker.ring
+	if r == nil {
+		return
+	}
+	tail := atomic.LoadUint64(ringCounter(&r.tail))
+	for atomic.LoadUint64(ringCounter(&r.head)) != tail {
+		w.ringWakeup(r)
+		time.Sleep(50 * time.Microsecond)
+	}
+}
+
+// RingTail returns the producer position, i.e. the end of the last record
+// written to the ring
+func (w *Worker) RingTail() uint64 {
+	r := w.worker.ring
+	if r == nil {
+		return 0
+	}
+	return atomic.LoadUint64(ringCounter(&r.tail))
+}
+
+// RingHead returns the consumer position, records before it have been
+// processed by v8
+func (w *Worker) RingHead() uint64 {
+	r := w.worker.ring
+	if r == nil {
+		return 0
+	}
+	return atomic.LoadUint64(ringCounter(&r.head))
+}
+
+// RingStats returns snapshot of ring counters
+func (w *Worker) RingStats() RingStats {
+	r := w.worker.ring
+	if r == nil {
+		return RingStats{}
+	}
+
+	tail := atomic.LoadUint64(ringCounter(&r.tail))
+	head := atomic.LoadUint64(ringCounter(&r.head))
+	return RingStats{
+		Capacity:          uint64(r.capacity),
+		Used:              tail - head,
+		RecordsWritten:    atomic.LoadUint64(ringCounter(&r.records_written)),
+		BytesWritten:      atomic.LoadUint64(ringCounter(&r.bytes_written)),
+		ProducerFullWaits: atomic.LoadUint64(ringCounter(&r.producer_full_waits)),
+		DoorbellsRung:     atomic.LoadUint64(ringCounter(&r.doorbells_rung)),
+		RecordsRead:       atomic.LoadUint64(ringCounter(&r.records_read)),
+		RecordsFailed:     atomic.LoadUint64(ringCounter(&r.records_failed)),
+		ConsumerWakeups:   atomic.LoadUint64(ringCounter(&r.consumer_wakeups)),
+	}
+}
+
+func ringCounter(c *C.uint64_t) *uint64 {
+	return (*uint64)(unsafe.Pointer(c))
+}
+
+func ringAlign(size uint64) uint64 {
+	return (size + ringRecordAlign - 1) &^ (ringRecordAlign - 1)
+}
+
+// ringWrite returns false if record can't ever fit in the ring, caller is
+// expected to fall back to synchronous cgo call
+func (w *Worker) ringWrite(kind uint32, value, meta, docType string) bool {
+	size := ringAlign(ringRecordHdrSize + uint64(len(value)+len(meta)+len(docType)+3))
+	rec, tail, need := w.ringReserve(size)
+	if rec == nil {
+		return false
+	}
+
+	hdr := (*C.ring_record_hdr)(unsafe.Pointer(&rec[0]))
+	hdr.size = C.uint32_t(size)
+	hdr.kind = C.uint32_t(kind)
+	hdr.value_len = C.uint32_t(len(value))
+	hdr.meta_len = C.uint32_t(len(meta))
+	hdr.type_len = C.uint32_t(len(docType))
+
+	off := ringRecordHdrSize
+	for _, field := range []string{value, meta, docType} {
+		off += uint64(copy(rec[off:], field))
+		rec[off] = 0
+		off++
+	}
+
+	w.ringCommit(tail, need, size)
+	return true
+}
+
+// ringReserve waits for size bytes of contiguous space in the ring and
+// returns the slice to encode the record into, along with tail and the
+// number of bytes(including wraparound padding) to pass to ringCommit.
+// Returns nil if record can't ever fit in the ring
+func (w *Worker) ringReserve(size uint64) ([]byte, uint64, uint64) {
+	r := w.worker.ring
+	data := w.worker.ringData
+	capacity := uint64(len(data))
+
+	if size > capacity/2 {
+		return nil, 0, 0
+	}
+
+	// Only producer updates tail, so plain read of our own copy is fine
+	tail := atomic.LoadUint64(ringCounter(&r.tail))
+	pos := tail & (capacity - 1)
+
+	need := size
+	padding := uint64(0)
+	if capacity-pos < size {
+		padding = capacity - pos
+		need += padding
+	}
+
+	// Backpressure: wait for consumer to free up enough space
+	if capacity-(tail-atomic.LoadUint64(ringCounter(&r.head))) < need {
+		atomic.AddUint64(ringCounter(&r.producer_full_waits), 1)
+		for capacity-(tail-atomic.LoadUint64(ringCounter(&r.head))) < need {
+			w.ringWakeup(r)
+			time.Sleep(50 * time.Microsecond)
+		}
+	}
+
+	if padding > 0 {
+		hdr := (*C.ring_record_hdr)(unsafe.Pointer(&data[pos]))
+		hdr.size = C.uint32_t(padding)
+		hdr.kind = C.RING_RECORD_PADDING
+		pos = 0
+	}
+
+	return data[pos : pos+size], tail, need
+}
+
+// ringCommit publishes the record reserved by ringReserve to the consumer
+func (w *Worker) ringCommit(tail, need, size uint64) {
+	r := w.worker.ring
+
+	atomic.StoreUint64(ringCounter(&r.tail), tail+need)
+	atomic.AddUint64(ringCounter(&r.records_written), 1)
+	atomic.AddUint64(ringCounter(&r.bytes_written), size)
+
+	if atomic.LoadUint32((*uint32)(unsafe.Pointer(&r.consumer_sleeping))) == 1 {
+		w.ringWakeup(r)
+	}
+}
+
+func (w *Worker) ringWakeup(r *C.ring_buffer) {
+	syscall.Write(int(r.doorbell_fd), ringDoorbell[:])
+	atomic.AddUint64(ringCounter(&r.doorbells_rung), 1)
+}
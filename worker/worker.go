@@ -8,6 +8,8 @@ import "C"
 import "errors"
 
 import (
+	"encoding/json"
+	"io"
 	"runtime"
 	"sync"
 	"unsafe"
@@ -32,6 +34,8 @@ var initV8Once sync.Once
 type worker struct {
 	cWorker    *C.worker
 	tableIndex workerTableIndex
+	ring       *C.ring_buffer
+	ringData   []byte
 }
 
 // Worker - Golang wrapper around a single V8 Isolate.
@@ -46,6 +50,21 @@ func Version() string {
 	return C.GoString(C.worker_version())
 }
 
+// SetStartupSnapshot toggles creation of new isolates from a V8 startup
+// snapshot that has builtin.js compiled and run already. Snapshot gets
+// built on first worker creation after it is enabled
+func SetStartupSnapshot(enabled bool) {
+	initV8Once.Do(func() {
+		C.v8_init()
+	})
+
+	flag := 0
+	if enabled {
+		flag = 1
+	}
+	C.v8_set_startup_snapshot(C.int(flag))
+}
+
 func workerTableLookup(index workerTableIndex) *worker {
 	workerTableLock.Lock()
 	defer workerTableLock.Unlock()
@@ -90,6 +109,8 @@ func (w *Worker) Dispose() {
 		panic("worker already disposed")
 	}
 	w.disposed = true
+	w.worker.ring = nil
+	w.worker.ringData = nil
 	workerTableLock.Lock()
 	internalWorker := w.worker
 	delete(workerTable, internalWorker.tableIndex)
@@ -113,6 +134,74 @@ func (w *Worker) Load(sName string, codeString string) error {
 	return nil
 }
 
+// Stats - script compile, bucket cache, n1ql, queue, timer and recursion filter
+// diagnostics reported by the v8 worker
+type Stats struct {
+	CodeCacheHits    uint64 `json:"code_cache_hits"`
+	CodeCacheMisses  uint64 `json:"code_cache_misses"`
+	CodeCacheRejects uint64 `json:"code_cache_rejects"`
+	CompileTimeUs    uint64 `json:"compile_time_us"`
+
+	DocCacheHits        uint64 `json:"doc_cache_hits"`
+	DocCacheMisses      uint64 `json:"doc_cache_misses"`
+	DocCacheEvictions   uint64 `json:"doc_cache_evictions"`
+	DocCacheExpirations uint64 `json:"doc_cache_expirations"`
+	DocCacheEntries     uint64 `json:"doc_cache_entries"`
+
+	N1QLPreparedHits      uint64 `json:"n1ql_prepared_hits"`
+	N1QLPreparedMisses    uint64 `json:"n1ql_prepared_misses"`
+	N1QLPreparedEvictions uint64 `json:"n1ql_prepared_evictions"`
+	N1QLPreparedEntries   uint64 `json:"n1ql_prepared_entries"`
+	N1QLReprepares        uint64 `json:"n1ql_reprepares"`
+
+	// Result cache is shared by the app's isolates, counters are app-wide
+	N1QLResultCacheHits        uint64 `json:"n1ql_result_cache_hits"`
+	N1QLResultCacheMisses      uint64 `json:"n1ql_result_cache_misses"`
+	N1QLResultCacheEvictions   uint64 `json:"n1ql_result_cache_evictions"`
+	N1QLResultCacheExpirations uint64 `json:"n1ql_result_cache_expirations"`
+	N1QLResultCacheEntries     uint64 `json:"n1ql_result_cache_entries"`
+	N1QLResultCacheBytes       uint64 `json:"n1ql_result_cache_bytes"`
+	N1QLResultCacheTimeSavedUs uint64 `json:"n1ql_result_cache_time_saved_us"`
+
+	QueueEnqueued  uint64 `json:"queue_enqueued"`
+	QueueDelivered uint64 `json:"queue_delivered"`
+	QueueFailed    uint64 `json:"queue_failed"`
+	QueueDequeued  uint64 `json:"queue_dequeued"`
+	QueueInFlight  uint64 `json:"queue_in_flight"`
+
+	TimersScheduled uint64 `json:"timers_scheduled"`
+	TimersFired     uint64 `json:"timers_fired"`
+	TimersFailed    uint64 `json:"timers_failed"`
+	TimersSpilled   uint64 `json:"timers_spilled"`
+	TimersLoaded    uint64 `json:"timers_loaded"`
+	TimersInMemory  uint64 `json:"timers_in_memory"`
+	TimerTicks      uint64 `json:"timer_ticks"`
+	TimerTickLastUs uint64 `json:"timer_tick_last_us"`
+	TimerTickMaxUs  uint64 `json:"timer_tick_max_us"`
+	TimerTickAvgUs  uint64 `json:"timer_tick_avg_us"`
+	TimerLagMs      uint64 `json:"timer_lag_ms"`
+	TimerLagMaxMs   uint64 `json:"timer_lag_max_ms"`
+
+	SelfWritesSkipped             uint64  `json:"self_writes_skipped"`
+	FilterPassed                  uint64  `json:"filter_passed"`
+	FilterDropped                 uint64  `json:"filter_dropped"`
+	RecursionFilterWrites         uint64  `json:"recursion_filter_writes"`
+	RecursionFilterChecks         uint64  `json:"recursion_filter_checks"`
+	RecursionFilterTracked        uint64  `json:"recursion_filter_tracked"`
+	RecursionFilterFalsePositives uint64  `json:"recursion_filter_false_positives"`
+	RecursionFilterFPRate         float64 `json:"recursion_filter_fp_rate"`
+}
+
+// Stats returns compile diagnostics of last Load call, code cache
+// counters are cumulative for the worker
+func (w *Worker) Stats() Stats {
+	var stats Stats
+	cstats := C.worker_stats(w.worker.cWorker)
+	defer C.free(unsafe.Pointer(cstats))
+	json.Unmarshal([]byte(C.GoString(cstats)), &stats)
+	return stats
+}
+
 // SendDelete sends DCP_DELETION mutation to v8
 func (w *Worker) SendDelete(m string) error {
 	msg := C.CString(m)
@@ -144,6 +233,49 @@ func (w *Worker) SendUpdate(v string, m string, t string) error {
 	return nil
 }
 
+// SendUpdateBatch sends a batch of DCP_MUTATIONs to v8 in a single cgo call,
+// returns per-event status codes. values, metas and docTypes must be of
+// same length
+func (w *Worker) SendUpdateBatch(values, metas, docTypes []string) []int {
+	count := len(values)
+	results := make([]int, count)
+	if count == 0 {
+		return results
+	}
+
+	ptrSize := C.size_t(unsafe.Sizeof(uintptr(0)))
+	cValues := (**C.char)(C.malloc(C.size_t(count) * ptrSize))
+	defer C.free(unsafe.Pointer(cValues))
+	cMetas := (**C.char)(C.malloc(C.size_t(count) * ptrSize))
+	defer C.free(unsafe.Pointer(cMetas))
+	cTypes := (**C.char)(C.malloc(C.size_t(count) * ptrSize))
+	defer C.free(unsafe.Pointer(cTypes))
+	cResults := (*C.int)(C.malloc(C.size_t(count) * C.size_t(unsafe.Sizeof(C.int(0)))))
+	defer C.free(unsafe.Pointer(cResults))
+
+	valueSlice := (*[1 << 28]*C.char)(unsafe.Pointer(cValues))[:count:count]
+	metaSlice := (*[1 << 28]*C.char)(unsafe.Pointer(cMetas))[:count:count]
+	typeSlice := (*[1 << 28]*C.char)(unsafe.Pointer(cTypes))[:count:count]
+	resultSlice := (*[1 << 28]C.int)(unsafe.Pointer(cResults))[:count:count]
+
+	for i := 0; i < count; i++ {
+		valueSlice[i] = C.CString(values[i])
+		metaSlice[i] = C.CString(metas[i])
+		typeSlice[i] = C.CString(docTypes[i])
+	}
+
+	C.worker_send_update_batch(w.worker.cWorker, C.int(count),
+		cValues, cMetas, cTypes, cResults)
+
+	for i := 0; i < count; i++ {
+		results[i] = int(resultSlice[i])
+		C.free(unsafe.Pointer(valueSlice[i]))
+		C.free(unsafe.Pointer(metaSlice[i]))
+		C.free(unsafe.Pointer(typeSlice[i]))
+	}
+	return results
+}
+
 // TerminateExecution terminates execution of javascript
 func (w *Worker) TerminateExecution() {
 	C.worker_terminate_execution(w.worker.cWorker)
@@ -151,20 +283,52 @@ func (w *Worker) TerminateExecution() {
 
 // SendHTTPGet sends http GET request to JS world
 func (w *Worker) SendHTTPGet(r string) string {
-	req := C.CString(r)
-	defer C.free(unsafe.Pointer(req))
-
-	res := C.worker_send_http_get(w.worker.cWorker, req)
-	return C.GoString(res)
+	var res string
+	w.sendHTTP(r, false, func(body []byte) { res = string(body) })
+	return res
 }
 
 // SendHTTPPost sends http POST request to JS world
 func (w *Worker) SendHTTPPost(r string) string {
+	var res string
+	w.sendHTTP(r, true, func(body []byte) { res = string(body) })
+	return res
+}
+
+// WriteHTTPGet sends http GET request to JS world and writes the response
+// body to out straight from the worker's response buffer, without copying
+// it into the Go heap
+func (w *Worker) WriteHTTPGet(r string, out io.Writer) (n int, err error) {
+	w.sendHTTP(r, false, func(body []byte) { n, err = out.Write(body) })
+	return
+}
+
+// WriteHTTPPost is WriteHTTPGet for http POST
+func (w *Worker) WriteHTTPPost(r string, out io.Writer) (n int, err error) {
+	w.sendHTTP(r, true, func(body []byte) { n, err = out.Write(body) })
+	return
+}
+
+// sendHTTP hands response body to fn, body aliases C memory which gets
+// reused by the next http request on the worker. fn must not retain it
+func (w *Worker) sendHTTP(r string, post bool, fn func(body []byte)) {
 	req := C.CString(r)
 	defer C.free(unsafe.Pointer(req))
 
-	res := C.worker_send_http_post(w.worker.cWorker, req)
-	return C.GoString(res)
+	var length C.uint64_t
+	var res *C.char
+	if post {
+		res = C.worker_send_http_post(w.worker.cWorker, req, &length)
+	} else {
+		res = C.worker_send_http_get(w.worker.cWorker, req, &length)
+	}
+
+	n := int(length)
+	if n == 0 {
+		fn(nil)
+		return
+	}
+	fn((*[1 << 30]byte)(unsafe.Pointer(res))[:n:n])
 }
 
 // SendTimerCallback send list of keys against which timed callbacks need to be triggered
@@ -176,6 +340,23 @@ func (w *Worker) SendTimerCallback(k string) {
 	return
 }
 
+// SetTimerScope namespaces timers the worker spills to the metadata bucket,
+// so that isolates of an app don't fire each other's timers. scope has to
+// be stable across restarts, call it ahead of Load
+func (w *Worker) SetTimerScope(scope string) {
+	cScope := C.CString(scope)
+	defer C.free(unsafe.Pointer(cScope))
+
+	C.worker_set_timer_scope(w.worker.cWorker, cScope)
+}
+
+// FireTimers runs callbacks of registerCallback timers that are due, returns
+// number of timers fired. Timers have 100ms resolution, so calling it more
+// often than that is pointless
+func (w *Worker) FireTimers() int {
+	return int(C.worker_fire_timers(w.worker.cWorker))
+}
+
 func (w *Worker) StartV8Debugger() {
 	C.start_v8_debugger(w.worker.cWorker)
 }